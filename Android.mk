@@ -29,6 +29,7 @@ VKRUNNER_SRC_FILES := vkrunner/vr-allocate-store.c \
 	vkrunner/vr-box.c \
 	vkrunner/vr-buffer.c \
 	vkrunner/vr-char.c \
+	vkrunner/vr-compiler.c \
 	vkrunner/vr-config.c \
 	vkrunner/vr-context.c \
 	vkrunner/vr-error-message.c \
@@ -36,19 +37,26 @@ VKRUNNER_SRC_FILES := vkrunner/vr-allocate-store.c \
 	vkrunner/vr-feature-offsets.c \
 	vkrunner/vr-flush-memory.c \
 	vkrunner/vr-format.c \
+	vkrunner/vr-glslang.c \
 	vkrunner/vr-half-float.c \
 	vkrunner/vr-hex.c \
+	vkrunner/vr-instance.c \
 	vkrunner/vr-list.c \
+	vkrunner/vr-object-cache.c \
+	vkrunner/vr-pipeline-cache.c \
 	vkrunner/vr-pipeline.c \
 	vkrunner/vr-pipeline-key.c \
 	vkrunner/vr-result.c \
 	vkrunner/vr-script.c \
+	vkrunner/vr-shader-cache.c \
 	vkrunner/vr-source.c \
+	vkrunner/vr-spirv-tools.c \
 	vkrunner/vr-stream.c \
 	vkrunner/vr-strtof.c \
 	vkrunner/vr-subprocess.c \
 	vkrunner/vr-temp-file.c \
 	vkrunner/vr-test.c \
+	vkrunner/vr-thread.c \
 	vkrunner/vr-tolerance.c \
 	vkrunner/vr-util.c \
 	vkrunner/vr-vbo.c \
@@ -0,0 +1,126 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* A persistent compiler worker for the -w option of vkrunner. It
+ * reads compile requests on stdin and writes the replies to stdout
+ * until stdin is closed. Each request is compiled in the same way
+ * that VkRunner would compile it itself.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "vkrunner/vr-compiler.h"
+#include "vkrunner/vr-subprocess.h"
+#include "vkrunner/vr-util.h"
+
+static void
+error_cb(const char *message,
+         void *user_data)
+{
+        struct vr_buffer *output = user_data;
+
+        vr_buffer_append_string(output, message);
+        vr_buffer_append_c(output, '\n');
+}
+
+static void
+free_shaders(struct vr_list *shaders)
+{
+        struct vr_script_shader *shader, *tmp;
+
+        vr_list_for_each_safe(shader, tmp, shaders, link)
+                vr_free(shader);
+
+        vr_list_init(shaders);
+}
+
+int
+main(int argc, char **argv)
+{
+        struct vr_config *config = vr_config_new();
+        struct vr_buffer request = VR_BUFFER_STATIC_INIT;
+        struct vr_buffer reply = VR_BUFFER_STATIC_INIT;
+        struct vr_buffer output = VR_BUFFER_STATIC_INIT;
+        struct vr_buffer binary = VR_BUFFER_STATIC_INIT;
+        enum vr_compiler_result result;
+        enum vr_shader_stage stage;
+        struct vr_list shaders;
+        int ret = EXIT_SUCCESS;
+
+        vr_list_init(&shaders);
+
+        vr_config_set_error_cb(config, error_cb);
+        vr_config_set_user_data(config, &output);
+
+        while (true) {
+                vr_buffer_set_length(&request, 0);
+
+                if (!vr_subprocess_read_message(STDIN_FILENO, &request))
+                        break;
+
+                if (!vr_compiler_decode_request(request.data,
+                                                request.length,
+                                                &stage,
+                                                &shaders)) {
+                        fprintf(stderr, "Invalid compile request\n");
+                        ret = EXIT_FAILURE;
+                        break;
+                }
+
+                vr_buffer_set_length(&output, 0);
+                vr_buffer_set_length(&binary, 0);
+
+                result = vr_compiler_run(config,
+                                         stage,
+                                         &shaders,
+                                         NULL, /* output */
+                                         &binary);
+
+                free_shaders(&shaders);
+
+                vr_buffer_set_length(&reply, 0);
+                vr_compiler_encode_reply(&reply, result, &output, &binary);
+
+                if (!vr_subprocess_write_message(STDOUT_FILENO,
+                                                 reply.data,
+                                                 reply.length))
+                        break;
+        }
+
+        free_shaders(&shaders);
+
+        vr_buffer_destroy(&binary);
+        vr_buffer_destroy(&output);
+        vr_buffer_destroy(&reply);
+        vr_buffer_destroy(&request);
+
+        vr_config_free(config);
+
+        return ret;
+}
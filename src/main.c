@@ -30,10 +30,25 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <math.h>
+#include <signal.h>
 
 #include <vkrunner/vkrunner.h>
 
+#include "vkrunner/vr-buffer.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "vkrunner/vr-subprocess.h"
+#endif
+
 struct string_array {
         char **data;
         size_t length;
@@ -50,6 +65,25 @@ struct main_data {
         int binding;
         bool inspect_failed;
         bool quiet;
+        bool shader_cache;
+        bool memory_stats;
+        bool batch;
+        bool group;
+        unsigned n_jobs;
+        /* Shader cache stats collected from the job workers */
+        unsigned worker_cache_hits;
+        unsigned worker_cache_misses;
+        bool server;
+        const char *server_socket;
+        /* Where to store the error messages when they are buffered */
+        struct string_array *messages;
+};
+
+struct script_run {
+        struct vr_script *script;
+        enum vr_result result;
+        /* Error messages buffered while the scripts are reordered */
+        struct string_array messages;
 };
 
 typedef bool (* option_cb_t) (struct main_data *data,
@@ -64,6 +98,10 @@ struct option {
          */
         char *argument_name;
         option_cb_t cb;
+        /* Name of the option if it only has a long form such as
+         * --server. In that case the letter is zero.
+         */
+        const char *long_name;
 };
 
 static bool
@@ -132,6 +170,99 @@ opt_disassembly(struct main_data *data,
         return true;
 }
 
+static bool
+opt_shader_cache(struct main_data *data,
+                 const char *arg)
+{
+        vr_config_set_shader_cache_dir(data->config, arg);
+        data->shader_cache = true;
+        return true;
+}
+
+static bool
+opt_memory_stats(struct main_data *data,
+                 const char *arg)
+{
+        data->memory_stats = true;
+        return true;
+}
+
+static bool
+opt_compiler_worker(struct main_data *data,
+                    const char *arg)
+{
+        vr_config_set_compiler_worker(data->config, arg);
+        return true;
+}
+
+static bool
+opt_pipeline_cache(struct main_data *data,
+                   const char *arg)
+{
+        vr_config_set_pipeline_cache_file(data->config, arg);
+        return true;
+}
+
+static bool
+opt_pipeline_threads(struct main_data *data,
+                     const char *arg)
+{
+        vr_config_set_pipeline_threads(data->config, strtoul(arg, NULL, 0));
+        return true;
+}
+
+static bool
+opt_batch(struct main_data *data,
+          const char *arg)
+{
+        data->batch = true;
+        return true;
+}
+
+static bool
+opt_group(struct main_data *data,
+          const char *arg)
+{
+        data->group = true;
+        return true;
+}
+
+static bool
+opt_jobs(struct main_data *data,
+         const char *arg)
+{
+        char *tail;
+
+        errno = 0;
+        long n_jobs = strtol(arg, &tail, 10);
+
+        if (errno || *tail || n_jobs < 1 || n_jobs > 1024) {
+                fprintf(stderr, "invalid number of jobs: %s\n", arg);
+                return false;
+        }
+
+        data->n_jobs = n_jobs;
+
+        return true;
+}
+
+static bool
+opt_server(struct main_data *data,
+           const char *arg)
+{
+        data->server = true;
+        return true;
+}
+
+static bool
+opt_listen(struct main_data *data,
+           const char *arg)
+{
+        data->server = true;
+        data->server_socket = arg;
+        return true;
+}
+
 static bool
 opt_token_replacement(struct main_data *data,
                       const char *arg)
@@ -166,6 +297,35 @@ opt_quiet(struct main_data *data,
         return true;
 }
 
+static bool
+opt_window_cache_size(struct main_data *data,
+                      const char *arg)
+{
+        char *tail;
+
+        errno = 0;
+        unsigned long size = strtoul(arg, &tail, 10);
+
+        if (errno || *tail || tail == arg || *arg == '-' ||
+            size > SIZE_MAX / (1024 * 1024)) {
+                fprintf(stderr, "invalid window cache size: %s\n", arg);
+                return false;
+        }
+
+        vr_config_set_window_cache_size(data->config, size * 1024 * 1024);
+
+        return true;
+}
+
+static bool
+opt_immediate_probes(struct main_data *data,
+                     const char *arg)
+{
+        vr_config_set_deferred_probes(data->config, false);
+
+        return true;
+}
+
 static const struct option
 options[] = {
         { 'h', "Show this help message", NULL, opt_help },
@@ -177,10 +337,32 @@ options[] = {
           "Defaults to first buffer", "BINDING",
           opt_binding },
         { 'd', "Show the SPIR-V disassembly", NULL, opt_disassembly },
+        { 'c', "Cache the compiled shaders in DIR", "DIR",
+          opt_shader_cache },
+        { 'M', "Show how much device memory was used for the buffers",
+          NULL, opt_memory_stats },
+        { 'w', "Compile the shaders with a pool of WORKER processes",
+          "WORKER", opt_compiler_worker },
+        { 'p', "Keep a Vulkan pipeline cache in FILE", "FILE",
+          opt_pipeline_cache },
+        { 't', "Create the pipelines of each script with N threads", "N",
+          opt_pipeline_threads },
+        { 'S', "Share one device with the features of all of the scripts",
+          NULL, opt_batch },
+        { 'g', "Run the scripts with the same requirements together", NULL,
+          opt_group },
+        { 'j', "Run the scripts in N worker processes", "N", opt_jobs },
         { 'D', "Replace occurences of TOK with REPL in the scripts",
           "TOK=REPL", opt_token_replacement },
         { 'q', "Don’t print any non-error information to stdout", NULL,
-          opt_quiet }
+          opt_quiet },
+        { 0, "Check each probe as soon as it is reached", NULL,
+          opt_immediate_probes, "immediate-probes" },
+        { 0, "Keep up to MIB mebibytes of windows for reuse", "MIB",
+          opt_window_cache_size, "window-cache-size" },
+        { 0, "Read scripts to run from stdin", NULL, opt_server, "server" },
+        { 0, "Like --server but read from a UNIX socket at PATH", "PATH",
+          opt_listen, "listen" },
 };
 
 #define N_OPTIONS (sizeof options / sizeof options[0])
@@ -195,13 +377,26 @@ opt_help(struct main_data *data,
                "Options:\n");
 
         for (int i = 0; i < N_OPTIONS; i++) {
-                printf("  -%c %-10s %s\n",
-                       options[i].letter,
-                       options[i].argument_name ?
-                       options[i].argument_name :
-                       "",
-                       options[i].description);
-
+                const char *arg_name = (options[i].argument_name ?
+                                        options[i].argument_name :
+                                        "");
+
+                if (options[i].letter) {
+                        printf("  -%c %-10s %s\n",
+                               options[i].letter,
+                               arg_name,
+                               options[i].description);
+                } else {
+                        char name[64];
+
+                        snprintf(name, sizeof name,
+                                 "%s %s",
+                                 options[i].long_name,
+                                 arg_name);
+                        printf("  --%-11s %s\n",
+                               name,
+                               options[i].description);
+                }
         }
 
         return false;
@@ -237,6 +432,58 @@ handle_option(struct main_data *data,
         return option->cb(data, arg);
 }
 
+static bool
+handle_long_option(struct main_data *data,
+                   const char *name,
+                   int argc, char **argv,
+                   int *arg_num)
+{
+        const char *equals = strchr(name, '=');
+        size_t name_length = equals ? equals - name : strlen(name);
+
+        for (int i = 0; i < N_OPTIONS; i++) {
+                const char *long_name = options[i].long_name;
+                const char *arg = NULL;
+
+                if (long_name == NULL ||
+                    strlen(long_name) != name_length ||
+                    memcmp(long_name, name, name_length))
+                        continue;
+
+                if (options[i].argument_name) {
+                        if (equals) {
+                                arg = equals + 1;
+                        } else {
+                                (*arg_num)++;
+                                if (*arg_num >= argc) {
+                                        fprintf(stderr,
+                                                "option ‘--%s’ expects an "
+                                                "argument\n",
+                                                long_name);
+                                        opt_help(data, NULL);
+                                        return false;
+                                }
+                                arg = argv[*arg_num];
+                        }
+                } else if (equals) {
+                        fprintf(stderr,
+                                "option ‘--%s’ doesn’t take an argument\n",
+                                long_name);
+                        opt_help(data, NULL);
+                        return false;
+                }
+
+                return options[i].cb(data, arg);
+        }
+
+        fprintf(stderr,
+                "unknown option ‘--%.*s’\n",
+                (int) name_length,
+                name);
+        opt_help(data, NULL);
+        return false;
+}
+
 static bool
 process_argv(struct main_data *data,
              int argc, char **argv)
@@ -250,6 +497,15 @@ process_argv(struct main_data *data,
                                 continue;
                         }
 
+                        if (argv[i][1] == '-') {
+                                if (!handle_long_option(data,
+                                                        argv[i] + 2,
+                                                        argc, argv,
+                                                        &i))
+                                        return false;
+                                continue;
+                        }
+
                         for (const char *p = argv[i] + 1; *p; p++) {
                                 for (int option_num = 0;
                                      option_num < N_OPTIONS;
@@ -287,12 +543,24 @@ process_argv(struct main_data *data,
                 }
         }
 
-        if (data->filenames.length <= 0) {
+        if (data->filenames.length <= 0 && !data->server) {
                 fprintf(stderr, "no script specified\n");
                 opt_help(data, NULL);
                 return false;
         }
 
+        /* The workers each have their own executor so these options
+         * wouldn’t do anything.
+         */
+        if (data->n_jobs > 1 &&
+            (data->image_filename || data->buffer_filename ||
+             data->batch || data->group || data->memory_stats)) {
+                fprintf(stderr,
+                        "-j can’t be used together with -i, -b, -S, -g or "
+                        "-M\n");
+                return false;
+        }
+
         return true;
 }
 
@@ -427,29 +695,923 @@ add_token_replacements(struct main_data *data,
         }
 }
 
+static struct vr_script *
+load_script(struct main_data *data,
+            const char *filename)
+{
+        struct vr_source *source = vr_source_from_file(filename);
+
+        add_token_replacements(data, source);
+
+        struct vr_script *script = vr_script_load(data->config, source);
+
+        vr_source_free(source);
+
+        return script;
+}
+
+static void
+error_cb(const char *message,
+         void *user_data)
+{
+        struct main_data *data = user_data;
+
+        /* Errors that aren’t reported while a script is being run,
+         * such as when the executor is freed, are printed as usual.
+         */
+        if (data->messages)
+                string_array_add(data->messages, message);
+        else
+                fprintf(stderr, "%s\n", message);
+}
+
+/* Prints the filename and the buffered messages of a script */
+static void
+print_script_run(struct main_data *data,
+                 size_t script_num,
+                 const struct script_run *run)
+{
+        if (data->filenames.length > 1 && !data->quiet)
+                printf("%s\n", data->filenames.data[script_num]);
+
+        fflush(stdout);
+
+        for (size_t i = 0; i < run->messages.length; i++)
+                fprintf(stderr, "%s\n", run->messages.data[i]);
+}
+
+/* Fills in the order to run the scripts in so that the scripts that
+ * need the same device and window are run one after the other.
+ */
+static void
+group_scripts(const struct script_run *runs,
+              size_t n_runs,
+              size_t *order)
+{
+        bool *added = calloc(n_runs, sizeof *added);
+        size_t n_added = 0;
+
+        for (size_t i = 0; i < n_runs; i++) {
+                if (added[i])
+                        continue;
+
+                order[n_added++] = i;
+                added[i] = true;
+
+                if (runs[i].script == NULL)
+                        continue;
+
+                for (size_t j = i + 1; j < n_runs; j++) {
+                        if (added[j] ||
+                            runs[j].script == NULL ||
+                            !vr_script_requirements_equal(runs[i].script,
+                                                          runs[j].script))
+                                continue;
+
+                        order[n_added++] = j;
+                        added[j] = true;
+                }
+        }
+
+        free(added);
+}
+
+#ifndef WIN32
+
+struct job_worker {
+        pid_t pid;
+        /* Socket connected to the worker or -1 if it isn’t running */
+        int fd;
+        /* The script that the worker is running */
+        size_t script_num;
+};
+
+/* Main loop of a forked worker process. It reads the number of a
+ * script to run from the socket and replies with the result, the
+ * shader cache hits and misses of the script and then the error
+ * messages.
+ */
+static void
+run_job_worker(struct main_data *data,
+               int fd)
+{
+        struct vr_buffer request = VR_BUFFER_STATIC_INIT;
+        struct vr_buffer reply = VR_BUFFER_STATIC_INIT;
+        struct string_array messages = { .data = NULL };
+
+        vr_config_set_error_cb(data->config, error_cb);
+        data->messages = &messages;
+
+        while (true) {
+                uint32_t script_num;
+                uint32_t result;
+                unsigned hits_before, misses_before, hits, misses;
+                uint32_t cache_stats[2];
+
+                vr_buffer_set_length(&request, 0);
+
+                if (!vr_subprocess_read_message(fd, &request) ||
+                    request.length != sizeof script_num)
+                        break;
+
+                memcpy(&script_num, request.data, sizeof script_num);
+
+                vr_config_get_shader_cache_stats(data->config,
+                                                 &hits_before,
+                                                 &misses_before);
+
+                struct vr_script *script =
+                        load_script(data, data->filenames.data[script_num]);
+
+                if (script) {
+                        result = vr_executor_execute_script(data->executor,
+                                                            script);
+                        vr_script_free(script);
+                } else {
+                        result = VR_RESULT_FAIL;
+                }
+
+                vr_config_get_shader_cache_stats(data->config,
+                                                 &hits,
+                                                 &misses);
+                cache_stats[0] = hits - hits_before;
+                cache_stats[1] = misses - misses_before;
+
+                vr_buffer_set_length(&reply, 0);
+                vr_buffer_append(&reply, &result, sizeof result);
+                vr_buffer_append(&reply, cache_stats, sizeof cache_stats);
+
+                for (size_t i = 0; i < messages.length; i++) {
+                        if (i > 0)
+                                vr_buffer_append_c(&reply, '\n');
+                        vr_buffer_append_string(&reply, messages.data[i]);
+                }
+
+                string_array_destroy(&messages);
+                memset(&messages, 0, sizeof messages);
+
+                if (!vr_subprocess_write_message(fd, reply.data, reply.length))
+                        break;
+        }
+
+        data->messages = NULL;
+
+        string_array_destroy(&messages);
+        vr_buffer_destroy(&reply);
+        vr_buffer_destroy(&request);
+}
+
+static bool
+start_job_worker(struct main_data *data,
+                 struct job_worker *workers,
+                 size_t n_workers,
+                 struct job_worker *worker)
+{
+        int sv[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+                fprintf(stderr, "socketpair: %s\n", strerror(errno));
+                return false;
+        }
+
+        /* Make sure the child doesn’t inherit any buffered output */
+        fflush(stdout);
+        fflush(stderr);
+
+        pid_t pid = fork();
+
+        if (pid < 0) {
+                fprintf(stderr, "fork failed: %s\n", strerror(errno));
+                close(sv[0]);
+                close(sv[1]);
+                return false;
+        } else if (pid == 0) {
+                close(sv[0]);
+                for (size_t i = 0; i < n_workers; i++) {
+                        if (workers[i].fd != -1)
+                                close(workers[i].fd);
+                }
+                run_job_worker(data, sv[1]);
+                vr_executor_free(data->executor);
+                exit(EXIT_SUCCESS);
+        }
+
+        close(sv[1]);
+
+        worker->pid = pid;
+        worker->fd = sv[0];
+
+        return true;
+}
+
+static void
+stop_job_worker(struct job_worker *worker)
+{
+        /* Closing the socket tells the worker to quit */
+        close(worker->fd);
+        while (waitpid(worker->pid, NULL, 0 /* options */) == -1 &&
+               errno == EINTR);
+        worker->fd = -1;
+}
+
+static void
+send_job(struct job_worker *worker,
+         size_t script_num)
+{
+        uint32_t script_num32 = script_num;
+
+        worker->script_num = script_num;
+
+        /* If this fails then the worker has died and it will be
+         * noticed when trying to read the reply.
+         */
+        vr_subprocess_write_message(worker->fd,
+                                    &script_num32,
+                                    sizeof script_num32);
+}
+
+static void
+finish_job(struct main_data *data,
+           struct job_worker *worker,
+           struct script_run *run)
+{
+        struct vr_buffer reply = VR_BUFFER_STATIC_INIT;
+        uint32_t result;
+        uint32_t cache_stats[2];
+        const size_t header_size = sizeof result + sizeof cache_stats;
+
+        if (vr_subprocess_read_message(worker->fd, &reply) &&
+            reply.length >= header_size) {
+                memcpy(&result, reply.data, sizeof result);
+                run->result = result;
+
+                memcpy(cache_stats,
+                       reply.data + sizeof result,
+                       sizeof cache_stats);
+                data->worker_cache_hits += cache_stats[0];
+                data->worker_cache_misses += cache_stats[1];
+
+                if (reply.length > header_size) {
+                        vr_buffer_append_c(&reply, '\0');
+                        string_array_add(&run->messages,
+                                         (const char *) reply.data +
+                                         header_size);
+                }
+        } else {
+                run->result = VR_RESULT_FAIL;
+                string_array_add(&run->messages,
+                                 "The worker process running the script "
+                                 "died");
+                stop_job_worker(worker);
+        }
+
+        vr_buffer_destroy(&reply);
+}
+
+/* Runs the scripts in a pool of forked worker processes, each with
+ * its own executor. The scripts are handed out in order to the
+ * workers as they become idle and the results are printed in the
+ * original order. If a worker dies then its script fails and a new
+ * worker is started for the remaining scripts.
+ */
+static enum vr_result
+run_jobs(struct main_data *data)
+{
+        enum vr_result overall_result = VR_RESULT_SKIP;
+        size_t n_scripts = data->filenames.length;
+        size_t n_workers = (data->n_jobs < n_scripts ?
+                            data->n_jobs :
+                            n_scripts);
+        struct job_worker *workers = malloc(n_workers * sizeof *workers);
+        struct script_run *runs = calloc(n_scripts, sizeof *runs);
+        bool *finished = calloc(n_scripts, sizeof *finished);
+        struct pollfd *pollfds = malloc(n_workers * sizeof *pollfds);
+        size_t *pollfd_workers = malloc(n_workers * sizeof *pollfd_workers);
+        size_t next_script = 0, next_print = 0;
+
+        for (size_t i = 0; i < n_workers; i++)
+                workers[i].fd = -1;
+
+        while (next_print < n_scripts) {
+                size_t n_pollfds = 0;
+
+                /* Give a script to every idle worker, starting new
+                 * ones if needed.
+                 */
+                for (size_t i = 0; i < n_workers; i++) {
+                        if (next_script >= n_scripts)
+                                break;
+
+                        if (workers[i].fd == -1) {
+                                if (!start_job_worker(data,
+                                                      workers,
+                                                      n_workers,
+                                                      workers + i))
+                                        continue;
+                        } else if (!finished[workers[i].script_num]) {
+                                continue;
+                        }
+
+                        send_job(workers + i, next_script++);
+                }
+
+                for (size_t i = 0; i < n_workers; i++) {
+                        if (workers[i].fd == -1 ||
+                            finished[workers[i].script_num])
+                                continue;
+
+                        pollfds[n_pollfds].fd = workers[i].fd;
+                        pollfds[n_pollfds].events = POLLIN;
+                        pollfd_workers[n_pollfds] = i;
+                        n_pollfds++;
+                }
+
+                if (n_pollfds == 0) {
+                        /* No workers could be started so give up on
+                         * the remaining scripts.
+                         */
+                        for (; next_script < n_scripts; next_script++) {
+                                string_array_add(&runs[next_script].messages,
+                                                 "No worker process could be "
+                                                 "started to run the script");
+                                runs[next_script].result = VR_RESULT_FAIL;
+                                finished[next_script] = true;
+                        }
+                } else if (poll(pollfds, n_pollfds, -1 /* timeout */) == -1) {
+                        if (errno != EINTR) {
+                                fprintf(stderr, "poll: %s\n", strerror(errno));
+                                overall_result = VR_RESULT_FAIL;
+                                break;
+                        }
+                        continue;
+                }
+
+                for (size_t i = 0; i < n_pollfds; i++) {
+                        if (pollfds[i].revents == 0)
+                                continue;
+
+                        struct job_worker *worker =
+                                workers + pollfd_workers[i];
+                        size_t script_num = worker->script_num;
+
+                        finish_job(data, worker, runs + script_num);
+                        finished[script_num] = true;
+                }
+
+                for (; next_print < n_scripts && finished[next_print];
+                     next_print++) {
+                        struct script_run *run = runs + next_print;
+
+                        print_script_run(data, next_print, run);
+                        string_array_destroy(&run->messages);
+
+                        overall_result = vr_result_merge(run->result,
+                                                         overall_result);
+                }
+        }
+
+        for (size_t i = 0; i < n_workers; i++) {
+                if (workers[i].fd != -1)
+                        stop_job_worker(workers + i);
+        }
+
+        free(pollfd_workers);
+        free(pollfds);
+        free(finished);
+        free(runs);
+        free(workers);
+
+        return overall_result;
+}
+
+#endif /* WIN32 */
+
 static enum vr_result
 run_scripts(struct main_data *data)
 {
+#ifndef WIN32
+        if (data->n_jobs > 1 && data->filenames.length > 1)
+                return run_jobs(data);
+#endif
+
         enum vr_result overall_result = VR_RESULT_SKIP;
+        size_t n_scripts = data->filenames.length;
+        struct script_run *runs = calloc(n_scripts, sizeof *runs);
+        size_t *order = malloc(n_scripts * sizeof *order);
+        /* In batch mode all of the scripts are loaded up front so
+         * that the executor can create a single device for all of
+         * them. They are also needed up front to group them.
+         */
+        bool preload = data->batch || data->group;
+
+        /* When the scripts are reordered the messages are buffered
+         * so that they can be reported in the original order.
+         */
+        if (data->group)
+                vr_config_set_error_cb(data->config, error_cb);
+
+        if (preload) {
+                for (size_t i = 0; i < n_scripts; i++) {
+                        data->messages = &runs[i].messages;
+                        runs[i].script = load_script(data,
+                                                     data->filenames.data[i]);
+                        if (data->batch && runs[i].script) {
+                                vr_executor_add_batch_script(data->executor,
+                                                             runs[i].script);
+                        }
+                }
+        }
+
+        if (data->group) {
+                group_scripts(runs, n_scripts, order);
+        } else {
+                for (size_t i = 0; i < n_scripts; i++)
+                        order[i] = i;
+        }
 
-        for (size_t i = 0; i < data->filenames.length; i++) {
-                const char *filename = data->filenames.data[i];
+        for (size_t i = 0; i < n_scripts; i++) {
+                struct script_run *run = runs + order[i];
+                const char *filename = data->filenames.data[order[i]];
 
-                if (data->filenames.length > 1 && !data->quiet)
+                if (!data->group && n_scripts > 1 && !data->quiet)
                         printf("%s\n", filename);
 
-                struct vr_source *source = vr_source_from_file(filename);
+                data->messages = &run->messages;
+
+                if (!preload)
+                        run->script = load_script(data, filename);
+
+                if (run->script) {
+                        run->result =
+                                vr_executor_execute_script(data->executor,
+                                                           run->script);
+                        vr_script_free(run->script);
+                } else {
+                        run->result = VR_RESULT_FAIL;
+                }
+        }
+
+        for (size_t i = 0; i < n_scripts; i++) {
+                struct script_run *run = runs + i;
+
+                if (data->group)
+                        print_script_run(data, i, run);
+
+                string_array_destroy(&run->messages);
+
+                overall_result = vr_result_merge(run->result, overall_result);
+        }
+
+        data->messages = NULL;
+
+        free(order);
+        free(runs);
+
+        return overall_result;
+}
+
+#define INLINE_SCRIPT_PREFIX "inline "
+/* Largest inline script that the server will accept */
+#define MAX_INLINE_SCRIPT_SIZE (64 * 1024 * 1024)
+
+/* Set by the signal handlers of the socket server to make it stop */
+static volatile sig_atomic_t
+quit_server = 0;
+
+/* Returns the length of the valid UTF-8 sequence at p or 0 if it
+ * isn’t valid.
+ */
+static int
+get_utf8_sequence_length(const unsigned char *p)
+{
+        unsigned char min = 0x80, max = 0xbf;
+        int length;
+
+        if (p[0] < 0x80)
+                return 1;
+        else if (p[0] >= 0xc2 && p[0] <= 0xdf)
+                length = 2;
+        else if (p[0] >= 0xe0 && p[0] <= 0xef)
+                length = 3;
+        else if (p[0] >= 0xf0 && p[0] <= 0xf4)
+                length = 4;
+        else
+                return 0;
+
+        /* Reject overlong encodings, surrogates and code points
+         * above U+10FFFF.
+         */
+        if (p[0] == 0xe0)
+                min = 0xa0;
+        else if (p[0] == 0xed)
+                max = 0x9f;
+        else if (p[0] == 0xf0)
+                min = 0x90;
+        else if (p[0] == 0xf4)
+                max = 0x8f;
+
+        if (p[1] < min || p[1] > max)
+                return 0;
+
+        /* The terminating zero stops this at the end of the string */
+        for (int i = 2; i < length; i++) {
+                if (p[i] < 0x80 || p[i] > 0xbf)
+                        return 0;
+        }
+
+        return length;
+}
+
+static void
+write_json_string(FILE *out,
+                  const char *str)
+{
+        fputc('"', out);
+
+        for (const char *p = str; *p; p++) {
+                switch (*p) {
+                case '"':
+                        fputs("\\\"", out);
+                        break;
+                case '\\':
+                        fputs("\\\\", out);
+                        break;
+                case '\n':
+                        fputs("\\n", out);
+                        break;
+                case '\t':
+                        fputs("\\t", out);
+                        break;
+                default:
+                        if ((unsigned char) *p < ' ') {
+                                fprintf(out, "\\u%04x", *p);
+                                break;
+                        }
+
+                        /* Compiler output isn’t necessarily valid
+                         * UTF-8 so replace any invalid bytes to
+                         * keep the JSON valid.
+                         */
+                        int length = get_utf8_sequence_length(
+                                (const unsigned char *) p);
+
+                        if (length == 0) {
+                                fputs("\\ufffd", out);
+                        } else {
+                                fwrite(p, 1, length, out);
+                                p += length - 1;
+                        }
+                        break;
+                }
+        }
+
+        fputc('"', out);
+}
+
+/* Reads a line without the line terminator. Returns false if the
+ * end of the input is reached before any characters are read.
+ */
+static bool
+read_line(FILE *in,
+          struct vr_buffer *buffer)
+{
+        int c;
+
+        vr_buffer_set_length(buffer, 0);
+
+        while ((c = fgetc(in)) != EOF && c != '\n')
+                vr_buffer_append_c(buffer, c);
+
+        /* If reading was interrupted then the line may be incomplete
+         * so it is dropped.
+         */
+        if (c == EOF && (buffer->length == 0 || ferror(in)))
+                return false;
+
+        if (buffer->length > 0 && buffer->data[buffer->length - 1] == '\r')
+                buffer->length--;
+
+        vr_buffer_append_c(buffer, '\0');
+
+        return true;
+}
+
+static void
+write_server_reply(FILE *out,
+                   const char *filename,
+                   enum vr_result result,
+                   const struct string_array *messages)
+{
+        fputs("{\"script\": ", out);
+        if (filename)
+                write_json_string(out, filename);
+        else
+                fputs("null", out);
+        fprintf(out, ", \"result\": \"%s\", \"messages\": [",
+                vr_result_to_string(result));
+        for (size_t i = 0; i < messages->length; i++) {
+                if (i > 0)
+                        fputs(", ", out);
+                write_json_string(out, messages->data[i]);
+        }
+        fputs("]}\n", out);
+        fflush(out);
+}
+
+/* Skips the given number of bytes of the input. Returns false if the
+ * input ends first.
+ */
+static bool
+skip_input(FILE *in,
+           unsigned long length)
+{
+        char buf[512];
+
+        while (length > 0) {
+                size_t chunk = length < sizeof buf ? length : sizeof buf;
+
+                if (fread(buf, 1, chunk, in) != chunk)
+                        return false;
+
+                length -= chunk;
+        }
+
+        return true;
+}
+
+/* Reads the script of an inline request into script_buffer. If the
+ * request is invalid then an error is added to messages and NULL is
+ * returned, unless the input ends in which case *eof is set.
+ */
+static struct vr_source *
+read_inline_script(FILE *in,
+                   const char *request,
+                   struct vr_buffer *script_buffer,
+                   struct string_array *messages,
+                   bool *eof)
+{
+        const char *length_str = request + sizeof INLINE_SCRIPT_PREFIX - 1;
+        unsigned long length;
+        char *tail;
+
+        errno = 0;
+        length = strtoul(length_str, &tail, 10);
+
+        if (errno || tail == length_str || *tail) {
+                string_array_add(messages, "Invalid inline script length");
+                return NULL;
+        }
+
+        /* The script is still skipped so that the next request can
+         * be read.
+         */
+        if (length > MAX_INLINE_SCRIPT_SIZE) {
+                string_array_add(messages, "Inline script is too large");
+                *eof = !skip_input(in, length);
+                return NULL;
+        }
+
+        vr_buffer_set_length(script_buffer, 0);
+        vr_buffer_ensure_size(script_buffer, length + 1);
+
+        if (fread(script_buffer->data, 1, length, in) != length) {
+                *eof = true;
+                return NULL;
+        }
+
+        script_buffer->data[length] = '\0';
+
+        return vr_source_from_string((const char *) script_buffer->data);
+}
 
+/* Runs the script for one request and writes the reply. The request
+ * is either the filename of a script or “inline N” followed by N
+ * bytes containing the script. Returns false if the input ends in
+ * the middle of the request.
+ */
+static bool
+handle_server_request(struct main_data *data,
+                      FILE *in,
+                      FILE *out,
+                      const char *request,
+                      struct vr_buffer *script_buffer)
+{
+        struct string_array messages = { .data = NULL };
+        const char *filename = NULL;
+        struct vr_source *source;
+        enum vr_result result = VR_RESULT_FAIL;
+        bool eof = false;
+
+        data->messages = &messages;
+
+        if (!strncmp(request,
+                     INLINE_SCRIPT_PREFIX,
+                     sizeof INLINE_SCRIPT_PREFIX - 1)) {
+                source = read_inline_script(in,
+                                            request,
+                                            script_buffer,
+                                            &messages,
+                                            &eof);
+                if (eof)
+                        goto out;
+        } else {
+                filename = request;
+                source = vr_source_from_file(filename);
+        }
+
+        if (source) {
                 add_token_replacements(data, source);
 
-                enum vr_result result = vr_executor_execute(data->executor,
-                                                            source);
+                struct vr_script *script = vr_script_load(data->config,
+                                                          source);
+
                 vr_source_free(source);
 
-                overall_result = vr_result_merge(result, overall_result);
+                if (script) {
+                        result = vr_executor_execute_script(data->executor,
+                                                            script);
+                        vr_script_free(script);
+                }
         }
 
-        return overall_result;
+        write_server_reply(out, filename, result, &messages);
+
+out:
+        data->messages = NULL;
+        string_array_destroy(&messages);
+
+        return !eof;
+}
+
+static void
+serve_stream(struct main_data *data,
+             FILE *in,
+             FILE *out)
+{
+        struct vr_buffer request = VR_BUFFER_STATIC_INIT;
+        struct vr_buffer script_buffer = VR_BUFFER_STATIC_INIT;
+
+        while (!quit_server && read_line(in, &request)) {
+                if (request.data[0] == '\0')
+                        continue;
+
+                if (!handle_server_request(data,
+                                           in, out,
+                                           (const char *) request.data,
+                                           &script_buffer))
+                        break;
+        }
+
+        vr_buffer_destroy(&script_buffer);
+        vr_buffer_destroy(&request);
+}
+
+#ifndef WIN32
+
+static void
+quit_server_cb(int signum)
+{
+        quit_server = 1;
+}
+
+/* Removes a socket left behind by a previous server. Anything else
+ * at the path is left alone so that bind will report an error.
+ */
+static void
+remove_stale_socket(const char *path)
+{
+        struct stat statbuf;
+
+        if (lstat(path, &statbuf) == 0 && S_ISSOCK(statbuf.st_mode))
+                unlink(path);
+}
+
+/* Accepts connections on a UNIX socket one at a time and serves the
+ * requests of each until it is closed. This runs until SIGINT or
+ * SIGTERM is received or there is an error. The socket file is
+ * removed before returning.
+ */
+static bool
+serve_socket(struct main_data *data)
+{
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        const char *path = data->server_socket;
+        bool ret = true;
+
+        if (strlen(path) >= sizeof addr.sun_path) {
+                fprintf(stderr, "%s: socket path is too long\n", path);
+                return false;
+        }
+
+        strcpy(addr.sun_path, path);
+
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (sock == -1) {
+                fprintf(stderr, "socket: %s\n", strerror(errno));
+                return false;
+        }
+
+        remove_stale_socket(path);
+
+        if (bind(sock, (struct sockaddr *) &addr, sizeof addr) == -1) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                close(sock);
+                return false;
+        }
+
+        if (listen(sock, 1 /* backlog */) == -1) {
+                fprintf(stderr, "%s: %s\n", path, strerror(errno));
+                ret = false;
+                goto out;
+        }
+
+        /* A client disconnecting before reading its reply shouldn’t
+         * kill the server.
+         */
+        signal(SIGPIPE, SIG_IGN);
+
+        /* Without SA_RESTART the signals interrupt accept and any
+         * reads so that the loop notices them.
+         */
+        struct sigaction quit_action = { .sa_handler = quit_server_cb };
+        sigemptyset(&quit_action.sa_mask);
+        sigaction(SIGINT, &quit_action, NULL);
+        sigaction(SIGTERM, &quit_action, NULL);
+
+        while (!quit_server) {
+                int fd = accept(sock, NULL, NULL);
+
+                if (fd == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        fprintf(stderr, "accept: %s\n", strerror(errno));
+                        ret = false;
+                        break;
+                }
+
+                int out_fd = dup(fd);
+                FILE *in = fdopen(fd, "r");
+                FILE *out = out_fd == -1 ? NULL : fdopen(out_fd, "w");
+
+                if (in && out)
+                        serve_stream(data, in, out);
+
+                if (in)
+                        fclose(in);
+                else
+                        close(fd);
+                if (out)
+                        fclose(out);
+                else if (out_fd != -1)
+                        close(out_fd);
+        }
+
+out:
+        close(sock);
+        unlink(path);
+
+        return ret;
+}
+
+#endif /* WIN32 */
+
+/* Keeps the executor alive and runs scripts as they are requested
+ * so that the device only has to be created once. Each result is
+ * written as a line of JSON.
+ */
+static bool
+run_server(struct main_data *data)
+{
+        if (data->filenames.length > 0) {
+                fprintf(stderr, "scripts can’t be given on the command "
+                        "line in server mode\n");
+                return false;
+        }
+
+        if (data->image_filename || data->buffer_filename ||
+            data->batch || data->group || data->n_jobs > 1 ||
+            data->memory_stats) {
+                fprintf(stderr, "server mode can’t be used together with "
+                        "-i, -b, -S, -g, -j or -M\n");
+                return false;
+        }
+
+        /* The error messages are sent as part of the reply */
+        vr_config_set_error_cb(data->config, error_cb);
+
+        if (data->server_socket) {
+#ifdef WIN32
+                fprintf(stderr, "--listen isn’t supported on Windows\n");
+                return false;
+#else
+                return serve_socket(data);
+#endif
+        }
+
+        serve_stream(data, stdin, stdout);
+
+        return true;
 }
 
 int
@@ -467,14 +1629,49 @@ main(int argc, char **argv)
         };
 
         vr_config_set_user_data(config, &data);
-        vr_config_set_inspect_cb(config, inspect_cb);
 
-        if (process_argv(&data, argc, argv)) {
+        if (!process_argv(&data, argc, argv)) {
+                return_value = EXIT_FAILURE;
+        } else if (data.server) {
+                if (!run_server(&data))
+                        return_value = EXIT_FAILURE;
+        } else {
+                /* Only install the inspect callback if something is
+                 * going to be written because otherwise VkRunner has
+                 * to keep a copy of the framebuffer for it.
+                 */
+                if (data.image_filename || data.buffer_filename)
+                        vr_config_set_inspect_cb(config, inspect_cb);
+
                 enum vr_result result = run_scripts(&data);
 
                 if (data.inspect_failed)
                         result = vr_result_merge(result, VR_RESULT_FAIL);
 
+                if (data.shader_cache && !data.quiet) {
+                        unsigned hits, misses;
+                        vr_config_get_shader_cache_stats(config,
+                                                         &hits,
+                                                         &misses);
+                        printf("Shader cache: %u hits, %u misses\n",
+                               hits + data.worker_cache_hits,
+                               misses + data.worker_cache_misses);
+                }
+
+                if (data.memory_stats && !data.quiet) {
+                        unsigned n_blocks, n_allocations;
+                        uint64_t block_size;
+                        vr_executor_get_memory_stats(data.executor,
+                                                     &n_blocks,
+                                                     &block_size,
+                                                     &n_allocations);
+                        printf("Device memory: %u blocks, %" PRIu64
+                               " bytes, %u allocations\n",
+                               n_blocks,
+                               block_size,
+                               n_allocations);
+                }
+
                 if (!data.quiet || result != VR_RESULT_PASS) {
                         printf("PIGLIT: {\"result\": \"%s\" }\n",
                                vr_result_to_string(result));
@@ -488,12 +1685,13 @@ main(int argc, char **argv)
                         return_value = EXIT_FAILURE;
                         break;
                 }
-        } else {
-                return_value = EXIT_FAILURE;
         }
 
-        vr_config_free(config);
+        /* The executor saves the pipeline cache with the config so
+         * it has to be freed first.
+         */
         vr_executor_free(data.executor);
+        vr_config_free(config);
         string_array_destroy(&data.filenames);
         string_array_destroy(&data.token_replacements);
 
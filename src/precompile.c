@@ -0,0 +1,1075 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Converts the GLSL and SPIR-V assembly sections of scripts to binary
+ * sections. This is a faster replacement for precompile-script.py
+ * and generates exactly the same output. The shaders of all of the
+ * scripts are compiled concurrently and identical shaders are only
+ * compiled once.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "vkrunner/vr-buffer.h"
+#include "vkrunner/vr-error-message.h"
+#include "vkrunner/vr-script.h"
+#include "vkrunner/vr-subprocess.h"
+#include "vkrunner/vr-temp-file.h"
+#include "vkrunner/vr-thread.h"
+#include "vkrunner/vr-util.h"
+
+#define TARGET_ENV "vulkan1.0"
+
+/* Maximum number of hex digits and spaces on a line of a binary
+ * section
+ */
+#define MAX_LINE_LENGTH 80
+
+static const struct {
+        const char *section_name;
+        const char *stage_name;
+} stages[] = {
+        { "vertex shader", "vert" },
+        { "tessellation control shader", "tesc" },
+        { "tessellation evaluation shader", "tese" },
+        { "geometry shader", "geom" },
+        { "fragment shader", "frag" },
+        { "compute shader", "comp" },
+};
+
+#define N_STAGES (sizeof stages / sizeof stages[0])
+
+struct shader_job {
+        enum vr_script_source_type source_type;
+        const char *stage_name;
+        struct vr_buffer source;
+        /* File that the shader was first seen in for error messages */
+        const char *filename;
+        /* Job with identical source which is compiled instead of
+         * this one, or NULL.
+         */
+        struct shader_job *duplicate_of;
+        bool compiled;
+        /* The binary section contents */
+        struct vr_buffer hex;
+};
+
+struct insertion {
+        size_t offset;
+        struct shader_job *job;
+};
+
+struct input_file {
+        const char *filename;
+        /* The contents of the file with the shader sections
+         * removed
+         */
+        struct vr_buffer text;
+        /* Array of struct insertion for the position of each
+         * compiled shader in text
+         */
+        struct vr_buffer insertions;
+        bool ok;
+};
+
+struct precompile_data {
+        struct vr_config *config;
+        const char *output;
+        const char *glslang;
+        const char *spirv_as;
+        int n_threads;
+        /* Array of struct input_file */
+        struct vr_buffer files;
+        /* Array of struct shader_job * */
+        struct vr_buffer jobs;
+        /* Array of struct shader_job * that need compiling */
+        struct vr_buffer unique_jobs;
+        vr_mutex_t mutex;
+        size_t next_job;
+};
+
+typedef bool (* option_cb_t) (struct precompile_data *data,
+                              const char *arg);
+
+struct option {
+        char letter;
+        const char *description;
+        const char *argument_name;
+        option_cb_t cb;
+};
+
+static bool
+opt_help(struct precompile_data *data,
+         const char *arg);
+
+static bool
+opt_output(struct precompile_data *data,
+           const char *arg)
+{
+        data->output = arg;
+        return true;
+}
+
+static bool
+opt_glslang(struct precompile_data *data,
+            const char *arg)
+{
+        data->glslang = arg;
+        return true;
+}
+
+static bool
+opt_spirv_as(struct precompile_data *data,
+             const char *arg)
+{
+        data->spirv_as = arg;
+        return true;
+}
+
+static bool
+opt_jobs(struct precompile_data *data,
+         const char *arg)
+{
+        char *tail;
+
+        errno = 0;
+        long n_threads = strtol(arg, &tail, 10);
+
+        if (errno || *tail || n_threads < 1 || n_threads > 1024) {
+                fprintf(stderr, "invalid number of jobs: %s\n", arg);
+                return false;
+        }
+
+        data->n_threads = n_threads;
+
+        return true;
+}
+
+static const struct option
+options[] = {
+        { 'h', "Show this help message", NULL, opt_help },
+        { 'o', "Write to OUTPUT file or directory", "OUTPUT", opt_output },
+        { 'g', "glslangValidator binary path", "GLSLANG", opt_glslang },
+        { 's', "spirv-as binary path", "SPIRV_AS", opt_spirv_as },
+        { 'j', "Run N compilers at once. Defaults to the number of CPUs",
+          "N", opt_jobs },
+};
+
+#define N_OPTIONS (sizeof options / sizeof options[0])
+
+static bool
+opt_help(struct precompile_data *data,
+         const char *arg)
+{
+        printf("usage: vkrunner-precompile [OPTION]... -o OUTPUT INPUT...\n"
+               "Precompiles the shaders of the VkRunner scripts INPUT\n"
+               "\n"
+               "Options:\n");
+
+        for (int i = 0; i < N_OPTIONS; i++) {
+                printf("  -%c %-10s %s\n",
+                       options[i].letter,
+                       options[i].argument_name ?
+                       options[i].argument_name :
+                       "",
+                       options[i].description);
+
+        }
+
+        return false;
+}
+
+static bool
+handle_option(struct precompile_data *data,
+              const struct option *option,
+              const char *p,
+              int argc, char **argv,
+              int *arg_num)
+{
+        const char *arg;
+
+        if (option->argument_name) {
+                if (p[1]) {
+                        arg = p + 1;
+                } else {
+                        (*arg_num)++;
+                        if (*arg_num >= argc) {
+                                fprintf(stderr,
+                                        "option ‘%c’ expects an argument\n",
+                                        *p);
+                                opt_help(data, NULL);
+                                return false;
+                        }
+                        arg = argv[*arg_num];
+                }
+        } else {
+                arg = NULL;
+        }
+
+        return option->cb(data, arg);
+}
+
+static void
+add_input_file(struct precompile_data *data,
+               const char *filename)
+{
+        struct input_file file = {
+                .filename = filename,
+                .text = VR_BUFFER_STATIC_INIT,
+                .insertions = VR_BUFFER_STATIC_INIT,
+                .ok = true
+        };
+
+        vr_buffer_append(&data->files, &file, sizeof file);
+}
+
+static bool
+process_argv(struct precompile_data *data,
+             int argc, char **argv)
+{
+        bool had_separator = false;
+
+        for (int i = 1; i < argc; i++) {
+                if (!had_separator && argv[i][0] == '-') {
+                        if (!strcmp(argv[i], "--")) {
+                                had_separator = true;
+                                continue;
+                        }
+
+                        for (const char *p = argv[i] + 1; *p; p++) {
+                                for (int option_num = 0;
+                                     option_num < N_OPTIONS;
+                                     option_num++) {
+                                        if (options[option_num].letter != *p)
+                                                continue;
+
+                                        if (!handle_option(data,
+                                                           options + option_num,
+                                                           p,
+                                                           argc, argv,
+                                                           &i))
+                                                return false;
+
+                                        if (options[option_num].argument_name)
+                                                goto handled_arg;
+
+                                        goto found_option;
+                                }
+
+                                fprintf(stderr,
+                                        "unknown option ‘%c’\n",
+                                        *p);
+                                opt_help(data, NULL);
+                                return false;
+
+                        found_option:
+                                (void) 0;
+                        }
+
+                handled_arg:
+                        (void) 0;
+                } else {
+                        add_input_file(data, argv[i]);
+                }
+        }
+
+        if (data->files.length <= 0) {
+                fprintf(stderr, "no input specified\n");
+                opt_help(data, NULL);
+                return false;
+        }
+
+        if (data->output == NULL) {
+                fprintf(stderr, "no output specified\n");
+                opt_help(data, NULL);
+                return false;
+        }
+
+        return true;
+}
+
+static bool
+read_file(const struct vr_config *config,
+          const char *filename,
+          struct vr_buffer *contents)
+{
+        FILE *file = fopen(filename, "rb");
+
+        if (file == NULL) {
+                vr_error_message(config, "%s: %s", filename, strerror(errno));
+                return false;
+        }
+
+        while (true) {
+                vr_buffer_ensure_size(contents, contents->length + 1024);
+
+                size_t got = fread(contents->data + contents->length,
+                                   1,
+                                   contents->size - contents->length,
+                                   file);
+
+                if (got == 0)
+                        break;
+
+                contents->length += got;
+        }
+
+        bool ret = !ferror(file);
+
+        if (!ret)
+                vr_error_message(config, "%s: error reading file", filename);
+
+        fclose(file);
+
+        return ret;
+}
+
+/* Converts “\r\n” and “\r” to “\n” in the same way as Python’s
+ * universal newlines mode which the Python script uses to read the
+ * files.
+ */
+static void
+translate_newlines(struct vr_buffer *contents)
+{
+        uint8_t *src = contents->data;
+        uint8_t *dst = contents->data;
+        uint8_t *end = contents->data + contents->length;
+
+        while (src < end) {
+                if (*src == '\r') {
+                        *(dst++) = '\n';
+                        src++;
+                        if (src < end && *src == '\n')
+                                src++;
+                } else {
+                        *(dst++) = *(src++);
+                }
+        }
+
+        contents->length = dst - contents->data;
+}
+
+/* Checks whether the line is a section header using the same rules
+ * as the Python script so that the output is identical.
+ */
+static bool
+get_section_name(const char *line,
+                 size_t length,
+                 const char **name_out,
+                 size_t *name_length_out)
+{
+        const char *end = line + length;
+        const char *p;
+
+        if (length < 1 || *line != '[')
+                return false;
+
+        const char *name_end = memchr(line + 1, ']', length - 1);
+
+        if (name_end == NULL || name_end == line + 1)
+                return false;
+
+        for (p = name_end + 1; p < end; p++) {
+                if (!strchr(" \t\n\r\f\v", *p) || *p == '\0')
+                        return false;
+        }
+
+        *name_out = line + 1;
+        *name_length_out = name_end - line - 1;
+
+        return true;
+}
+
+static const char *
+lookup_stage(const char *name,
+             size_t length)
+{
+        for (int i = 0; i < N_STAGES; i++) {
+                if (strlen(stages[i].section_name) == length &&
+                    !memcmp(stages[i].section_name, name, length))
+                        return stages[i].stage_name;
+        }
+
+        return NULL;
+}
+
+static struct shader_job *
+start_shader(struct precompile_data *data,
+             struct input_file *file,
+             enum vr_script_source_type source_type,
+             const char *stage_name,
+             const char *section_name,
+             size_t section_name_length)
+{
+        struct shader_job *job = vr_calloc(sizeof *job);
+
+        job->source_type = source_type;
+        job->stage_name = stage_name;
+        job->filename = file->filename;
+        vr_buffer_init(&job->source);
+        vr_buffer_init(&job->hex);
+
+        vr_buffer_append(&data->jobs, &job, sizeof job);
+
+        vr_buffer_append_c(&file->text, '[');
+        vr_buffer_append(&file->text, section_name, section_name_length);
+        vr_buffer_append_string(&file->text, " binary]\n");
+
+        struct insertion insertion = {
+                .offset = file->text.length,
+                .job = job
+        };
+
+        vr_buffer_append(&file->insertions, &insertion, sizeof insertion);
+
+        return job;
+}
+
+/* Splits the file into the text to copy verbatim and the shaders to
+ * compile.
+ */
+static bool
+split_file(struct precompile_data *data,
+           struct input_file *file,
+           const struct vr_buffer *contents)
+{
+        const char *p = (const char *) contents->data;
+        const char *end = p + contents->length;
+        struct shader_job *job = NULL;
+
+        while (p < end) {
+                const char *line_end = memchr(p, '\n', end - p);
+                const char *name;
+                size_t name_length;
+
+                line_end = line_end ? line_end + 1 : end;
+
+                if (get_section_name(p, line_end - p, &name, &name_length)) {
+                        static const char spirv_tail[] = " spirv";
+                        size_t tail_length = sizeof spirv_tail - 1;
+                        const char *stage_name;
+
+                        job = NULL;
+
+                        if (name_length >= tail_length &&
+                            !memcmp(name + name_length - tail_length,
+                                    spirv_tail,
+                                    tail_length)) {
+                                name_length -= tail_length;
+                                stage_name = lookup_stage(name, name_length);
+
+                                if (stage_name == NULL) {
+                                        vr_error_message(data->config,
+                                                         "%s: unknown stage "
+                                                         "in section [%.*s]",
+                                                         file->filename,
+                                                         (int) (line_end - p),
+                                                         p);
+                                        return false;
+                                }
+
+                                job = start_shader(data,
+                                                   file,
+                                                   VR_SCRIPT_SOURCE_TYPE_SPIRV,
+                                                   stage_name,
+                                                   name,
+                                                   name_length);
+                        } else if ((stage_name = lookup_stage(name,
+                                                              name_length))) {
+                                job = start_shader(data,
+                                                   file,
+                                                   VR_SCRIPT_SOURCE_TYPE_GLSL,
+                                                   stage_name,
+                                                   name,
+                                                   name_length);
+                        } else {
+                                vr_buffer_append(&file->text, p, line_end - p);
+                        }
+                } else if (job) {
+                        vr_buffer_append(&job->source, p, line_end - p);
+                } else {
+                        vr_buffer_append(&file->text, p, line_end - p);
+                }
+
+                p = line_end;
+        }
+
+        return true;
+}
+
+static bool
+load_file(struct precompile_data *data,
+          struct input_file *file)
+{
+        struct vr_buffer contents = VR_BUFFER_STATIC_INIT;
+        bool ret = false;
+
+        /* Load the script with VkRunner’s parser first so that
+         * invalid scripts are reported before anything is compiled
+         */
+        struct vr_source *source = vr_source_from_file(file->filename);
+        struct vr_script *script = vr_script_load(data->config, source);
+
+        vr_source_free(source);
+
+        if (script == NULL)
+                goto out;
+
+        vr_script_free(script);
+
+        if (!read_file(data->config, file->filename, &contents))
+                goto out;
+
+        translate_newlines(&contents);
+
+        ret = split_file(data, file, &contents);
+
+out:
+        vr_buffer_destroy(&contents);
+
+        return ret;
+}
+
+static int
+compare_jobs(const void *a,
+             const void *b)
+{
+        const struct shader_job *job_a = *(const struct shader_job **) a;
+        const struct shader_job *job_b = *(const struct shader_job **) b;
+        int ret;
+
+        if (job_a->source_type != job_b->source_type)
+                return job_a->source_type < job_b->source_type ? -1 : 1;
+
+        /* The stage is not passed to the assembler */
+        if (job_a->source_type == VR_SCRIPT_SOURCE_TYPE_GLSL) {
+                ret = strcmp(job_a->stage_name, job_b->stage_name);
+                if (ret)
+                        return ret;
+        }
+
+        if (job_a->source.length != job_b->source.length)
+                return job_a->source.length < job_b->source.length ? -1 : 1;
+
+        return memcmp(job_a->source.data,
+                      job_b->source.data,
+                      job_a->source.length);
+}
+
+static void
+find_unique_jobs(struct precompile_data *data)
+{
+        size_t n_jobs = data->jobs.length / sizeof (struct shader_job *);
+        struct shader_job **sorted = vr_alloc(data->jobs.length + 1);
+        struct shader_job *prev = NULL;
+
+        memcpy(sorted, data->jobs.data, data->jobs.length);
+        qsort(sorted, n_jobs, sizeof *sorted, compare_jobs);
+
+        for (size_t i = 0; i < n_jobs; i++) {
+                if (prev && !compare_jobs(&prev, sorted + i)) {
+                        sorted[i]->duplicate_of = prev;
+                } else {
+                        vr_buffer_append(&data->unique_jobs,
+                                         sorted + i,
+                                         sizeof sorted[i]);
+                        prev = sorted[i];
+                }
+        }
+
+        vr_free(sorted);
+}
+
+static bool
+load_stream_contents(const struct vr_config *config,
+                     FILE *stream,
+                     struct vr_buffer *contents)
+{
+        long pos;
+
+        fseek(stream, 0, SEEK_END);
+        pos = ftell(stream);
+
+        if (pos == -1) {
+                vr_error_message(config, "ftell failed");
+                return false;
+        }
+
+        size_t size = pos;
+        rewind(stream);
+        vr_buffer_set_length(contents, size);
+
+        if (fread(contents->data, 1, size, stream) != size) {
+                vr_error_message(config, "Error reading file contents");
+                return false;
+        }
+
+        return true;
+}
+
+static bool
+format_binary(const struct vr_config *config,
+              const struct shader_job *job,
+              const struct vr_buffer *binary,
+              struct vr_buffer *hex)
+{
+        const uint8_t *data = binary->data;
+        bool big_endian;
+        int line_pos = 0;
+
+        if (binary->length < 4 || binary->length % 4 != 0) {
+                vr_error_message(config,
+                                 "%s: Resulting binary SPIR-V file has an "
+                                 "invalid size",
+                                 job->filename);
+                return false;
+        }
+
+        if (data[0] == 0x07 && data[1] == 0x23 &&
+            data[2] == 0x02 && data[3] == 0x03) {
+                big_endian = true;
+        } else if (data[0] == 0x03 && data[1] == 0x02 &&
+                   data[2] == 0x23 && data[3] == 0x07) {
+                big_endian = false;
+        } else {
+                vr_error_message(config,
+                                 "%s: Resulting binary SPIR-V has an invalid "
+                                 "magic number",
+                                 job->filename);
+                return false;
+        }
+
+        for (size_t offset = 0; offset < binary->length; offset += 4) {
+                const uint8_t *p = data + offset;
+                uint32_t value;
+                char hex_str[9];
+
+                if (big_endian) {
+                        value = (((uint32_t) p[0] << 24) |
+                                 ((uint32_t) p[1] << 16) |
+                                 ((uint32_t) p[2] << 8) |
+                                 (uint32_t) p[3]);
+                } else {
+                        value = (((uint32_t) p[3] << 24) |
+                                 ((uint32_t) p[2] << 16) |
+                                 ((uint32_t) p[1] << 8) |
+                                 (uint32_t) p[0]);
+                }
+
+                int len = snprintf(hex_str, sizeof hex_str, "%x", value);
+
+                if (len + line_pos + 1 > MAX_LINE_LENGTH) {
+                        line_pos = 0;
+                        vr_buffer_append_c(hex, '\n');
+                } else if (line_pos > 0) {
+                        vr_buffer_append_c(hex, ' ');
+                        line_pos++;
+                }
+
+                vr_buffer_append(hex, hex_str, len);
+                line_pos += len;
+        }
+
+        if (line_pos > 0)
+                vr_buffer_append_c(hex, '\n');
+        vr_buffer_append_c(hex, '\n');
+
+        return true;
+}
+
+static bool
+compile_job(const struct precompile_data *data,
+            struct shader_job *job)
+{
+        const struct vr_config *config = data->config;
+        struct vr_buffer binary = VR_BUFFER_STATIC_INIT;
+        FILE *source_stream = NULL, *module_stream = NULL;
+        char *source_filename = NULL, *module_filename = NULL;
+        bool ret = false;
+
+        if (!vr_temp_file_create_named(config,
+                                       &source_stream,
+                                       &source_filename))
+                goto out;
+
+        fwrite(job->source.data, 1, job->source.length, source_stream);
+        fflush(source_stream);
+
+        if (!vr_temp_file_create_named(config,
+                                       &module_stream,
+                                       &module_filename))
+                goto out;
+
+        /* These must be the same arguments that the Python script
+         * uses so that the output is identical
+         */
+        char *glsl_args[] = {
+                (char *) data->glslang,
+                "-S", (char *) job->stage_name,
+                "-G",
+                "-V",
+                "--target-env", TARGET_ENV,
+                "-o", module_filename,
+                source_filename,
+                NULL
+        };
+        char *spirv_args[] = {
+                (char *) data->spirv_as,
+                "--target-env", TARGET_ENV,
+                "-o", module_filename,
+                source_filename,
+                NULL
+        };
+        char **args = (job->source_type == VR_SCRIPT_SOURCE_TYPE_GLSL ?
+                       glsl_args :
+                       spirv_args);
+
+        if (!vr_subprocess_command(config, args)) {
+                vr_error_message(config,
+                                 "%s: %s failed",
+                                 job->filename,
+                                 args[0]);
+                goto out;
+        }
+
+        if (!load_stream_contents(config, module_stream, &binary))
+                goto out;
+
+        ret = format_binary(config, job, &binary, &job->hex);
+
+out:
+        if (source_stream) {
+                fclose(source_stream);
+                vr_temp_file_remove(source_filename);
+                vr_free(source_filename);
+        }
+
+        if (module_stream) {
+                fclose(module_stream);
+                vr_temp_file_remove(module_filename);
+                vr_free(module_filename);
+        }
+
+        vr_buffer_destroy(&binary);
+
+        return ret;
+}
+
+static void
+compile_thread(void *user_data)
+{
+        struct precompile_data *data = user_data;
+        size_t n_jobs = data->unique_jobs.length / sizeof (struct shader_job *);
+        struct shader_job **jobs = (struct shader_job **) data->unique_jobs.data;
+
+        while (true) {
+                vr_mutex_lock(&data->mutex);
+                size_t job_num = data->next_job++;
+                vr_mutex_unlock(&data->mutex);
+
+                if (job_num >= n_jobs)
+                        break;
+
+                jobs[job_num]->compiled = compile_job(data, jobs[job_num]);
+        }
+}
+
+static int
+get_n_cpus(void)
+{
+#ifdef WIN32
+        SYSTEM_INFO info;
+
+        GetSystemInfo(&info);
+
+        return info.dwNumberOfProcessors;
+#else
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        return n_cpus < 1 ? 1 : n_cpus;
+#endif
+}
+
+static void
+compile_jobs(struct precompile_data *data)
+{
+        size_t n_jobs = data->unique_jobs.length / sizeof (struct shader_job *);
+        int n_threads = data->n_threads > 0 ? data->n_threads : get_n_cpus();
+        struct vr_thread **threads;
+        int i;
+
+        if (n_threads > n_jobs)
+                n_threads = n_jobs;
+
+        if (n_threads < 1)
+                return;
+
+        threads = vr_calloc(n_threads * sizeof *threads);
+
+        /* This thread acts as one of the workers too. If a thread
+         * can’t be created then the remaining workers will take its
+         * share of the jobs.
+         */
+        for (i = 1; i < n_threads; i++)
+                threads[i] = vr_thread_start(compile_thread, data);
+
+        compile_thread(data);
+
+        for (i = 1; i < n_threads; i++) {
+                if (threads[i])
+                        vr_thread_join(threads[i]);
+        }
+
+        vr_free(threads);
+}
+
+static bool
+is_directory(const char *filename)
+{
+        struct stat statbuf;
+
+        return stat(filename, &statbuf) == 0 && S_ISDIR(statbuf.st_mode);
+}
+
+static void
+get_output_filename(const struct precompile_data *data,
+                    const struct input_file *file,
+                    bool output_is_directory,
+                    struct vr_buffer *filename)
+{
+        vr_buffer_append_string(filename, data->output);
+
+        if (!output_is_directory)
+                return;
+
+        const char *basename = file->filename;
+
+        for (const char *p = file->filename; *p; p++) {
+#ifdef WIN32
+                if (*p == '\\' || *p == ':')
+                        basename = p + 1;
+#endif
+                if (*p == '/')
+                        basename = p + 1;
+        }
+
+        if (filename->length > 0 &&
+            filename->data[filename->length - 1] != '/' &&
+            filename->data[filename->length - 1] != *VR_PATH_SEPARATOR)
+                vr_buffer_append_string(filename, VR_PATH_SEPARATOR);
+
+        vr_buffer_append_string(filename, basename);
+}
+
+/* Writes to a temporary file and then renames it so that the output
+ * is never left partially written.
+ */
+static bool
+write_file_atomically(const struct vr_config *config,
+                      const char *filename,
+                      const struct vr_buffer *contents)
+{
+        struct vr_buffer temp_filename = VR_BUFFER_STATIC_INIT;
+        bool ok;
+
+        FILE *file = vr_temp_file_open_replacement(filename, &temp_filename);
+
+        if (file == NULL) {
+                vr_error_message(config, "%s: %s", filename, strerror(errno));
+                vr_buffer_destroy(&temp_filename);
+                return false;
+        }
+
+        ok = fwrite(contents->data, 1, contents->length, file) ==
+                contents->length;
+
+        if (fclose(file) != 0)
+                ok = false;
+
+        if (ok) {
+                ok = vr_temp_file_replace((const char *) temp_filename.data,
+                                          filename);
+        } else {
+                remove((const char *) temp_filename.data);
+        }
+
+        if (!ok)
+                vr_error_message(config, "%s: error writing file", filename);
+
+        vr_buffer_destroy(&temp_filename);
+
+        return ok;
+}
+
+static bool
+write_file(const struct precompile_data *data,
+           const struct input_file *file,
+           bool output_is_directory)
+{
+        const struct insertion *insertions =
+                (const struct insertion *) file->insertions.data;
+        size_t n_insertions = file->insertions.length / sizeof *insertions;
+        struct vr_buffer filename = VR_BUFFER_STATIC_INIT;
+        struct vr_buffer contents = VR_BUFFER_STATIC_INIT;
+        size_t offset = 0;
+        bool ret = false;
+
+        for (size_t i = 0; i < n_insertions; i++) {
+                const struct shader_job *job = insertions[i].job;
+
+                if (job->duplicate_of)
+                        job = job->duplicate_of;
+
+                if (!job->compiled) {
+                        vr_error_message(data->config,
+                                         "%s: not written because a shader "
+                                         "failed to compile",
+                                         file->filename);
+                        goto out;
+                }
+
+                vr_buffer_append(&contents,
+                                 file->text.data + offset,
+                                 insertions[i].offset - offset);
+                vr_buffer_append(&contents, job->hex.data, job->hex.length);
+                offset = insertions[i].offset;
+        }
+
+        vr_buffer_append(&contents,
+                         file->text.data + offset,
+                         file->text.length - offset);
+
+        get_output_filename(data, file, output_is_directory, &filename);
+
+        ret = write_file_atomically(data->config,
+                                    (const char *) filename.data,
+                                    &contents);
+
+out:
+        vr_buffer_destroy(&contents);
+        vr_buffer_destroy(&filename);
+
+        return ret;
+}
+
+static bool
+precompile(struct precompile_data *data)
+{
+        struct input_file *files = (struct input_file *) data->files.data;
+        size_t n_files = data->files.length / sizeof *files;
+        bool ret = true;
+
+        for (size_t i = 0; i < n_files; i++) {
+                if (!load_file(data, files + i)) {
+                        files[i].ok = false;
+                        ret = false;
+                }
+        }
+
+        find_unique_jobs(data);
+        compile_jobs(data);
+
+        bool output_is_directory = n_files >= 2 || is_directory(data->output);
+
+        if (output_is_directory) {
+#ifdef WIN32
+                _mkdir(data->output);
+#else
+                mkdir(data->output, 0777);
+#endif
+        }
+
+        for (size_t i = 0; i < n_files; i++) {
+                if (files[i].ok && !write_file(data, files + i,
+                                               output_is_directory))
+                        ret = false;
+        }
+
+        return ret;
+}
+
+static void
+free_data(struct precompile_data *data)
+{
+        struct input_file *files = (struct input_file *) data->files.data;
+        size_t n_files = data->files.length / sizeof *files;
+        struct shader_job **jobs = (struct shader_job **) data->jobs.data;
+        size_t n_jobs = data->jobs.length / sizeof *jobs;
+
+        for (size_t i = 0; i < n_files; i++) {
+                vr_buffer_destroy(&files[i].text);
+                vr_buffer_destroy(&files[i].insertions);
+        }
+
+        for (size_t i = 0; i < n_jobs; i++) {
+                vr_buffer_destroy(&jobs[i]->source);
+                vr_buffer_destroy(&jobs[i]->hex);
+                vr_free(jobs[i]);
+        }
+
+        vr_buffer_destroy(&data->unique_jobs);
+        vr_buffer_destroy(&data->jobs);
+        vr_buffer_destroy(&data->files);
+}
+
+int
+main(int argc, char **argv)
+{
+        int return_value = EXIT_SUCCESS;
+        struct precompile_data data = {
+                .config = vr_config_new(),
+                .glslang = "glslangValidator",
+                .spirv_as = "spirv-as",
+                .files = VR_BUFFER_STATIC_INIT,
+                .jobs = VR_BUFFER_STATIC_INIT,
+                .unique_jobs = VR_BUFFER_STATIC_INIT,
+        };
+
+        vr_mutex_init(&data.mutex);
+
+        if (!process_argv(&data, argc, argv) || !precompile(&data))
+                return_value = EXIT_FAILURE;
+
+        free_data(&data);
+        vr_mutex_destroy(&data.mutex);
+        vr_config_free(data.config);
+
+        return return_value;
+}
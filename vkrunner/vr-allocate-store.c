@@ -29,6 +29,37 @@
 
 #include "vr-allocate-store.h"
 #include "vr-util.h"
+#include "vr-list.h"
+
+/* Size of the blocks of memory that the arena allocates. Buffers that
+ * are bigger than this get a block of their own which is freed as
+ * soon as the buffer is released.
+ */
+#define BLOCK_SIZE (4 * 1024 * 1024)
+
+struct free_range {
+        struct vr_list link;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+};
+
+struct vr_allocate_store_block {
+        struct vr_list link;
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        void *memory_map;
+        /* List of free_ranges sorted by offset. Adjacent ranges are
+         * always merged.
+         */
+        struct vr_list free_ranges;
+        unsigned n_allocations;
+};
+
+struct vr_allocate_store_arena {
+        struct vr_context *context;
+        struct vr_list blocks[VK_MAX_MEMORY_TYPES];
+        struct vr_allocate_store_stats stats;
+};
 
 static int
 find_memory_type(struct vr_context *context,
@@ -182,3 +213,284 @@ vr_allocate_store_image(struct vr_context *context,
 
         return VK_SUCCESS;
 }
+
+static VkDeviceSize
+align_size(VkDeviceSize value,
+           VkDeviceSize alignment)
+{
+        return (value + alignment - 1) / alignment * alignment;
+}
+
+struct vr_allocate_store_arena *
+vr_allocate_store_arena_new(struct vr_context *context)
+{
+        struct vr_allocate_store_arena *arena = vr_calloc(sizeof *arena);
+
+        arena->context = context;
+
+        for (int i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+                vr_list_init(arena->blocks + i);
+
+        return arena;
+}
+
+static void
+free_block(struct vr_allocate_store_arena *arena,
+           struct vr_allocate_store_block *block)
+{
+        struct vr_context *context = arena->context;
+        struct vr_vk *vkfn = &context->vkfn;
+        struct free_range *range, *tmp;
+
+        vr_list_for_each_safe(range, tmp, &block->free_ranges, link)
+                vr_free(range);
+
+        if (block->memory_map)
+                vkfn->vkUnmapMemory(context->device, block->memory);
+
+        vkfn->vkFreeMemory(context->device,
+                           block->memory,
+                           NULL /* allocator */);
+
+        arena->stats.n_blocks--;
+        arena->stats.block_size -= block->size;
+
+        vr_list_remove(&block->link);
+        vr_free(block);
+}
+
+static struct vr_allocate_store_block *
+new_block(struct vr_allocate_store_arena *arena,
+          int memory_type_index,
+          VkDeviceSize size)
+{
+        struct vr_context *context = arena->context;
+        struct vr_vk *vkfn = &context->vkfn;
+        const VkMemoryType *memory_type =
+                &context->memory_properties.memoryTypes[memory_type_index];
+        VkDeviceMemory memory;
+        void *memory_map = NULL;
+        VkResult res;
+
+        VkMemoryAllocateInfo allocate_info = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+                .allocationSize = size,
+                .memoryTypeIndex = memory_type_index
+        };
+        res = vkfn->vkAllocateMemory(context->device,
+                                     &allocate_info,
+                                     NULL, /* allocator */
+                                     &memory);
+        if (res != VK_SUCCESS)
+                return NULL;
+
+        arena->stats.n_memory_allocations++;
+
+        if ((memory_type->propertyFlags &
+             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+                res = vkfn->vkMapMemory(context->device,
+                                        memory,
+                                        0, /* offset */
+                                        VK_WHOLE_SIZE,
+                                        0, /* flags */
+                                        &memory_map);
+                if (res != VK_SUCCESS) {
+                        vkfn->vkFreeMemory(context->device,
+                                           memory,
+                                           NULL /* allocator */);
+                        return NULL;
+                }
+        }
+
+        struct vr_allocate_store_block *block = vr_calloc(sizeof *block);
+        struct free_range *range = vr_alloc(sizeof *range);
+
+        block->memory = memory;
+        block->size = size;
+        block->memory_map = memory_map;
+
+        range->offset = 0;
+        range->size = size;
+        vr_list_init(&block->free_ranges);
+        vr_list_insert(&block->free_ranges, &range->link);
+
+        vr_list_insert(arena->blocks[memory_type_index].prev, &block->link);
+
+        arena->stats.n_blocks++;
+        arena->stats.block_size += size;
+
+        return block;
+}
+
+/* Tries to take a range of the given size out of the block. Returns
+ * the offset of the range or -1 if there isn’t enough space.
+ */
+static VkDeviceSize
+allocate_from_block(struct vr_allocate_store_block *block,
+                    VkDeviceSize size,
+                    VkDeviceSize alignment)
+{
+        struct free_range *range;
+
+        vr_list_for_each(range, &block->free_ranges, link) {
+                VkDeviceSize offset = align_size(range->offset, alignment);
+                VkDeviceSize end = range->offset + range->size;
+
+                if (offset + size > end)
+                        continue;
+
+                if (offset + size < end) {
+                        struct free_range *after = vr_alloc(sizeof *after);
+                        after->offset = offset + size;
+                        after->size = end - after->offset;
+                        vr_list_insert(&range->link, &after->link);
+                }
+
+                if (offset > range->offset) {
+                        range->size = offset - range->offset;
+                } else {
+                        vr_list_remove(&range->link);
+                        vr_free(range);
+                }
+
+                block->n_allocations++;
+
+                return offset;
+        }
+
+        return (VkDeviceSize) -1;
+}
+
+static void
+free_to_block(struct vr_allocate_store_block *block,
+              VkDeviceSize offset,
+              VkDeviceSize size)
+{
+        struct free_range *range, *prev = NULL, *next = NULL;
+
+        vr_list_for_each(range, &block->free_ranges, link) {
+                if (range->offset > offset) {
+                        next = range;
+                        break;
+                }
+                prev = range;
+        }
+
+        if (prev && prev->offset + prev->size == offset) {
+                prev->size += size;
+                range = prev;
+        } else {
+                range = vr_alloc(sizeof *range);
+                range->offset = offset;
+                range->size = size;
+                vr_list_insert(prev ? &prev->link : &block->free_ranges,
+                               &range->link);
+        }
+
+        if (next && range->offset + range->size == next->offset) {
+                range->size += next->size;
+                vr_list_remove(&next->link);
+                vr_free(next);
+        }
+
+        block->n_allocations--;
+}
+
+VkResult
+vr_allocate_store_arena_buffer(struct vr_allocate_store_arena *arena,
+                               uint32_t memory_type_flags,
+                               VkBuffer buffer,
+                               struct vr_allocate_store_allocation *out)
+{
+        struct vr_context *context = arena->context;
+        struct vr_vk *vkfn = &context->vkfn;
+        VkMemoryRequirements reqs;
+
+        vkfn->vkGetBufferMemoryRequirements(context->device, buffer, &reqs);
+
+        int memory_type_index = find_memory_type(context,
+                                                 reqs.memoryTypeBits,
+                                                 memory_type_flags);
+        if (memory_type_index == -1)
+                return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+        /* Align to the atom size so that flushing the range of one
+         * buffer can’t affect its neighbours.
+         */
+        VkDeviceSize atom_size =
+                context->device_properties.limits.nonCoherentAtomSize;
+        VkDeviceSize alignment = MAX(MAX(reqs.alignment, atom_size), 1);
+        VkDeviceSize size = align_size(MAX(reqs.size, 1), alignment);
+        struct vr_allocate_store_block *block;
+        VkDeviceSize offset = (VkDeviceSize) -1;
+
+        vr_list_for_each(block, arena->blocks + memory_type_index, link) {
+                offset = allocate_from_block(block, size, alignment);
+                if (offset != (VkDeviceSize) -1)
+                        goto found;
+        }
+
+        block = new_block(arena, memory_type_index, MAX(size, BLOCK_SIZE));
+        if (block == NULL)
+                return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+        offset = allocate_from_block(block, size, alignment);
+
+found:
+        vkfn->vkBindBufferMemory(context->device,
+                                 buffer,
+                                 block->memory,
+                                 offset);
+
+        out->block = block;
+        out->memory = block->memory;
+        out->offset = offset;
+        out->size = size;
+        out->memory_type_index = memory_type_index;
+        out->memory_map = (block->memory_map ?
+                           (uint8_t *) block->memory_map + offset :
+                           NULL);
+
+        arena->stats.n_allocations++;
+        arena->stats.allocation_size += size;
+
+        return VK_SUCCESS;
+}
+
+void
+vr_allocate_store_arena_release(struct vr_allocate_store_arena *arena,
+                                struct vr_allocate_store_allocation *alloc)
+{
+        struct vr_allocate_store_block *block = alloc->block;
+
+        free_to_block(block, alloc->offset, alloc->size);
+
+        arena->stats.n_allocations--;
+        arena->stats.allocation_size -= alloc->size;
+
+        /* Keep the normal-sized blocks around for the next script */
+        if (block->n_allocations == 0 && block->size > BLOCK_SIZE)
+                free_block(arena, block);
+
+        alloc->block = NULL;
+}
+
+void
+vr_allocate_store_arena_get_stats(const struct vr_allocate_store_arena *arena,
+                                  struct vr_allocate_store_stats *stats)
+{
+        *stats = arena->stats;
+}
+
+void
+vr_allocate_store_arena_free(struct vr_allocate_store_arena *arena)
+{
+        struct vr_allocate_store_block *block, *tmp;
+
+        for (int i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+                vr_list_for_each_safe(block, tmp, arena->blocks + i, link)
+                        free_block(arena, block);
+        }
+
+        vr_free(arena);
+}
@@ -29,6 +29,42 @@
 #include <stdint.h>
 #include "vr-context.h"
 
+/* An arena sub-allocates buffers out of large blocks of device
+ * memory so that most buffers don’t need their own call to
+ * vkAllocateMemory. The blocks are kept for each memory type and
+ * host-visible blocks are mapped for as long as they exist. The arena
+ * is owned by the context.
+ */
+
+struct vr_allocate_store_block;
+
+struct vr_allocate_store_allocation {
+        struct vr_allocate_store_block *block;
+        VkDeviceMemory memory;
+        /* Offset and size of the range within the memory. These are
+         * aligned to nonCoherentAtomSize so the whole range can be
+         * flushed or invalidated.
+         */
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        int memory_type_index;
+        /* Pointer to the start of the range or NULL if the memory
+         * isn’t host-visible.
+         */
+        void *memory_map;
+};
+
+struct vr_allocate_store_stats {
+        /* Number of blocks and their total size */
+        unsigned n_blocks;
+        VkDeviceSize block_size;
+        /* Number of live allocations and their total size */
+        unsigned n_allocations;
+        VkDeviceSize allocation_size;
+        /* Number of times vkAllocateMemory has been called */
+        unsigned n_memory_allocations;
+};
+
 VkResult
 vr_allocate_store_image(struct vr_context *context,
                         uint32_t memory_type_flags,
@@ -46,4 +82,26 @@ vr_allocate_store_buffer(struct vr_context *context,
                          int *memory_type_index_out,
                          int *offsets);
 
+struct vr_allocate_store_arena *
+vr_allocate_store_arena_new(struct vr_context *context);
+
+/* Allocates memory for the buffer from the arena and binds it */
+VkResult
+vr_allocate_store_arena_buffer(struct vr_allocate_store_arena *arena,
+                               uint32_t memory_type_flags,
+                               VkBuffer buffer,
+                               struct vr_allocate_store_allocation *out);
+
+void
+vr_allocate_store_arena_release(struct vr_allocate_store_arena *arena,
+                                struct vr_allocate_store_allocation *alloc);
+
+void
+vr_allocate_store_arena_get_stats(const struct vr_allocate_store_arena *arena,
+                                  struct vr_allocate_store_stats *stats);
+
+/* All of the allocations must be released before the arena is freed */
+void
+vr_allocate_store_arena_free(struct vr_allocate_store_arena *arena);
+
 #endif /* VR_ALLOCATE_STORE_H */
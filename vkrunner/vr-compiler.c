@@ -0,0 +1,650 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "vr-compiler.h"
+#include "vr-config-private.h"
+#include "vr-subprocess.h"
+#include "vr-error-message.h"
+#include "vr-temp-file.h"
+#include "vr-glslang.h"
+#include "vr-spirv-tools.h"
+#include "vr-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *
+stage_names[VR_SHADER_STAGE_N_STAGES] = {
+        [VR_SHADER_STAGE_VERTEX] = "vert",
+        [VR_SHADER_STAGE_TESS_CTRL] = "tesc",
+        [VR_SHADER_STAGE_TESS_EVAL] = "tese",
+        [VR_SHADER_STAGE_GEOMETRY] = "geom",
+        [VR_SHADER_STAGE_FRAGMENT] = "frag",
+        [VR_SHADER_STAGE_COMPUTE] = "comp",
+};
+
+#define TARGET_ENV "vulkan1.0"
+
+static char *
+create_file_for_shader(const struct vr_config *config,
+                       const struct vr_script_shader *shader,
+                       FILE **stream_out)
+{
+        char *filename;
+
+        if (!vr_temp_file_create_named(config, stream_out, &filename))
+                return NULL;
+
+        fwrite(shader->source, 1, shader->length, *stream_out);
+        fflush(*stream_out);
+
+        return filename;
+}
+
+static bool
+load_stream_contents(const struct vr_config *config,
+                     FILE *stream,
+                     struct vr_buffer *contents)
+{
+        size_t got;
+        long pos;
+
+        fseek(stream, 0, SEEK_END);
+        pos = ftell(stream);
+
+        if (pos == -1) {
+                vr_error_message(config, "ftell failed");
+                return false;
+        }
+
+        size_t size = pos;
+        rewind(stream);
+        vr_buffer_set_length(contents, size);
+
+        got = fread(contents->data, 1, size, stream);
+        if (got != size) {
+                vr_error_message(config, "Error reading file contents");
+                return false;
+        }
+
+        return true;
+}
+
+static bool
+show_disassembly(const struct vr_config *config,
+                 const char *filename)
+{
+        char *args[] = {
+                getenv("PIGLIT_SPIRV_DIS_BINARY"),
+                (char *) filename,
+                NULL
+        };
+
+        if (args[0] == NULL)
+                args[0] = "spirv-dis";
+
+        return vr_subprocess_command(config, args);
+}
+
+void
+vr_compiler_show_disassembly(const struct vr_config *config,
+                             const void *binary,
+                             size_t size)
+{
+        FILE *module_stream;
+        char *module_filename;
+
+        if (getenv("PIGLIT_SPIRV_DIS_BINARY") == NULL &&
+            vr_spirv_tools_get_version()) {
+                vr_spirv_tools_disassemble(config, binary, size);
+                return;
+        }
+
+        if (!vr_temp_file_create_named(config,
+                                       &module_stream,
+                                       &module_filename))
+                return;
+
+        fwrite(binary, 1, size, module_stream);
+        fflush(module_stream);
+
+        show_disassembly(config, module_filename);
+
+        fclose(module_stream);
+        vr_temp_file_remove(module_filename);
+        vr_free(module_filename);
+}
+
+static const char *
+get_compiler(enum vr_script_source_type source_type)
+{
+        const char *compiler;
+
+        switch (source_type) {
+        case VR_SCRIPT_SOURCE_TYPE_GLSL:
+                compiler = getenv("PIGLIT_GLSLANG_VALIDATOR_BINARY");
+                return compiler ? compiler : "glslangValidator";
+        case VR_SCRIPT_SOURCE_TYPE_SPIRV:
+                compiler = getenv("PIGLIT_SPIRV_AS_BINARY");
+                return compiler ? compiler : "spirv-as";
+        case VR_SCRIPT_SOURCE_TYPE_BINARY:
+                break;
+        }
+
+        vr_fatal("should not be reached");
+}
+
+/* Returns a string identifying the version of the compiler linked
+ * into VkRunner for the source type, or NULL if an external binary
+ * should be used instead. Setting the environment variable for the
+ * binary overrides the built-in compiler.
+ */
+static const char *
+get_builtin_compiler(enum vr_script_source_type source_type)
+{
+        switch (source_type) {
+        case VR_SCRIPT_SOURCE_TYPE_GLSL:
+                if (getenv("PIGLIT_GLSLANG_VALIDATOR_BINARY"))
+                        return NULL;
+                return vr_glslang_get_version();
+        case VR_SCRIPT_SOURCE_TYPE_SPIRV:
+                if (getenv("PIGLIT_SPIRV_AS_BINARY"))
+                        return NULL;
+                return vr_spirv_tools_get_version();
+        case VR_SCRIPT_SOURCE_TYPE_BINARY:
+                break;
+        }
+
+        vr_fatal("should not be reached");
+}
+
+const char *
+vr_compiler_get_name(enum vr_script_source_type source_type)
+{
+        bool builtin = get_builtin_compiler(source_type) != NULL;
+
+        switch (source_type) {
+        case VR_SCRIPT_SOURCE_TYPE_GLSL:
+                return builtin ? "glslang" : "glslangValidator";
+        case VR_SCRIPT_SOURCE_TYPE_SPIRV:
+                return builtin ? "SPIRV-Tools" : "spirv-as";
+        case VR_SCRIPT_SOURCE_TYPE_BINARY:
+                break;
+        }
+
+        vr_fatal("should not be reached");
+}
+
+static enum vr_compiler_result
+compile_stage(const struct vr_config *config,
+              enum vr_shader_stage stage,
+              const struct vr_list *shaders,
+              const char *compiler,
+              struct vr_buffer *output,
+              struct vr_buffer *binary)
+{
+        const int n_base_args = 8;
+        int n_shaders = vr_list_length(shaders);
+        char **args = alloca((n_base_args + n_shaders + 1) * sizeof args[0]);
+        FILE **streams = alloca(n_shaders * sizeof streams[0]);
+        const struct vr_script_shader *shader;
+        enum vr_compiler_result result = VR_COMPILER_RESULT_ERROR;
+        FILE *module_stream = NULL;
+        char *module_filename;
+        int i;
+
+        memset(args + n_base_args, 0, (n_shaders + 1) * sizeof args[0]);
+
+        if (!vr_temp_file_create_named(config,
+                                       &module_stream,
+                                       &module_filename))
+                goto out;
+
+        args[0] = (char *) compiler;
+        args[1] = "-V";
+        args[2] = "--target-env";
+        args[3] = TARGET_ENV;
+        args[4] = "-S";
+        args[5] = (char *) stage_names[stage];
+        args[6] = "-o";
+        args[7] = module_filename;
+
+        i = n_base_args;
+        vr_list_for_each(shader, shaders, link) {
+                args[i] = create_file_for_shader(config,
+                                                 shader,
+                                                 streams + i - n_base_args);
+                if (args[i] == 0)
+                        goto out;
+                i++;
+        }
+
+        switch (vr_subprocess_command_capture(config, args, output)) {
+        case VR_SUBPROCESS_RESULT_OK:
+                break;
+        case VR_SUBPROCESS_RESULT_FAILED:
+                result = VR_COMPILER_RESULT_FAILED;
+                goto out;
+        case VR_SUBPROCESS_RESULT_ERROR:
+                goto out;
+        }
+
+        if (!load_stream_contents(config, module_stream, binary))
+                goto out;
+
+        result = VR_COMPILER_RESULT_OK;
+
+out:
+        for (i = 0; i < n_shaders; i++) {
+                if (args[i + n_base_args]) {
+                        fclose(streams[i]);
+                        vr_temp_file_remove(args[i + n_base_args]);
+                        vr_free(args[i + n_base_args]);
+                }
+        }
+
+        if (module_stream) {
+                fclose(module_stream);
+                vr_temp_file_remove(module_filename);
+                vr_free(module_filename);
+        }
+
+        return result;
+}
+
+static enum vr_compiler_result
+assemble_stage(const struct vr_config *config,
+               const struct vr_script_shader *shader,
+               const char *assembler,
+               struct vr_buffer *output,
+               struct vr_buffer *binary)
+{
+        enum vr_compiler_result result = VR_COMPILER_RESULT_ERROR;
+        FILE *module_stream = NULL;
+        char *module_filename;
+        char *source_filename = NULL;
+        FILE *source_stream;
+
+        if (!vr_temp_file_create_named(config,
+                                       &module_stream,
+                                       &module_filename))
+                goto out;
+
+        source_filename = create_file_for_shader(config,
+                                                 shader,
+                                                 &source_stream);
+        if (source_filename == NULL)
+                goto out;
+
+        char *args[] = {
+                (char *) assembler,
+                "--target-env", TARGET_ENV,
+                "-o", module_filename,
+                source_filename,
+                NULL
+        };
+
+        switch (vr_subprocess_command_capture(config, args, output)) {
+        case VR_SUBPROCESS_RESULT_OK:
+                break;
+        case VR_SUBPROCESS_RESULT_FAILED:
+                result = VR_COMPILER_RESULT_FAILED;
+                goto out;
+        case VR_SUBPROCESS_RESULT_ERROR:
+                goto out;
+        }
+
+        if (!load_stream_contents(config, module_stream, binary))
+                goto out;
+
+        result = VR_COMPILER_RESULT_OK;
+
+out:
+        if (source_filename) {
+                fclose(source_stream);
+                vr_temp_file_remove(source_filename);
+                vr_free(source_filename);
+        }
+
+        if (module_stream) {
+                fclose(module_stream);
+                vr_temp_file_remove(module_filename);
+                vr_free(module_filename);
+        }
+
+        return result;
+}
+
+static bool
+init_worker_cache_key(const struct vr_config *config,
+                      struct vr_shader_cache_key *key,
+                      const char *compiler)
+{
+        const char *command =
+                vr_subprocess_pool_get_command(config->compiler_pool);
+        struct vr_shader_cache_key compiler_key;
+
+        if (!vr_shader_cache_key_init(key, command))
+                return false;
+
+        /* The worker might run the same compiler locally so it is
+         * identified too if it can be found. Otherwise only its
+         * name is used.
+         */
+        if (vr_shader_cache_key_init(&compiler_key, compiler)) {
+                vr_shader_cache_key_add(key,
+                                        compiler_key.data.data,
+                                        compiler_key.data.length);
+                vr_shader_cache_key_destroy(&compiler_key);
+        } else {
+                vr_shader_cache_key_add_string(key, compiler);
+        }
+
+        return true;
+}
+
+bool
+vr_compiler_init_cache_key(const struct vr_config *config,
+                           struct vr_shader_cache_key *key,
+                           enum vr_shader_stage stage,
+                           const struct vr_list *shaders)
+{
+        const struct vr_script_shader *shader =
+                vr_container_of(shaders->next,
+                                struct vr_script_shader,
+                                link);
+        const char *builtin = get_builtin_compiler(shader->source_type);
+        const char *compiler = get_compiler(shader->source_type);
+
+        if (builtin) {
+                vr_shader_cache_key_init_builtin(key, builtin);
+        } else if (config->compiler_pool) {
+                /* vr_compiler_run sends the shaders to the worker
+                 * instead so the key needs to identify it.
+                 */
+                if (!init_worker_cache_key(config, key, compiler))
+                        return false;
+        } else if (!vr_shader_cache_key_init(key, compiler)) {
+                return false;
+        }
+
+        /* The key needs to contain everything that affects the
+         * output of the compiler. If the arguments passed to the
+         * compiler change then they should be reflected here too.
+         */
+        vr_shader_cache_key_add_string(key, TARGET_ENV);
+        vr_shader_cache_key_add_string(key, stage_names[stage]);
+
+        vr_list_for_each(shader, shaders, link) {
+                vr_shader_cache_key_add(key, shader->source, shader->length);
+
+                /* Only the first shader is used for SPIR-V assembly */
+                if (shader->source_type != VR_SCRIPT_SOURCE_TYPE_GLSL)
+                        break;
+        }
+
+        return true;
+}
+
+static void
+append_uint32(struct vr_buffer *buffer,
+              uint32_t value)
+{
+        vr_buffer_append(buffer, &value, sizeof value);
+}
+
+static bool
+read_uint32(const uint8_t **p,
+            const uint8_t *end,
+            uint32_t *value)
+{
+        if (end - *p < sizeof *value)
+                return false;
+
+        memcpy(value, *p, sizeof *value);
+        *p += sizeof *value;
+
+        return true;
+}
+
+static bool
+read_data(const uint8_t **p,
+          const uint8_t *end,
+          const uint8_t **data,
+          uint32_t *length)
+{
+        if (!read_uint32(p, end, length) || end - *p < *length)
+                return false;
+
+        *data = *p;
+        *p += *length;
+
+        return true;
+}
+
+void
+vr_compiler_encode_request(struct vr_buffer *buffer,
+                           enum vr_shader_stage stage,
+                           const struct vr_list *shaders)
+{
+        const struct vr_script_shader *shader;
+
+        append_uint32(buffer, stage);
+        append_uint32(buffer, vr_list_length(shaders));
+
+        vr_list_for_each(shader, shaders, link) {
+                append_uint32(buffer, shader->source_type);
+                append_uint32(buffer, shader->length);
+                vr_buffer_append(buffer, shader->source, shader->length);
+        }
+}
+
+bool
+vr_compiler_decode_request(const void *data,
+                           size_t size,
+                           enum vr_shader_stage *stage_out,
+                           struct vr_list *shaders)
+{
+        const uint8_t *p = data, *end = p + size;
+        uint32_t stage, n_shaders;
+
+        if (!read_uint32(&p, end, &stage) ||
+            stage >= VR_SHADER_STAGE_N_STAGES ||
+            !read_uint32(&p, end, &n_shaders) ||
+            n_shaders < 1)
+                return false;
+
+        for (uint32_t i = 0; i < n_shaders; i++) {
+                uint32_t source_type, length;
+                const uint8_t *source;
+
+                if (!read_uint32(&p, end, &source_type) ||
+                    (source_type != VR_SCRIPT_SOURCE_TYPE_GLSL &&
+                     source_type != VR_SCRIPT_SOURCE_TYPE_SPIRV) ||
+                    !read_data(&p, end, &source, &length))
+                        return false;
+
+                struct vr_script_shader *shader =
+                        vr_alloc(sizeof *shader + length);
+                shader->source_type = source_type;
+                shader->length = length;
+                memcpy(shader->source, source, length);
+                vr_list_insert(shaders->prev, &shader->link);
+        }
+
+        *stage_out = stage;
+
+        return true;
+}
+
+void
+vr_compiler_encode_reply(struct vr_buffer *buffer,
+                         enum vr_compiler_result result,
+                         const struct vr_buffer *output,
+                         const struct vr_buffer *binary)
+{
+        append_uint32(buffer, result);
+        append_uint32(buffer, output->length);
+        vr_buffer_append(buffer, output->data, output->length);
+        append_uint32(buffer, binary->length);
+        vr_buffer_append(buffer, binary->data, binary->length);
+}
+
+static enum vr_compiler_result
+run_worker(const struct vr_config *config,
+           enum vr_shader_stage stage,
+           const struct vr_list *shaders,
+           struct vr_buffer *output,
+           struct vr_buffer *binary)
+{
+        struct vr_buffer request = VR_BUFFER_STATIC_INIT;
+        struct vr_buffer reply = VR_BUFFER_STATIC_INIT;
+        enum vr_compiler_result ret = VR_COMPILER_RESULT_ERROR;
+        uint32_t result, length;
+        const uint8_t *data;
+
+        vr_compiler_encode_request(&request, stage, shaders);
+
+        if (!vr_subprocess_pool_request(config,
+                                        config->compiler_pool,
+                                        request.data,
+                                        request.length,
+                                        &reply))
+                goto out;
+
+        const uint8_t *p = reply.data, *end = p + reply.length;
+
+        if (!read_uint32(&p, end, &result) ||
+            result > VR_COMPILER_RESULT_ERROR ||
+            !read_data(&p, end, &data, &length)) {
+                vr_error_message(config, "Invalid reply from compiler worker");
+                goto out;
+        }
+
+        /* Report the messages in the same way as if the compiler
+         * was run directly.
+         */
+        const uint8_t *line = data, *data_end = data + length;
+
+        while (line < data_end) {
+                const uint8_t *eol = memchr(line, '\n', data_end - line);
+                size_t line_length = (eol ? eol : data_end) - line;
+                char *str = vr_strndup((const char *) line, line_length);
+
+                vr_error_message_string(config, str);
+                vr_free(str);
+
+                if (eol == NULL)
+                        break;
+                line = eol + 1;
+        }
+
+        if (output)
+                vr_buffer_append(output, data, length);
+
+        if (!read_data(&p, end, &data, &length)) {
+                vr_error_message(config, "Invalid reply from compiler worker");
+                goto out;
+        }
+
+        vr_buffer_append(binary, data, length);
+
+        ret = result;
+
+out:
+        vr_buffer_destroy(&reply);
+        vr_buffer_destroy(&request);
+
+        return ret;
+}
+
+enum vr_compiler_result
+vr_compiler_run(const struct vr_config *config,
+                enum vr_shader_stage stage,
+                const struct vr_list *shaders,
+                struct vr_buffer *output,
+                struct vr_buffer *binary)
+{
+        struct vr_script_shader *shader =
+                vr_container_of(shaders->next,
+                                struct vr_script_shader,
+                                link);
+        const char *builtin = get_builtin_compiler(shader->source_type);
+        const char *compiler;
+
+        if (builtin == NULL) {
+                if (config->compiler_pool) {
+                        return run_worker(config,
+                                          stage,
+                                          shaders,
+                                          output,
+                                          binary);
+                }
+
+                compiler = get_compiler(shader->source_type);
+        }
+
+        switch (shader->source_type) {
+        case VR_SCRIPT_SOURCE_TYPE_GLSL:
+                if (builtin == NULL) {
+                        return compile_stage(config,
+                                             stage,
+                                             shaders,
+                                             compiler,
+                                             output,
+                                             binary);
+                }
+
+                if (vr_glslang_compile(config, stage, shaders, output, binary))
+                        return VR_COMPILER_RESULT_OK;
+                else
+                        return VR_COMPILER_RESULT_FAILED;
+        case VR_SCRIPT_SOURCE_TYPE_SPIRV:
+                if (builtin == NULL) {
+                        return assemble_stage(config,
+                                              shader,
+                                              compiler,
+                                              output,
+                                              binary);
+                }
+
+                if (vr_spirv_tools_assemble(config,
+                                            shader->source,
+                                            shader->length,
+                                            output,
+                                            binary))
+                        return VR_COMPILER_RESULT_OK;
+                else
+                        return VR_COMPILER_RESULT_FAILED;
+        case VR_SCRIPT_SOURCE_TYPE_BINARY:
+                break;
+        }
+
+        vr_fatal("should not be reached");
+}
+
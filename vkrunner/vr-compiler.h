@@ -0,0 +1,110 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VR_COMPILER_H
+#define VR_COMPILER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vr-config.h"
+#include "vr-buffer.h"
+#include "vr-list.h"
+#include "vr-script-private.h"
+#include "vr-shader-cache.h"
+
+enum vr_compiler_result {
+        VR_COMPILER_RESULT_OK,
+        /* The compiler ran but reported an error */
+        VR_COMPILER_RESULT_FAILED,
+        /* Something else went wrong, such as creating a temporary file */
+        VR_COMPILER_RESULT_ERROR
+};
+
+/* Compiles or assembles a list of vr_script_shaders for a stage to
+ * SPIR-V and appends it to binary. The shaders must all be either
+ * GLSL or SPIR-V assembly. The compiler is either one linked into
+ * VkRunner, a worker from the config’s worker pool or an external
+ * binary. The messages from the compiler are reported and also
+ * appended to output if it is not NULL.
+ */
+enum vr_compiler_result
+vr_compiler_run(const struct vr_config *config,
+                enum vr_shader_stage stage,
+                const struct vr_list *shaders,
+                struct vr_buffer *output,
+                struct vr_buffer *binary);
+
+/* Initialises a shader cache key identifying the compiler that
+ * vr_compiler_run would use and the given sources. Returns false if
+ * the compiler can’t be identified.
+ */
+bool
+vr_compiler_init_cache_key(const struct vr_config *config,
+                           struct vr_shader_cache_key *key,
+                           enum vr_shader_stage stage,
+                           const struct vr_list *shaders);
+
+/* Returns the name of the compiler for the source type to use in
+ * error messages.
+ */
+const char *
+vr_compiler_get_name(enum vr_script_source_type source_type);
+
+void
+vr_compiler_show_disassembly(const struct vr_config *config,
+                             const void *binary,
+                             size_t size);
+
+/* Protocol used to talk to the compiler workers. Each message is
+ * framed by vr_subprocess_pool. All of the integers are native-endian
+ * uint32_t. A request contains the stage and the number of shaders
+ * followed by the source type, length and source of each shader. The
+ * reply contains the result, the length of the messages from the
+ * compiler followed by the messages and then the length of the SPIR-V
+ * binary followed by the binary.
+ */
+
+void
+vr_compiler_encode_request(struct vr_buffer *buffer,
+                           enum vr_shader_stage stage,
+                           const struct vr_list *shaders);
+
+/* Decodes a request and adds newly allocated vr_script_shaders to
+ * the list.
+ */
+bool
+vr_compiler_decode_request(const void *data,
+                           size_t size,
+                           enum vr_shader_stage *stage_out,
+                           struct vr_list *shaders);
+
+void
+vr_compiler_encode_reply(struct vr_buffer *buffer,
+                         enum vr_compiler_result result,
+                         const struct vr_buffer *output,
+                         const struct vr_buffer *binary);
+
+#endif /* VR_COMPILER_H */
@@ -30,6 +30,9 @@
 #include "vr-config.h"
 #include "vr-callback.h"
 #include "vr-strtof.h"
+#include "vr-shader-cache.h"
+#include "vr-subprocess.h"
+#include "vr-thread.h"
 
 struct vr_config {
         bool show_disassembly;
@@ -37,8 +40,24 @@ struct vr_config {
         vr_callback_error error_cb;
         vr_callback_inspect inspect_cb;
         void *user_data;
+        /* Held while calling the callbacks so that executors on
+         * different threads can share the config.
+         */
+        vr_mutex_t callback_mutex;
 
         struct vr_strtof_data strtof_data;
+
+        struct vr_shader_cache *shader_cache;
+
+        struct vr_subprocess_pool *compiler_pool;
+
+        char *pipeline_cache_file;
+
+        unsigned pipeline_threads;
+
+        bool deferred_probes;
+
+        size_t window_cache_size;
 };
 
 #endif /* VR_CONFIG_PRIVATE_H */
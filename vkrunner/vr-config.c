@@ -27,11 +27,20 @@
 #include "vr-config-private.h"
 #include "vr-util.h"
 
+/* Default maximum amount of memory that the images of the cached
+ * windows can use before the least recently used ones are freed.
+ */
+#define DEFAULT_WINDOW_CACHE_SIZE (256 * 1024 * 1024)
+
 struct vr_config *
 vr_config_new(void)
 {
         struct vr_config *config = vr_calloc(sizeof(struct vr_config));
         vr_strtof_init(&config->strtof_data);
+        vr_mutex_init(&config->callback_mutex);
+        config->pipeline_threads = 1;
+        config->deferred_probes = true;
+        config->window_cache_size = DEFAULT_WINDOW_CACHE_SIZE;
         return config;
 }
 
@@ -39,7 +48,13 @@ vr_config_new(void)
 void
 vr_config_free(struct vr_config *config)
 {
+        if (config->shader_cache)
+                vr_shader_cache_free(config->shader_cache);
+        if (config->compiler_pool)
+                vr_subprocess_pool_free(config->compiler_pool);
+        vr_free(config->pipeline_cache_file);
         vr_strtof_destroy(&config->strtof_data);
+        vr_mutex_destroy(&config->callback_mutex);
         vr_free(config);
 }
 
@@ -70,3 +85,73 @@ vr_config_set_inspect_cb(struct vr_config *config,
 {
         config->inspect_cb = inspect_cb;
 }
+
+void
+vr_config_set_shader_cache_dir(struct vr_config *config,
+                               const char *dir)
+{
+        if (config->shader_cache) {
+                vr_shader_cache_free(config->shader_cache);
+                config->shader_cache = NULL;
+        }
+
+        if (dir)
+                config->shader_cache = vr_shader_cache_new(dir);
+}
+
+void
+vr_config_get_shader_cache_stats(const struct vr_config *config,
+                                 unsigned *hits_out,
+                                 unsigned *misses_out)
+{
+        if (config->shader_cache) {
+                vr_shader_cache_get_stats(config->shader_cache,
+                                          hits_out,
+                                          misses_out);
+        } else {
+                *hits_out = 0;
+                *misses_out = 0;
+        }
+}
+
+void
+vr_config_set_compiler_worker(struct vr_config *config,
+                              const char *command)
+{
+        if (config->compiler_pool) {
+                vr_subprocess_pool_free(config->compiler_pool);
+                config->compiler_pool = NULL;
+        }
+
+        if (command)
+                config->compiler_pool = vr_subprocess_pool_new(command);
+}
+
+void
+vr_config_set_pipeline_cache_file(struct vr_config *config,
+                                  const char *filename)
+{
+        vr_free(config->pipeline_cache_file);
+        config->pipeline_cache_file = filename ? vr_strdup(filename) : NULL;
+}
+
+void
+vr_config_set_pipeline_threads(struct vr_config *config,
+                               unsigned n_threads)
+{
+        config->pipeline_threads = MAX(1, n_threads);
+}
+
+void
+vr_config_set_deferred_probes(struct vr_config *config,
+                              bool deferred_probes)
+{
+        config->deferred_probes = deferred_probes;
+}
+
+void
+vr_config_set_window_cache_size(struct vr_config *config,
+                                size_t size)
+{
+        config->window_cache_size = size;
+}
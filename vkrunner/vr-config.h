@@ -27,6 +27,7 @@
 #define VR_CONFIG_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <vkrunner/vr-callback.h>
 
 #ifdef  __cplusplus
@@ -48,7 +49,8 @@ vr_config_set_show_disassembly(struct vr_config *config,
                                bool show_disassembly);
 
 /* Sets a pointer to be passed back to the caller in all of the
- * callback fuctions below.
+ * callback fuctions below. The callbacks must not use VkRunner
+ * themselves, see vr-executor.h.
  */
 void
 vr_config_set_user_data(struct vr_config *config,
@@ -71,6 +73,76 @@ void
 vr_config_set_inspect_cb(struct vr_config *config,
                          vr_callback_inspect inspect_cb);
 
+/* Sets a directory in which to keep the results of compiling the
+ * GLSL and SPIR-V assembly shaders so that subsequent runs with the
+ * same source don’t need to invoke the compiler again. The directory
+ * will be created if it doesn’t already exist. Set to NULL to
+ * disable the cache, which is the default.
+ */
+void
+vr_config_set_shader_cache_dir(struct vr_config *config,
+                               const char *dir);
+
+/* Gets the number of times a shader was found or not found in the
+ * cache since it was enabled.
+ */
+void
+vr_config_get_shader_cache_stats(const struct vr_config *config,
+                                 unsigned *hits_out,
+                                 unsigned *misses_out);
+
+/* Sets a command to run as a persistent compiler worker. Instead of
+ * starting glslangValidator or spirv-as for every shader, requests
+ * are sent to a pool of these workers which are kept running until
+ * the config is freed. This is only used when the compiler isn’t
+ * linked into VkRunner and it is only supported on POSIX systems.
+ * Set to NULL to disable, which is the default.
+ */
+void
+vr_config_set_compiler_worker(struct vr_config *config,
+                              const char *command);
+
+/* Sets a file in which to keep a VkPipelineCache between runs. It is
+ * loaded when an executor first creates a Vulkan context as long as
+ * it was written for the same device. The contents are carried over
+ * when the context is recreated and the merged contents are written
+ * back once when the executor is freed. Set to NULL to disable, which
+ * is the default.
+ */
+void
+vr_config_set_pipeline_cache_file(struct vr_config *config,
+                                  const char *filename);
+
+/* Sets the number of threads to use to create the pipelines of a
+ * script. The pipelines are always passed to the driver in batches
+ * and with more than one thread the batches are split between them.
+ * The default is 1.
+ */
+void
+vr_config_set_pipeline_threads(struct vr_config *config,
+                               unsigned n_threads);
+
+/* Sets whether the probes are checked together once the commands
+ * before them have been submitted. Otherwise each probe submits the
+ * commands and waits for them to finish before it is checked, so its
+ * failure is reported before the next command runs. The results are
+ * the same either way. The default is true.
+ */
+void
+vr_config_set_deferred_probes(struct vr_config *config,
+                              bool deferred_probes);
+
+/* Sets the maximum number of bytes that the images of the windows
+ * kept for reuse by an executor can use. When a new window would
+ * take the total over this, the least recently used ones are freed,
+ * although the window needed by the current script is always kept.
+ * Set to 0 to only keep the most recent window. The default is
+ * 256MiB.
+ */
+void
+vr_config_set_window_cache_size(struct vr_config *config,
+                                size_t size);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -31,49 +31,27 @@
 #include <string.h>
 
 #include "vr-context.h"
+#include "vr-instance.h"
 #include "vr-util.h"
 #include "vr-error-message.h"
 #include "vr-allocate-store.h"
 #include "vr-feature-offsets.h"
 
-static int
-find_queue_family(struct vr_context *context,
-                  VkPhysicalDevice physical_device)
-{
-        struct vr_vk *vkfn = &context->vkfn;
-        VkQueueFamilyProperties *queues;
-        uint32_t count = 0;
-        uint32_t i;
-
-        vkfn->vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
-                                                       &count,
-                                                       NULL /* queues */);
-
-        queues = vr_alloc(sizeof *queues * count);
-
-        vkfn->vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
-                                                       &count,
-                                                       queues);
-
-        for (i = 0; i < count; i++) {
-                if ((queues[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
-                    queues[i].queueCount >= 1)
-                        break;
-        }
-
-        vr_free(queues);
-
-        if (i >= count)
-                return -1;
-        else
-                return i;
-}
-
 static void
 deinit_vk(struct vr_context *context)
 {
         struct vr_vk *vkfn = &context->vkfn;
 
+        if (context->arena) {
+                vr_allocate_store_arena_free(context->arena);
+                context->arena = NULL;
+        }
+        if (context->pipeline_cache) {
+                vkfn->vkDestroyPipelineCache(context->device,
+                                             context->pipeline_cache,
+                                             NULL /* allocator */);
+                context->pipeline_cache = VK_NULL_HANDLE;
+        }
         if (context->vk_fence) {
                 vkfn->vkDestroyFence(context->device,
                                      context->vk_fence,
@@ -99,9 +77,9 @@ deinit_vk(struct vr_context *context)
                                               NULL /* allocator */);
                         context->device = VK_NULL_HANDLE;
                 }
-                if (context->vk_instance) {
-                        vkfn->vkDestroyInstance(context->vk_instance,
-                                                NULL /* allocator */);
+                if (context->instance) {
+                        vr_instance_unref(context->instance);
+                        context->instance = NULL;
                         context->vk_instance = VK_NULL_HANDLE;
                 }
         }
@@ -116,6 +94,15 @@ get_feature(const VkPhysicalDeviceFeatures *features,
         return *(const VkBool32 *) ((const uint8_t *) features + fo->offset);
 }
 
+static void
+set_feature(VkPhysicalDeviceFeatures *features,
+            int feature_num)
+{
+        const struct vr_feature_offset *fo =
+                vr_feature_offsets + feature_num;
+        *(VkBool32 *) ((uint8_t *) features + fo->offset) = VK_TRUE;
+}
+
 static bool
 check_features(const VkPhysicalDeviceFeatures *features,
                const VkPhysicalDeviceFeatures *requires)
@@ -143,10 +130,10 @@ find_extension(uint32_t property_count,
         return false;
 }
 
-static bool
-check_extensions(struct vr_context *context,
-                 VkPhysicalDevice device,
-                 const char *const *extensions)
+static VkExtensionProperties *
+get_extension_properties(struct vr_context *context,
+                         VkPhysicalDevice device,
+                         uint32_t *property_count_out)
 {
         struct vr_vk *vkfn = &context->vkfn;
         VkResult res;
@@ -157,78 +144,136 @@ check_extensions(struct vr_context *context,
                                                          &property_count,
                                                          NULL /* properties */);
         if (res != VK_SUCCESS)
-                return false;
+                return NULL;
 
         VkExtensionProperties *props = vr_alloc(property_count * sizeof *props);
-        bool ret = true;
 
         res = vkfn->vkEnumerateDeviceExtensionProperties(device,
                                                          NULL, /* layerName */
                                                          &property_count,
                                                          props);
-        if (res == VK_SUCCESS) {
-                for (const char * const *ext = extensions; *ext; ext++) {
-                        if (!find_extension(property_count, props, *ext)) {
-                                ret = false;
-                                break;
-                        }
-                }
-        } else {
-                ret = false;
+        if (res != VK_SUCCESS) {
+                vr_free(props);
+                return NULL;
         }
 
-        vr_free(props);
+        *property_count_out = property_count;
 
-        return ret;
+        return props;
 }
 
-static enum vr_result
-find_physical_device(struct vr_context *context,
-                     const VkPhysicalDeviceFeatures *requires,
-                     const char *const *extensions)
+static bool
+check_extensions(uint32_t property_count,
+                 const VkExtensionProperties *props,
+                 const char *const *extensions)
+{
+        for (const char * const *ext = extensions; *ext; ext++) {
+                if (!find_extension(property_count, props, *ext))
+                        return false;
+        }
+
+        return true;
+}
 
+static void
+add_optional_features(struct vr_context *context,
+                      const VkPhysicalDeviceFeatures *optional_features)
 {
-        struct vr_vk *vkfn = &context->vkfn;
-        VkResult res;
-        uint32_t count;
-        VkPhysicalDevice *devices;
-        int i, queue_family;
+        for (int i = 0; vr_feature_offsets[i].name; i++) {
+                if (get_feature(optional_features, i) &&
+                    get_feature(&context->features, i))
+                        set_feature(&context->enabled_features, i);
+        }
+}
 
-        res = vkfn->vkEnumeratePhysicalDevices(context->vk_instance,
-                                               &count,
-                                               NULL);
-        if (res != VK_SUCCESS) {
-                vr_error_message(context->config,
-                                 "Error enumerating VkPhysicalDevices");
-                return VR_RESULT_FAIL;
+static bool
+has_extension(char **extensions,
+              const char *extension)
+{
+        for (char **ext = extensions; *ext; ext++) {
+                if (!strcmp(*ext, extension))
+                        return true;
         }
 
-        devices = alloca(count * sizeof *devices);
+        return false;
+}
 
-        res = vkfn->vkEnumeratePhysicalDevices(context->vk_instance,
-                                               &count,
-                                               devices);
-        if (res != VK_SUCCESS) {
-                vr_error_message(context->config,
-                                 "Error enumerating VkPhysicalDevices");
-                return VR_RESULT_FAIL;
+/* Builds the list of extensions to enable on the device. This is all
+ * of the required extensions followed by any of the optional ones
+ * that the device supports.
+ */
+static char **
+get_enabled_extensions(struct vr_context *context,
+                       const char *const *extensions,
+                       const char *const *optional_extensions)
+{
+        int n_extensions = 0;
+        int n_enabled = 0;
+
+        for (const char * const *ext = extensions; *ext; ext++)
+                n_extensions++;
+        if (optional_extensions) {
+                for (const char * const *ext = optional_extensions;
+                     *ext;
+                     ext++)
+                        n_extensions++;
         }
 
-        for (i = 0; i < count; i++) {
-                VkPhysicalDeviceFeatures features;
-                vkfn->vkGetPhysicalDeviceFeatures(devices[i], &features);
-                if (!check_features(&features, requires))
+        char **enabled = vr_alloc((n_extensions + 1) * sizeof *enabled);
+
+        for (const char * const *ext = extensions; *ext; ext++)
+                enabled[n_enabled++] = vr_strdup(*ext);
+
+        enabled[n_enabled] = NULL;
+
+        if (optional_extensions == NULL)
+                return enabled;
+
+        const struct vr_physical_device *info = context->physical_device_info;
+
+        for (const char * const *ext = optional_extensions; *ext; ext++) {
+                if (!find_extension(info->n_extensions,
+                                    info->extensions,
+                                    *ext) ||
+                    has_extension(enabled, *ext))
                         continue;
 
-                if (!check_extensions(context, devices[i], extensions))
+                enabled[n_enabled++] = vr_strdup(*ext);
+                enabled[n_enabled] = NULL;
+        }
+
+        return enabled;
+}
+
+static enum vr_result
+find_physical_device(struct vr_context *context,
+                     const VkPhysicalDeviceFeatures *requires,
+                     const char *const *extensions)
+
+{
+        const struct vr_instance *instance = context->instance;
+
+        for (uint32_t i = 0; i < instance->n_physical_devices; i++) {
+                const struct vr_physical_device *info =
+                        instance->physical_devices + i;
+
+                if (!check_features(&info->features, requires))
+                        continue;
+
+                if (!check_extensions(info->n_extensions,
+                                      info->extensions,
+                                      extensions))
                         continue;
 
-                queue_family = find_queue_family(context, devices[i]);
-                if (queue_family == -1)
+                if (info->queue_family == -1)
                         continue;
 
-                context->physical_device = devices[i];
-                context->queue_family = queue_family;
+                context->physical_device_info = info;
+                context->physical_device = info->physical_device;
+                context->queue_family = info->queue_family;
+                context->device_properties = info->properties;
+                context->memory_properties = info->memory_properties;
+                context->features = info->features;
 
                 return VR_RESULT_PASS;
         }
@@ -239,51 +284,38 @@ find_physical_device(struct vr_context *context,
         return VR_RESULT_SKIP;
 }
 
-static void *
-get_instance_proc(const char *name,
-                  void *user_data)
-{
-        struct vr_context *context = user_data;
-        struct vr_vk *vkfn = &context->vkfn;
-
-        return vkfn->vkGetInstanceProcAddr(context->vk_instance, name);
-}
-
 static enum vr_result
 init_vk_device(struct vr_context *context,
+               struct vr_instance *instance,
                const VkPhysicalDeviceFeatures *requires,
-               const char *const *extensions)
+               const char *const *extensions,
+               const VkPhysicalDeviceFeatures *optional_features,
+               const char *const *optional_extensions)
 {
         struct vr_vk *vkfn = &context->vkfn;
+        enum vr_result vres;
         VkResult res;
 
-        struct VkInstanceCreateInfo instance_create_info = {
-                .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-                .pApplicationInfo = &(VkApplicationInfo) {
-                        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-                        .pApplicationName = "vkrunner",
-                        .apiVersion = VK_MAKE_VERSION(1, 0, 2)
-                },
-        };
-        res = vkfn->vkCreateInstance(&instance_create_info,
-                                     NULL, /* allocator */
-                                     &context->vk_instance);
-
-        if (res != VK_SUCCESS) {
-                vr_error_message(context->config,
-                                 "Failed to create VkInstance");
-                return VR_RESULT_FAIL;
-        }
-
-        vr_vk_init_instance(vkfn, get_instance_proc, context);
+        context->instance = vr_instance_ref(instance);
+        context->vk_instance = instance->vk_instance;
+        /* The device functions are added to this copy of the table */
+        *vkfn = instance->vkfn;
 
-        enum vr_result vres =
-                find_physical_device(context, requires, extensions);
+        vres = find_physical_device(context, requires, extensions);
         if (vres != VR_RESULT_PASS)
                 return vres;
 
+        context->enabled_features = *requires;
+        if (optional_features)
+                add_optional_features(context, optional_features);
+
+        context->enabled_extensions =
+                get_enabled_extensions(context,
+                                       extensions,
+                                       optional_extensions);
+
         int n_extensions = 0;
-        for (const char * const *ext = extensions; *ext; ext++)
+        for (char **ext = context->enabled_extensions; *ext; ext++)
                 n_extensions++;
 
         VkDeviceCreateInfo device_create_info = {
@@ -296,8 +328,11 @@ init_vk_device(struct vr_context *context,
                         .pQueuePriorities = (float[]) { 1.0f }
                 },
                 .enabledExtensionCount = n_extensions,
-                .ppEnabledExtensionNames = n_extensions ? extensions : NULL,
-                .pEnabledFeatures = requires
+                .ppEnabledExtensionNames =
+                (n_extensions ?
+                 (const char *const *) context->enabled_extensions :
+                 NULL),
+                .pEnabledFeatures = &context->enabled_features
         };
         res = vkfn->vkCreateDevice(context->physical_device,
                                    &device_create_info,
@@ -315,18 +350,9 @@ static enum vr_result
 init_vk(struct vr_context *context)
 {
         struct vr_vk *vkfn = &context->vkfn;
-        VkPhysicalDeviceMemoryProperties *memory_properties =
-                &context->memory_properties;
         enum vr_result vres = VR_RESULT_PASS;
         VkResult res;
 
-        vkfn->vkGetPhysicalDeviceProperties(context->physical_device,
-                                            &context->device_properties);
-        vkfn->vkGetPhysicalDeviceMemoryProperties(context->physical_device,
-                                                  memory_properties);
-        vkfn->vkGetPhysicalDeviceFeatures(context->physical_device,
-                                          &context->features);
-
         vr_vk_init_device(vkfn, context->device);
 
         vkfn->vkGetDeviceQueue(context->device,
@@ -380,6 +406,8 @@ init_vk(struct vr_context *context)
                 goto error;
         }
 
+        context->arena = vr_allocate_store_arena_new(context);
+
         return VR_RESULT_PASS;
 
 error:
@@ -391,7 +419,29 @@ bool
 vr_context_check_extensions(struct vr_context *context,
                             const char *const *extensions)
 {
-        return check_extensions(context, context->physical_device, extensions);
+        const struct vr_physical_device *info = context->physical_device_info;
+
+        if (info) {
+                return check_extensions(info->n_extensions,
+                                        info->extensions,
+                                        extensions);
+        }
+
+        /* The extensions of an external device aren’t cached */
+        uint32_t property_count;
+        VkExtensionProperties *props =
+                get_extension_properties(context,
+                                         context->physical_device,
+                                         &property_count);
+
+        if (props == NULL)
+                return false;
+
+        bool ret = check_extensions(property_count, props, extensions);
+
+        vr_free(props);
+
+        return ret;
 }
 
 bool
@@ -403,22 +453,24 @@ vr_context_check_features(struct vr_context *context,
 
 enum vr_result
 vr_context_new(const struct vr_config *config,
+               struct vr_instance *instance,
                const VkPhysicalDeviceFeatures *requires,
                const char *const *extensions,
+               const VkPhysicalDeviceFeatures *optional_features,
+               const char *const *optional_extensions,
                struct vr_context **context_out)
 {
         struct vr_context *context = vr_calloc(sizeof *context);
-        struct vr_vk *vkfn = &context->vkfn;
         enum vr_result vres;
 
-        if (!vr_vk_load_libvulkan(config, vkfn)) {
-                vres = VR_RESULT_FAIL;
-                goto error;
-        }
-
         context->config = config;
 
-        vres = init_vk_device(context, requires, extensions);
+        vres = init_vk_device(context,
+                              instance,
+                              requires,
+                              extensions,
+                              optional_features,
+                              optional_extensions);
         if (vres != VR_RESULT_PASS)
                 goto error;
 
@@ -455,6 +507,13 @@ vr_context_new_with_device(const struct vr_config *config,
 
         vr_vk_init_instance(vkfn, get_instance_proc_cb, user_data);
 
+        vkfn->vkGetPhysicalDeviceProperties(physical_device,
+                                            &context->device_properties);
+        vkfn->vkGetPhysicalDeviceMemoryProperties(physical_device,
+                                                  &context->memory_properties);
+        vkfn->vkGetPhysicalDeviceFeatures(physical_device,
+                                          &context->features);
+
         vres = init_vk(context);
         if (vres != VR_RESULT_PASS)
                 goto error;
@@ -472,8 +531,11 @@ vr_context_free(struct vr_context *context)
 {
         deinit_vk(context);
 
-        if (!context->device_is_external && context->vkfn.lib_vulkan)
-                vr_vk_unload_libvulkan(&context->vkfn);
+        if (context->enabled_extensions) {
+                for (char **ext = context->enabled_extensions; *ext; ext++)
+                        vr_free(*ext);
+                vr_free(context->enabled_extensions);
+        }
 
         vr_free(context);
 }
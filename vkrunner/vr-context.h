@@ -32,6 +32,10 @@
 #include "vr-result.h"
 #include "vr-config.h"
 
+struct vr_allocate_store_arena;
+struct vr_instance;
+struct vr_physical_device;
+
 struct vr_context {
         const struct vr_config *config;
 
@@ -39,23 +43,49 @@ struct vr_context {
 
         VkDevice device;
         VkPhysicalDevice physical_device;
+        /* The cached information about the physical device from the
+         * instance. This is NULL if the device is external.
+         */
+        const struct vr_physical_device *physical_device_info;
         VkPhysicalDeviceMemoryProperties memory_properties;
         VkPhysicalDeviceProperties device_properties;
         VkPhysicalDeviceFeatures features;
+        /* The features and extensions that were enabled when the
+         * device was created. These aren’t known for an external
+         * device so they are left empty.
+         */
+        VkPhysicalDeviceFeatures enabled_features;
+        char **enabled_extensions;
         VkCommandPool command_pool;
         VkCommandBuffer command_buffer;
         VkQueue queue;
         int queue_family;
+        /* The shared instance. This is NULL if the device is external */
+        struct vr_instance *instance;
         VkInstance vk_instance;
         VkFence vk_fence;
+        /* Shared by all of the pipelines created with the context.
+         * This is created by the executor so that it can carry the
+         * contents over from the previous context.
+         */
+        VkPipelineCache pipeline_cache;
+        /* Used to allocate the memory for the test buffers */
+        struct vr_allocate_store_arena *arena;
 
         struct vr_vk vkfn;
 };
 
+/* Creates a device from the instance that has all of the required
+ * features and extensions. Any of the optional ones that the device
+ * supports are also enabled. The optional ones can be NULL.
+ */
 enum vr_result
 vr_context_new(const struct vr_config *config,
+               struct vr_instance *instance,
                const VkPhysicalDeviceFeatures *requires,
                const char *const *extensions,
+               const VkPhysicalDeviceFeatures *optional_features,
+               const char *const *optional_extensions,
                struct vr_context **context_out);
 
 enum vr_result
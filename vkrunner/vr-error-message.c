@@ -36,32 +36,33 @@ void
 vr_error_message_string(const struct vr_config *config,
                         const char *str)
 {
+        /* The callback is only called from one thread at a time */
+        vr_mutex_t *mutex = (vr_mutex_t *) &config->callback_mutex;
+
+        vr_mutex_lock(mutex);
+
         if (config->error_cb) {
                 config->error_cb(str, config->user_data);
         } else {
                 fputs(str, stderr);
                 fputc('\n', stderr);
         }
+
+        vr_mutex_unlock(mutex);
 }
 
 void
 vr_error_message(const struct vr_config *config,
                  const char *format, ...)
 {
+        struct vr_buffer buf = VR_BUFFER_STATIC_INIT;
         va_list ap;
 
         va_start(ap, format);
+        vr_buffer_append_vprintf(&buf, format, ap);
+        va_end(ap);
 
-        if (config->error_cb) {
-                struct vr_buffer buf = VR_BUFFER_STATIC_INIT;
-                vr_buffer_append_vprintf(&buf, format, ap);
-                config->error_cb((const char *) buf.data,
-                                 config->user_data);
-                vr_buffer_destroy(&buf);
-        } else {
-                vfprintf(stderr, format, ap);
-                fputc('\n', stderr);
-        }
+        vr_error_message_string(config, (const char *) buf.data);
 
-        va_end(ap);
+        vr_buffer_destroy(&buf);
 }
@@ -35,21 +35,55 @@
 
 #include "vr-vk.h"
 #include "vr-window.h"
+#include "vr-instance.h"
 #include "vr-script-private.h"
 #include "vr-pipeline.h"
+#include "vr-object-cache.h"
+#include "vr-allocate-store.h"
 #include "vr-test.h"
 #include "vr-error-message.h"
 #include "vr-source-private.h"
+#include "vr-feature-offsets.h"
+#include "vr-pipeline-cache.h"
+
+struct cached_window {
+        struct vr_list link;
+        struct vr_window *window;
+        struct vr_object_cache *object_cache;
+        /* Estimate of the memory used by the images of the window */
+        size_t memory_size;
+};
 
 struct vr_executor {
         struct vr_config *config;
-        struct vr_window *window;
+        /* List of struct cached_window, most recently used first */
+        struct vr_list windows;
+        size_t windows_memory_size;
+        /* Reference to the shared instance. This is kept until the
+         * executor is freed so that only the device needs to be
+         * created again when the context is recreated.
+         */
+        struct vr_instance *instance;
         struct vr_context *context;
-        char **extensions;
-        VkPhysicalDeviceFeatures enabled_features;
+        /* Contents of the pipeline cache of the previous context. The
+         * cache is only written to the file when the executor is
+         * freed so that recreating the context doesn’t rewrite it.
+         */
+        struct vr_buffer pipeline_cache_data;
+        /* Memory allocations made by the arenas of previous contexts */
+        unsigned n_freed_memory_allocations;
 
         bool use_external;
 
+        /* Union of the requirements of the scripts added with
+         * vr_executor_add_batch_script. If use_batch is true then
+         * these are enabled on the device if they are supported.
+         */
+        bool use_batch;
+        VkPhysicalDeviceFeatures batch_features;
+        char **batch_extensions;
+        size_t n_batch_extensions;
+
         struct {
                 vr_executor_get_instance_proc_cb get_instance_proc_cb;
                 void *user_data;
@@ -60,12 +94,97 @@ struct vr_executor {
 };
 
 static void
-free_window(struct vr_executor *executor)
+free_cached_window(struct vr_executor *executor,
+                   struct cached_window *cached)
+{
+        vr_list_remove(&cached->link);
+        executor->windows_memory_size -= cached->memory_size;
+
+        vr_object_cache_free(cached->object_cache);
+        vr_window_free(cached->window);
+        vr_free(cached);
+}
+
+static void
+free_windows(struct vr_executor *executor)
+{
+        struct cached_window *cached, *tmp;
+
+        vr_list_for_each_safe(cached, tmp, &executor->windows, link)
+                free_cached_window(executor, cached);
+}
+
+static size_t
+get_window_memory_size(const struct vr_window *window)
+{
+        const struct vr_window_format *format = &window->format;
+        size_t pixel_size;
+
+        if (window->compute_only)
+                return 0;
+
+        /* The color image and the linear buffer */
+        pixel_size = vr_format_get_size(format->color_format) * 2;
+
+        if (format->depth_stencil_format)
+                pixel_size += vr_format_get_size(format->depth_stencil_format);
+
+        return pixel_size * window->image_width * window->image_height;
+}
+
+/* Finds a window that can be used for a script with the given format.
+ * If there are several then the smallest one is used.
+ */
+static struct cached_window *
+find_window(struct vr_executor *executor,
+            const struct vr_window_format *format,
+            bool compute_only)
+{
+        struct cached_window *cached, *best = NULL;
+
+        vr_list_for_each(cached, &executor->windows, link) {
+                /* Compute-only scripts can use any window */
+                if (compute_only)
+                        return cached;
+
+                if (!vr_window_is_compatible(cached->window, format))
+                        continue;
+
+                if (best == NULL || cached->memory_size < best->memory_size)
+                        best = cached;
+        }
+
+        return best;
+}
+
+static struct cached_window *
+add_window(struct vr_executor *executor,
+           struct vr_window *window)
 {
-        if (executor->window) {
-                vr_window_free(executor->window);
-                executor->window = NULL;
+        struct cached_window *cached = vr_alloc(sizeof *cached);
+
+        cached->window = window;
+        cached->object_cache = vr_object_cache_new(window);
+        cached->memory_size = get_window_memory_size(window);
+
+        vr_list_insert(&executor->windows, &cached->link);
+        executor->windows_memory_size += cached->memory_size;
+
+        /* Free the least recently used windows until the cache fits
+         * within the limit. The new window is always kept.
+         */
+        while (executor->windows_memory_size >
+               executor->config->window_cache_size) {
+                struct cached_window *last =
+                        vr_container_of(executor->windows.prev,
+                                        struct cached_window,
+                                        link);
+                if (last == cached)
+                        break;
+                free_cached_window(executor, last);
         }
+
+        return cached;
 }
 
 static void
@@ -74,17 +193,66 @@ free_context(struct vr_executor *executor)
         if (executor->context == NULL)
                 return;
 
-        free_window(executor);
+        free_windows(executor);
+
+        struct vr_allocate_store_stats stats;
+        vr_allocate_store_arena_get_stats(executor->context->arena, &stats);
+        executor->n_freed_memory_allocations += stats.n_memory_allocations;
+
+        if (executor->config->pipeline_cache_file &&
+            executor->context->pipeline_cache &&
+            !vr_pipeline_cache_get_data(executor->context,
+                                        &executor->pipeline_cache_data))
+                vr_buffer_set_length(&executor->pipeline_cache_data, 0);
 
         vr_context_free(executor->context);
         executor->context = NULL;
+}
 
-        if (!executor->use_external) {
-                for (char **ext = executor->extensions; *ext; ext++)
-                        vr_free(*ext);
+static bool
+get_feature(const VkPhysicalDeviceFeatures *features,
+            int feature_num)
+{
+        const struct vr_feature_offset *fo =
+                vr_feature_offsets + feature_num;
+        return *(const VkBool32 *) ((const uint8_t *) features + fo->offset);
+}
 
-                vr_free(executor->extensions);
+static bool
+has_extension(char **extensions,
+              const char *extension)
+{
+        if (extensions == NULL)
+                return false;
+
+        for (char **ext = extensions; *ext; ext++) {
+                if (!strcmp(*ext, extension))
+                        return true;
         }
+
+        return false;
+}
+
+/* Returns whether all of the features and extensions required by the
+ * script are in the given sets.
+ */
+static bool
+has_requirements(const VkPhysicalDeviceFeatures *features,
+                 char **extensions,
+                 const struct vr_script *script)
+{
+        for (int i = 0; vr_feature_offsets[i].name; i++) {
+                if (get_feature(&script->required_features, i) &&
+                    !get_feature(features, i))
+                        return false;
+        }
+
+        for (const char *const *ext = script->extensions; *ext; ext++) {
+                if (!has_extension(extensions, *ext))
+                        return false;
+        }
+
+        return true;
 }
 
 static bool
@@ -97,7 +265,16 @@ context_is_compatible(struct vr_executor *executor,
         if (executor->context->device_is_external)
                 return true;
 
-        if (memcmp(&executor->enabled_features,
+        /* In batch mode the device can have more than the script
+         * needs so that it can be shared */
+        if (executor->use_batch) {
+                struct vr_context *context = executor->context;
+                return has_requirements(&context->enabled_features,
+                                        context->enabled_extensions,
+                                        script);
+        }
+
+        if (memcmp(&executor->context->enabled_features,
                    &script->required_features,
                    sizeof script->required_features))
                 return false;
@@ -105,7 +282,7 @@ context_is_compatible(struct vr_executor *executor,
         const char *const *a;
         char **b;
 
-        for (a = script->extensions, b = executor->extensions;
+        for (a = script->extensions, b = executor->context->enabled_extensions;
              true;
              a++, b++) {
                 if (*a == NULL)
@@ -121,22 +298,31 @@ context_is_compatible(struct vr_executor *executor,
         return true;
 }
 
-static void
-copy_extensions(struct vr_executor *executor,
-                const char * const *extensions)
+/* Returns whether the script only uses compute shaders so that it can
+ * be run without creating a framebuffer.
+ */
+static bool
+script_is_compute_only(const struct vr_script *script)
 {
-        int n_extensions = 0;
-
-        for (const char * const *ext = extensions; *ext; ext++)
-                n_extensions++;
-
-        executor->extensions = vr_alloc((sizeof executor->extensions[0]) *
-                                        (n_extensions + 1));
+        for (int i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
+                if (i != VR_SHADER_STAGE_COMPUTE &&
+                    !vr_list_empty(&script->stages[i]))
+                        return false;
+        }
 
-        for (int i = 0; i < n_extensions; i++)
-                executor->extensions[i] = vr_strdup(extensions[i]);
+        for (size_t i = 0; i < script->n_commands; i++) {
+                switch (script->commands[i].op) {
+                case VR_SCRIPT_OP_DRAW_RECT:
+                case VR_SCRIPT_OP_DRAW_ARRAYS:
+                case VR_SCRIPT_OP_PROBE_RECT:
+                case VR_SCRIPT_OP_CLEAR:
+                        return false;
+                default:
+                        break;
+                }
+        }
 
-        executor->extensions[n_extensions] = NULL;
+        return true;
 }
 
 static enum vr_result
@@ -159,9 +345,40 @@ vr_executor_new(struct vr_config *config)
 {
         struct vr_executor *executor = vr_calloc(sizeof *executor);
         executor->config = config;
+        vr_list_init(&executor->windows);
+        vr_buffer_init(&executor->pipeline_cache_data);
         return executor;
 }
 
+void
+vr_executor_add_batch_script(struct vr_executor *executor,
+                             const struct vr_script *script)
+{
+        executor->use_batch = true;
+
+        for (int i = 0; vr_feature_offsets[i].name; i++) {
+                if (get_feature(&script->required_features, i)) {
+                        *(VkBool32 *) ((uint8_t *) &executor->batch_features +
+                                       vr_feature_offsets[i].offset) =
+                                VK_TRUE;
+                }
+        }
+
+        for (const char *const *ext = script->extensions; *ext; ext++) {
+                if (has_extension(executor->batch_extensions, *ext))
+                        continue;
+
+                executor->batch_extensions =
+                        vr_realloc(executor->batch_extensions,
+                                   (executor->n_batch_extensions + 2) *
+                                   sizeof executor->batch_extensions[0]);
+                executor->batch_extensions[executor->n_batch_extensions++] =
+                        vr_strdup(*ext);
+                executor->batch_extensions[executor->n_batch_extensions] =
+                        NULL;
+        }
+}
+
 void
 vr_executor_set_device(struct vr_executor *executor,
                        vr_executor_get_instance_proc_cb get_instance_proc_cb,
@@ -188,17 +405,33 @@ vr_executor_execute_script(struct vr_executor *executor,
 {
         enum vr_result res = VR_RESULT_PASS;
         struct vr_pipeline *pipeline = NULL;
+        struct cached_window *cached;
+        /* The inspection callback always gets the color buffer so
+         * the framebuffer is needed even for compute scripts.
+         */
+        bool compute_only = (executor->config->inspect_cb == NULL &&
+                             script_is_compute_only(script));
 
         /* Recreate the context if the required features or extensions
          * have changed */
-        if (executor->context && !context_is_compatible(executor, script))
-                free_context(executor);
+        if (executor->context && !context_is_compatible(executor, script)) {
+                /* In batch mode the device already has everything
+                 * from the batch that it supports so creating it
+                 * again won’t help.
+                 */
+                if (executor->use_batch &&
+                    has_requirements(&executor->batch_features,
+                                     executor->batch_extensions,
+                                     script)) {
+                        vr_error_message(executor->config,
+                                         "%s: A required feature or "
+                                         "extension is not supported",
+                                         script->filename);
+                        return VR_RESULT_SKIP;
+                }
 
-        /* Recreate the window if the framebuffer format is different */
-        if (executor->window &&
-            !vr_window_format_equal(&executor->window->format,
-                                    &script->window_format))
-                free_window(executor);
+                free_context(executor);
+        }
 
         if (executor->context == NULL) {
                 if (executor->use_external) {
@@ -206,16 +439,37 @@ vr_executor_execute_script(struct vr_executor *executor,
                         if (res != VR_RESULT_PASS)
                                 goto out;
                 } else {
+                        if (executor->instance == NULL) {
+                                res = vr_instance_ref_shared(
+                                        executor->config,
+                                        &executor->instance);
+                                if (res != VR_RESULT_PASS)
+                                        goto out;
+                        }
+
                         res = vr_context_new(executor->config,
+                                             executor->instance,
                                              &script->required_features,
                                              script->extensions,
+                                             (executor->use_batch ?
+                                              &executor->batch_features :
+                                              NULL),
+                                             (const char *const *)
+                                             executor->batch_extensions,
                                              &executor->context);
 
                         if (res != VR_RESULT_PASS)
                                 goto out;
+                }
 
-                        copy_extensions(executor, script->extensions);
-                        executor->enabled_features = script->required_features;
+                executor->context->pipeline_cache =
+                        vr_pipeline_cache_create(executor->context,
+                                                 &executor->
+                                                 pipeline_cache_data);
+                if (executor->context->pipeline_cache == VK_NULL_HANDLE) {
+                        free_context(executor);
+                        res = VR_RESULT_FAIL;
+                        goto out;
                 }
         }
 
@@ -239,16 +493,36 @@ vr_executor_execute_script(struct vr_executor *executor,
                 }
         }
 
-        if (executor->window == NULL) {
-                res = vr_window_new(executor->context,
-                                    &script->window_format,
-                                    &executor->window);
-                if (res != VR_RESULT_PASS)
-                        goto out;
+        cached = find_window(executor, &script->window_format, compute_only);
+
+        if (cached == NULL) {
+                struct vr_window *window;
+
+                if (compute_only) {
+                        window = vr_window_new_compute_only(
+                                executor->context,
+                                &script->window_format);
+                } else {
+                        res = vr_window_new(executor->context,
+                                            &script->window_format,
+                                            &window);
+                        if (res != VR_RESULT_PASS)
+                                goto out;
+                }
+
+                cached = add_window(executor, window);
+        } else {
+                vr_list_remove(&cached->link);
+                vr_list_insert(&executor->windows, &cached->link);
         }
 
+        /* Limit the rendering to the size requested by the script */
+        if (!compute_only)
+                cached->window->format = script->window_format;
+
         pipeline = vr_pipeline_create(executor->config,
-                                      executor->window,
+                                      cached->window,
+                                      cached->object_cache,
                                       script);
 
         if (pipeline == NULL) {
@@ -256,7 +530,7 @@ vr_executor_execute_script(struct vr_executor *executor,
                 goto out;
         }
 
-        if (!vr_test_run(executor->window, pipeline, script))
+        if (!vr_test_run(cached->window, pipeline, script))
                 res = VR_RESULT_FAIL;
 
 out:
@@ -287,9 +561,46 @@ out:
         return res;
 }
 
+void
+vr_executor_get_memory_stats(struct vr_executor *executor,
+                             unsigned *n_blocks_out,
+                             uint64_t *block_size_out,
+                             unsigned *n_memory_allocations_out)
+{
+        struct vr_allocate_store_stats stats = { .n_blocks = 0 };
+
+        if (executor->context)
+                vr_allocate_store_arena_get_stats(executor->context->arena,
+                                                  &stats);
+
+        *n_blocks_out = stats.n_blocks;
+        *block_size_out = stats.block_size;
+        *n_memory_allocations_out = (stats.n_memory_allocations +
+                                     executor->n_freed_memory_allocations);
+}
+
 void
 vr_executor_free(struct vr_executor *executor)
 {
+        /* If creating the last context failed then the contents of
+         * the previous one aren’t saved. The cache is only there to
+         * speed things up so nothing else is lost.
+         */
+        if (executor->context && executor->context->pipeline_cache)
+                vr_pipeline_cache_save(executor->context);
+
         free_context(executor);
+
+        vr_buffer_destroy(&executor->pipeline_cache_data);
+
+        if (executor->instance)
+                vr_instance_unref(executor->instance);
+
+        if (executor->batch_extensions) {
+                for (char **ext = executor->batch_extensions; *ext; ext++)
+                        vr_free(*ext);
+                vr_free(executor->batch_extensions);
+        }
+
         vr_free(executor);
 }
@@ -27,11 +27,23 @@
 #define VR_EXECUTOR_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <vkrunner/vr-result.h>
 #include <vkrunner/vr-source.h>
 #include <vkrunner/vr-callback.h>
 #include <vkrunner/vr-script.h>
 
+/* An executor must only be used by one thread at a time but
+ * different executors can run scripts on different threads at the
+ * same time. The Vulkan loader and VkInstance are shared by all of the
+ * executors in the process and each executor creates its own device,
+ * queue and command pool. Executors can share a vr_config as long as
+ * it isn’t modified while they are running. Its callbacks are only
+ * called from one thread at a time, but not necessarily the thread
+ * that created the config. They are called with a lock held so they
+ * must not call back into VkRunner, for example to load or run
+ * another script.
+ */
 struct vr_executor;
 
 typedef void *
@@ -70,6 +82,28 @@ vr_executor_set_device(struct vr_executor *executor,
                        /* VkDevice */
                        void *device);
 
+/* Adds the requirements of a script to a batch. When the executor
+ * next creates a device it will enable all of the features and
+ * extensions of the batch that the device supports so that the device
+ * can be shared by all of the scripts. This can be used to pre-scan a
+ * set of scripts before executing them. Scripts in the batch that need
+ * something that the device doesn’t support are skipped.
+ */
+void
+vr_executor_add_batch_script(struct vr_executor *executor,
+                             const struct vr_script *script);
+
+/* Gets the number and total size in bytes of the blocks of device
+ * memory that the buffers of the scripts are currently sub-allocated
+ * from, and the number of times device memory has been allocated for
+ * them since the executor was created.
+ */
+void
+vr_executor_get_memory_stats(struct vr_executor *executor,
+                             unsigned *n_blocks_out,
+                             uint64_t *block_size_out,
+                             unsigned *n_memory_allocations_out);
+
 enum vr_result
 vr_executor_execute(struct vr_executor *executor,
                     const struct vr_source *source);
@@ -78,6 +112,9 @@ enum vr_result
 vr_executor_execute_script(struct vr_executor *executor,
                            const struct vr_script *script);
 
+/* The config must still be alive when the executor is freed because
+ * it may need to report errors and save the pipeline cache.
+ */
 void
 vr_executor_free(struct vr_executor *executor);
 
@@ -0,0 +1,220 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "vr-glslang.h"
+#include "vr-util.h"
+
+#ifdef HAVE_GLSLANG
+
+#include "vr-error-message.h"
+#include "vr-thread.h"
+
+#include <string.h>
+#include <glslang/Include/glslang_c_interface.h>
+#include <glslang/Public/resource_limits_c.h>
+#include <glslang/build_info.h>
+
+static const glslang_stage_t
+stage_map[VR_SHADER_STAGE_N_STAGES] = {
+        [VR_SHADER_STAGE_VERTEX] = GLSLANG_STAGE_VERTEX,
+        [VR_SHADER_STAGE_TESS_CTRL] = GLSLANG_STAGE_TESSCONTROL,
+        [VR_SHADER_STAGE_TESS_EVAL] = GLSLANG_STAGE_TESSEVALUATION,
+        [VR_SHADER_STAGE_GEOMETRY] = GLSLANG_STAGE_GEOMETRY,
+        [VR_SHADER_STAGE_FRAGMENT] = GLSLANG_STAGE_FRAGMENT,
+        [VR_SHADER_STAGE_COMPUTE] = GLSLANG_STAGE_COMPUTE,
+};
+
+/* Same messages that glslangValidator uses with the -V option */
+#define MESSAGES (GLSLANG_MSG_SPV_RULES_BIT | GLSLANG_MSG_VULKAN_RULES_BIT)
+
+static vr_once_t
+init_once = VR_ONCE_INIT;
+
+static void
+init_process(void)
+{
+        /* The process is never finalized so that the built-in symbol
+         * tables are kept around for the next compilation.
+         */
+        glslang_initialize_process();
+}
+
+static void
+report_log(const struct vr_config *config,
+           const char *log,
+           struct vr_buffer *output)
+{
+        if (log == NULL)
+                return;
+
+        while (*log) {
+                const char *end = strchr(log, '\n');
+                size_t len = end ? (size_t) (end - log) : strlen(log);
+                char *line = vr_strndup(log, len);
+
+                vr_error_message_string(config, line);
+
+                if (output) {
+                        vr_buffer_append_string(output, line);
+                        vr_buffer_append_c(output, '\n');
+                }
+
+                vr_free(line);
+
+                if (end == NULL)
+                        break;
+
+                log = end + 1;
+        }
+}
+
+const char *
+vr_glslang_get_version(void)
+{
+        return ("glslang " VR_STRINGIFY(GLSLANG_VERSION_MAJOR)
+                "." VR_STRINGIFY(GLSLANG_VERSION_MINOR)
+                "." VR_STRINGIFY(GLSLANG_VERSION_PATCH)
+                GLSLANG_VERSION_FLAVOR);
+}
+
+bool
+vr_glslang_compile(const struct vr_config *config,
+                   enum vr_shader_stage stage,
+                   const struct vr_list *sources,
+                   struct vr_buffer *output,
+                   struct vr_buffer *binary)
+{
+        int n_shaders = vr_list_length(sources);
+        glslang_input_t *inputs = vr_calloc(n_shaders * sizeof *inputs);
+        glslang_shader_t **shaders = vr_calloc(n_shaders * sizeof *shaders);
+        const struct vr_script_shader *shader;
+        glslang_program_t *program = NULL;
+        bool ret = false;
+        int i = 0;
+
+        vr_thread_once(&init_once, init_process);
+
+        vr_list_for_each(shader, sources, link) {
+                /* glslang keeps a pointer to the input so it needs to
+                 * stay alive until the shader is deleted.
+                 */
+                inputs[i] = (glslang_input_t) {
+                        .language = GLSLANG_SOURCE_GLSL,
+                        .stage = stage_map[stage],
+                        .client = GLSLANG_CLIENT_VULKAN,
+                        .client_version = GLSLANG_TARGET_VULKAN_1_0,
+                        .target_language = GLSLANG_TARGET_SPV,
+                        .target_language_version = GLSLANG_TARGET_SPV_1_0,
+                        .code = vr_strndup(shader->source, shader->length),
+                        .default_version = 100,
+                        .default_profile = GLSLANG_NO_PROFILE,
+                        .force_default_version_and_profile = false,
+                        .forward_compatible = false,
+                        .messages = MESSAGES,
+                        .resource = glslang_default_resource(),
+                };
+
+                shaders[i] = glslang_shader_create(inputs + i);
+
+                /* The parser reads the preprocessed source so the
+                 * preprocessor has to be run first.
+                 */
+                bool parsed =
+                        glslang_shader_preprocess(shaders[i], inputs + i) &&
+                        glslang_shader_parse(shaders[i], inputs + i);
+
+                report_log(config,
+                           glslang_shader_get_info_log(shaders[i]),
+                           output);
+
+                if (!parsed)
+                        goto out;
+
+                i++;
+        }
+
+        program = glslang_program_create();
+
+        for (i = 0; i < n_shaders; i++)
+                glslang_program_add_shader(program, shaders[i]);
+
+        bool linked = glslang_program_link(program, MESSAGES);
+
+        report_log(config, glslang_program_get_info_log(program), output);
+
+        if (!linked)
+                goto out;
+
+        glslang_program_SPIRV_generate(program, stage_map[stage]);
+
+        report_log(config, glslang_program_SPIRV_get_messages(program), output);
+
+        size_t size = glslang_program_SPIRV_get_size(program) *
+                sizeof (uint32_t);
+        size_t old_length = binary->length;
+
+        vr_buffer_set_length(binary, old_length + size);
+        glslang_program_SPIRV_get(program,
+                                  (unsigned int *) (binary->data + old_length));
+
+        ret = true;
+
+out:
+        if (program)
+                glslang_program_delete(program);
+
+        for (i = 0; i < n_shaders; i++) {
+                if (shaders[i])
+                        glslang_shader_delete(shaders[i]);
+                vr_free((char *) inputs[i].code);
+        }
+
+        vr_free(shaders);
+        vr_free(inputs);
+
+        return ret;
+}
+
+#else /* HAVE_GLSLANG */
+
+const char *
+vr_glslang_get_version(void)
+{
+        return NULL;
+}
+
+bool
+vr_glslang_compile(const struct vr_config *config,
+                   enum vr_shader_stage stage,
+                   const struct vr_list *sources,
+                   struct vr_buffer *output,
+                   struct vr_buffer *binary)
+{
+        vr_fatal("VkRunner was built without glslang");
+}
+
+#endif /* HAVE_GLSLANG */
@@ -0,0 +1,54 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VR_GLSLANG_H
+#define VR_GLSLANG_H
+
+#include <stdbool.h>
+
+#include "vr-config.h"
+#include "vr-script-private.h"
+#include "vr-buffer.h"
+#include "vr-list.h"
+
+/* Returns a string identifying the version of glslang that was
+ * linked into VkRunner or NULL if it was built without it.
+ */
+const char *
+vr_glslang_get_version(void);
+
+/* Compiles a list of GLSL vr_script_shaders for the given stage to
+ * SPIR-V in memory and appends it to binary. Any messages from the
+ * compiler are reported and also appended to output if it is not
+ * NULL. Returns false if compilation failed.
+ */
+bool
+vr_glslang_compile(const struct vr_config *config,
+                   enum vr_shader_stage stage,
+                   const struct vr_list *sources,
+                   struct vr_buffer *output,
+                   struct vr_buffer *binary);
+
+#endif /* VR_GLSLANG_H */
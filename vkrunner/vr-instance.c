@@ -0,0 +1,284 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "vr-instance.h"
+#include "vr-util.h"
+#include "vr-thread.h"
+#include "vr-error-message.h"
+
+static vr_once_t
+init_once = VR_ONCE_INIT;
+
+/* Protects shared_instance and its reference count */
+static vr_mutex_t
+instance_mutex;
+
+static struct vr_instance *
+shared_instance = NULL;
+
+static void
+init_mutex(void)
+{
+        vr_mutex_init(&instance_mutex);
+}
+
+static void *
+get_instance_proc(const char *name,
+                  void *user_data)
+{
+        struct vr_instance *instance = user_data;
+        struct vr_vk *vkfn = &instance->vkfn;
+
+        return vkfn->vkGetInstanceProcAddr(instance->vk_instance, name);
+}
+
+static int
+find_queue_family(struct vr_instance *instance,
+                  VkPhysicalDevice physical_device)
+{
+        struct vr_vk *vkfn = &instance->vkfn;
+        VkQueueFamilyProperties *queues;
+        uint32_t count = 0;
+        uint32_t i;
+
+        vkfn->vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
+                                                       &count,
+                                                       NULL /* queues */);
+
+        queues = vr_alloc(sizeof *queues * count);
+
+        vkfn->vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
+                                                       &count,
+                                                       queues);
+
+        for (i = 0; i < count; i++) {
+                if ((queues[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+                    queues[i].queueCount >= 1)
+                        break;
+        }
+
+        vr_free(queues);
+
+        if (i >= count)
+                return -1;
+        else
+                return i;
+}
+
+static void
+query_extensions(struct vr_instance *instance,
+                 struct vr_physical_device *device)
+{
+        struct vr_vk *vkfn = &instance->vkfn;
+        VkPhysicalDevice physical_device = device->physical_device;
+        VkExtensionProperties *props;
+        uint32_t count;
+        VkResult res;
+
+        res = vkfn->vkEnumerateDeviceExtensionProperties(physical_device,
+                                                         NULL, /* layerName */
+                                                         &count,
+                                                         NULL /* properties */);
+        if (res != VK_SUCCESS || count == 0)
+                return;
+
+        props = vr_alloc(count * sizeof *props);
+
+        res = vkfn->vkEnumerateDeviceExtensionProperties(physical_device,
+                                                         NULL, /* layerName */
+                                                         &count,
+                                                         props);
+        if (res != VK_SUCCESS) {
+                vr_free(props);
+                return;
+        }
+
+        device->n_extensions = count;
+        device->extensions = props;
+}
+
+static bool
+query_physical_devices(const struct vr_config *config,
+                       struct vr_instance *instance)
+{
+        struct vr_vk *vkfn = &instance->vkfn;
+        VkPhysicalDevice *devices;
+        uint32_t count;
+        VkResult res;
+
+        res = vkfn->vkEnumeratePhysicalDevices(instance->vk_instance,
+                                               &count,
+                                               NULL);
+        if (res != VK_SUCCESS)
+                goto error;
+
+        if (count == 0)
+                return true;
+
+        devices = alloca(count * sizeof *devices);
+
+        res = vkfn->vkEnumeratePhysicalDevices(instance->vk_instance,
+                                               &count,
+                                               devices);
+        if (res != VK_SUCCESS)
+                goto error;
+
+        instance->physical_devices =
+                vr_calloc(count * sizeof *instance->physical_devices);
+        instance->n_physical_devices = count;
+
+        for (uint32_t i = 0; i < count; i++) {
+                struct vr_physical_device *device =
+                        instance->physical_devices + i;
+
+                device->physical_device = devices[i];
+                vkfn->vkGetPhysicalDeviceProperties(devices[i],
+                                                    &device->properties);
+                vkfn->vkGetPhysicalDeviceMemoryProperties(
+                        devices[i],
+                        &device->memory_properties);
+                vkfn->vkGetPhysicalDeviceFeatures(devices[i],
+                                                  &device->features);
+                query_extensions(instance, device);
+                device->queue_family = find_queue_family(instance,
+                                                         devices[i]);
+        }
+
+        return true;
+
+error:
+        vr_error_message(config, "Error enumerating VkPhysicalDevices");
+        return false;
+}
+
+static void
+free_instance(struct vr_instance *instance)
+{
+        struct vr_vk *vkfn = &instance->vkfn;
+
+        for (uint32_t i = 0; i < instance->n_physical_devices; i++)
+                vr_free(instance->physical_devices[i].extensions);
+        vr_free(instance->physical_devices);
+
+        if (instance->vk_instance) {
+                vkfn->vkDestroyInstance(instance->vk_instance,
+                                        NULL /* allocator */);
+        }
+
+        if (vkfn->lib_vulkan)
+                vr_vk_unload_libvulkan(vkfn);
+
+        vr_free(instance);
+}
+
+static enum vr_result
+create_instance(const struct vr_config *config,
+                struct vr_instance **instance_out)
+{
+        struct vr_instance *instance = vr_calloc(sizeof *instance);
+        struct vr_vk *vkfn = &instance->vkfn;
+        VkResult res;
+
+        if (!vr_vk_load_libvulkan(config, vkfn))
+                goto error;
+
+        struct VkInstanceCreateInfo instance_create_info = {
+                .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+                .pApplicationInfo = &(VkApplicationInfo) {
+                        .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+                        .pApplicationName = "vkrunner",
+                        .apiVersion = VK_MAKE_VERSION(1, 0, 2)
+                },
+        };
+        res = vkfn->vkCreateInstance(&instance_create_info,
+                                     NULL, /* allocator */
+                                     &instance->vk_instance);
+
+        if (res != VK_SUCCESS) {
+                vr_error_message(config, "Failed to create VkInstance");
+                goto error;
+        }
+
+        vr_vk_init_instance(vkfn, get_instance_proc, instance);
+
+        if (!query_physical_devices(config, instance))
+                goto error;
+
+        *instance_out = instance;
+
+        return VR_RESULT_PASS;
+
+error:
+        free_instance(instance);
+        return VR_RESULT_FAIL;
+}
+
+enum vr_result
+vr_instance_ref_shared(const struct vr_config *config,
+                       struct vr_instance **instance_out)
+{
+        enum vr_result res = VR_RESULT_PASS;
+
+        vr_thread_once(&init_once, init_mutex);
+
+        vr_mutex_lock(&instance_mutex);
+
+        if (shared_instance == NULL)
+                res = create_instance(config, &shared_instance);
+
+        if (res == VR_RESULT_PASS) {
+                shared_instance->ref_count++;
+                *instance_out = shared_instance;
+        }
+
+        vr_mutex_unlock(&instance_mutex);
+
+        return res;
+}
+
+struct vr_instance *
+vr_instance_ref(struct vr_instance *instance)
+{
+        vr_mutex_lock(&instance_mutex);
+        instance->ref_count++;
+        vr_mutex_unlock(&instance_mutex);
+
+        return instance;
+}
+
+void
+vr_instance_unref(struct vr_instance *instance)
+{
+        vr_mutex_lock(&instance_mutex);
+
+        if (--instance->ref_count <= 0) {
+                free_instance(instance);
+                shared_instance = NULL;
+        }
+
+        vr_mutex_unlock(&instance_mutex);
+}
@@ -0,0 +1,80 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VR_INSTANCE_H
+#define VR_INSTANCE_H
+
+#include "vr-vk.h"
+#include "vr-result.h"
+#include "vr-config.h"
+
+/* Information about a physical device. This is queried once when
+ * the instance is created and doesn’t change afterwards.
+ */
+struct vr_physical_device {
+        VkPhysicalDevice physical_device;
+        VkPhysicalDeviceProperties properties;
+        VkPhysicalDeviceMemoryProperties memory_properties;
+        VkPhysicalDeviceFeatures features;
+        uint32_t n_extensions;
+        VkExtensionProperties *extensions;
+        /* A queue family that supports graphics or -1 if there isn’t
+         * one.
+         */
+        int queue_family;
+};
+
+/* The Vulkan loader and VkInstance are shared by all of the contexts
+ * in the process. Each context creates its own device from it.
+ */
+struct vr_instance {
+        int ref_count;
+
+        VkInstance vk_instance;
+
+        /* Only the loader and the instance-level functions are set */
+        struct vr_vk vkfn;
+
+        uint32_t n_physical_devices;
+        struct vr_physical_device *physical_devices;
+};
+
+/* Returns a new reference to the shared instance, creating it if this
+ * is the first reference. This can be called from any thread.
+ */
+enum vr_result
+vr_instance_ref_shared(const struct vr_config *config,
+                       struct vr_instance **instance_out);
+
+struct vr_instance *
+vr_instance_ref(struct vr_instance *instance);
+
+/* Releases a reference. The instance is destroyed and the loader is
+ * unloaded when the last reference goes away.
+ */
+void
+vr_instance_unref(struct vr_instance *instance);
+
+#endif /* VR_INSTANCE_H */
@@ -0,0 +1,423 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "vr-object-cache.h"
+#include "vr-error-message.h"
+#include "vr-util.h"
+#include "vr-flush-memory.h"
+
+#include <string.h>
+
+/* Number of entries above which unused entries start being evicted */
+#define MAX_ENTRIES 256
+
+struct vr_object_cache {
+        struct vr_window *window;
+        struct vr_list entries;
+        int n_entries;
+        uint64_t next_serial;
+};
+
+struct vr_object_cache *
+vr_object_cache_new(struct vr_window *window)
+{
+        struct vr_object_cache *cache = vr_calloc(sizeof *cache);
+
+        cache->window = window;
+        vr_list_init(&cache->entries);
+
+        return cache;
+}
+
+static void
+destroy_entry(struct vr_object_cache *cache,
+              struct vr_object_cache_entry *entry)
+{
+        struct vr_window *window = cache->window;
+        struct vr_vk *vkfn = &window->vkfn;
+
+        switch (entry->type) {
+        case VR_OBJECT_CACHE_TYPE_MODULE:
+                vkfn->vkDestroyShaderModule(window->device,
+                                            entry->module,
+                                            NULL /* allocator */);
+                break;
+        case VR_OBJECT_CACHE_TYPE_PIPELINE:
+                vkfn->vkDestroyPipeline(window->device,
+                                        entry->pipeline,
+                                        NULL /* allocator */);
+                /* The layout entry isn’t freed here even if this was
+                 * the last reference. It will be evicted later.
+                 */
+                entry->layout_entry->ref_count--;
+                break;
+        case VR_OBJECT_CACHE_TYPE_LAYOUT:
+                vkfn->vkDestroyPipelineLayout(window->device,
+                                              entry->layout.layout,
+                                              NULL /* allocator */);
+                for (unsigned i = 0; i < entry->layout.n_set_layouts; i++) {
+                        VkDescriptorSetLayout dsl =
+                                entry->layout.set_layouts[i];
+                        if (dsl == VK_NULL_HANDLE)
+                                continue;
+                        vkfn->vkDestroyDescriptorSetLayout(
+                                window->device,
+                                dsl,
+                                NULL /* allocator */);
+                }
+                vr_free(entry->layout.set_layouts);
+                break;
+        case VR_OBJECT_CACHE_TYPE_BUFFER:
+                vkfn->vkDestroyBuffer(window->device,
+                                      entry->buffer.buffer,
+                                      NULL /* allocator */);
+                vr_allocate_store_arena_release(window->context->arena,
+                                                &entry->buffer.allocation);
+                break;
+        }
+
+        vr_list_remove(&entry->link);
+        cache->n_entries--;
+
+        vr_buffer_destroy(&entry->key);
+        vr_free(entry);
+}
+
+static void
+evict_entries(struct vr_object_cache *cache)
+{
+        struct vr_object_cache_entry *entry, *tmp;
+
+        /* Walk backwards from the least recently used entry */
+        for (entry = vr_container_of(cache->entries.prev,
+                                     struct vr_object_cache_entry,
+                                     link);
+             cache->n_entries > MAX_ENTRIES && &entry->link != &cache->entries;
+             entry = tmp) {
+                tmp = vr_container_of(entry->link.prev,
+                                      struct vr_object_cache_entry,
+                                      link);
+
+                if (entry->ref_count <= 0)
+                        destroy_entry(cache, entry);
+        }
+}
+
+static struct vr_object_cache_entry *
+lookup(struct vr_object_cache *cache,
+       enum vr_object_cache_type type,
+       uint64_t hash,
+       const void *key,
+       size_t key_size)
+{
+        struct vr_object_cache_entry *entry;
+
+        vr_list_for_each(entry, &cache->entries, link) {
+                if (entry->type != type ||
+                    entry->hash != hash ||
+                    entry->key.length != key_size ||
+                    memcmp(entry->key.data, key, key_size))
+                        continue;
+
+                /* Move the entry to the front of the LRU list */
+                vr_list_remove(&entry->link);
+                vr_list_insert(&cache->entries, &entry->link);
+
+                entry->ref_count++;
+
+                return entry;
+        }
+
+        return NULL;
+}
+
+static struct vr_object_cache_entry *
+add_entry(struct vr_object_cache *cache,
+          enum vr_object_cache_type type,
+          uint64_t hash,
+          const void *key,
+          size_t key_size)
+{
+        struct vr_object_cache_entry *entry = vr_calloc(sizeof *entry);
+
+        entry->type = type;
+        entry->hash = hash;
+        vr_buffer_init(&entry->key);
+        vr_buffer_append(&entry->key, key, key_size);
+        entry->serial = ++cache->next_serial;
+        entry->ref_count = 1;
+
+        vr_list_insert(&cache->entries, &entry->link);
+        cache->n_entries++;
+
+        evict_entries(cache);
+
+        return entry;
+}
+
+struct vr_object_cache_entry *
+vr_object_cache_get_module(struct vr_object_cache *cache,
+                           const void *binary,
+                           size_t size)
+{
+        uint64_t hash = vr_hash_data(VR_HASH_INIT, binary, size);
+        struct vr_object_cache_entry *entry =
+                lookup(cache, VR_OBJECT_CACHE_TYPE_MODULE, hash, binary, size);
+
+        if (entry)
+                return entry;
+
+        struct vr_window *window = cache->window;
+        struct vr_vk *vkfn = &window->vkfn;
+        VkShaderModule module;
+        VkResult res;
+
+        VkShaderModuleCreateInfo shader_module_create_info = {
+                        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+                        .codeSize = size,
+                        .pCode = (const uint32_t *) binary
+        };
+        res = vkfn->vkCreateShaderModule(window->device,
+                                         &shader_module_create_info,
+                                         NULL, /* allocator */
+                                         &module);
+        if (res != VK_SUCCESS) {
+                vr_error_message(window->config, "vkCreateShaderModule failed");
+                return NULL;
+        }
+
+        entry = add_entry(cache,
+                          VR_OBJECT_CACHE_TYPE_MODULE,
+                          hash,
+                          binary,
+                          size);
+        entry->module = module;
+
+        return entry;
+}
+
+static VkResult
+allocate_buffer_memory(struct vr_window *window,
+                       VkBuffer buffer,
+                       struct vr_allocate_store_allocation *allocation)
+{
+        VkResult res;
+
+        /* Prefer memory that is fast for the device if it can also
+         * be mapped.
+         */
+        res = vr_allocate_store_arena_buffer(
+                window->context->arena,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                buffer,
+                allocation);
+        if (res == VK_SUCCESS)
+                return res;
+
+        return vr_allocate_store_arena_buffer(
+                window->context->arena,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                buffer,
+                allocation);
+}
+
+struct vr_object_cache_entry *
+vr_object_cache_get_buffer(struct vr_object_cache *cache,
+                           VkBufferUsageFlags usage,
+                           const void *data,
+                           size_t size)
+{
+        struct vr_buffer key = VR_BUFFER_STATIC_INIT;
+
+        vr_buffer_append(&key, &usage, sizeof usage);
+        vr_buffer_append(&key, data, size);
+
+        uint64_t hash = vr_hash_data(VR_HASH_INIT, key.data, key.length);
+        struct vr_object_cache_entry *entry =
+                lookup(cache,
+                       VR_OBJECT_CACHE_TYPE_BUFFER,
+                       hash,
+                       key.data,
+                       key.length);
+
+        if (entry)
+                goto out;
+
+        struct vr_window *window = cache->window;
+        struct vr_vk *vkfn = &window->vkfn;
+        struct vr_allocate_store_allocation allocation;
+        VkBuffer buffer;
+        VkResult res;
+
+        VkBufferCreateInfo buffer_create_info = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                .size = MAX(size, 1),
+                .usage = usage,
+                .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        };
+        res = vkfn->vkCreateBuffer(window->device,
+                                   &buffer_create_info,
+                                   NULL, /* allocator */
+                                   &buffer);
+        if (res != VK_SUCCESS) {
+                vr_error_message(window->config, "Error creating buffer");
+                goto out;
+        }
+
+        res = allocate_buffer_memory(window, buffer, &allocation);
+        if (res != VK_SUCCESS) {
+                vkfn->vkDestroyBuffer(window->device,
+                                      buffer,
+                                      NULL /* allocator */);
+                vr_error_message(window->config, "Error allocating memory");
+                goto out;
+        }
+
+        memcpy(allocation.memory_map, data, size);
+        vr_flush_memory(window->context,
+                        allocation.memory_type_index,
+                        allocation.memory,
+                        allocation.offset,
+                        allocation.size);
+
+        entry = add_entry(cache,
+                          VR_OBJECT_CACHE_TYPE_BUFFER,
+                          hash,
+                          key.data,
+                          key.length);
+        entry->buffer.buffer = buffer;
+        entry->buffer.allocation = allocation;
+
+out:
+        vr_buffer_destroy(&key);
+
+        return entry;
+}
+
+static struct vr_object_cache_entry *
+lookup_key(struct vr_object_cache *cache,
+           enum vr_object_cache_type type,
+           const struct vr_buffer *key)
+{
+        return lookup(cache,
+                      type,
+                      vr_hash_data(VR_HASH_INIT, key->data, key->length),
+                      key->data,
+                      key->length);
+}
+
+static struct vr_object_cache_entry *
+add_key(struct vr_object_cache *cache,
+        enum vr_object_cache_type type,
+        const struct vr_buffer *key)
+{
+        return add_entry(cache,
+                         type,
+                         vr_hash_data(VR_HASH_INIT, key->data, key->length),
+                         key->data,
+                         key->length);
+}
+
+struct vr_object_cache_entry *
+vr_object_cache_lookup_pipeline(struct vr_object_cache *cache,
+                                const struct vr_buffer *key)
+{
+        return lookup_key(cache, VR_OBJECT_CACHE_TYPE_PIPELINE, key);
+}
+
+struct vr_object_cache_entry *
+vr_object_cache_add_pipeline(struct vr_object_cache *cache,
+                             const struct vr_buffer *key,
+                             VkPipeline pipeline,
+                             struct vr_object_cache_entry *layout_entry)
+{
+        /* Take the reference before adding the entry so that the
+         * layout can’t be evicted.
+         */
+        layout_entry->ref_count++;
+
+        struct vr_object_cache_entry *entry =
+                add_key(cache, VR_OBJECT_CACHE_TYPE_PIPELINE, key);
+
+        entry->pipeline = pipeline;
+        entry->layout_entry = layout_entry;
+
+        return entry;
+}
+
+struct vr_object_cache_entry *
+vr_object_cache_lookup_layout(struct vr_object_cache *cache,
+                              const struct vr_buffer *key)
+{
+        return lookup_key(cache, VR_OBJECT_CACHE_TYPE_LAYOUT, key);
+}
+
+struct vr_object_cache_entry *
+vr_object_cache_add_layout(struct vr_object_cache *cache,
+                           const struct vr_buffer *key,
+                           VkPipelineLayout layout,
+                           unsigned n_set_layouts,
+                           VkDescriptorSetLayout *set_layouts)
+{
+        struct vr_object_cache_entry *entry =
+                add_key(cache, VR_OBJECT_CACHE_TYPE_LAYOUT, key);
+
+        entry->layout.layout = layout;
+        entry->layout.n_set_layouts = n_set_layouts;
+        entry->layout.set_layouts = set_layouts;
+
+        return entry;
+}
+
+void
+vr_object_cache_release(struct vr_object_cache *cache,
+                        struct vr_object_cache_entry *entry)
+{
+        entry->ref_count--;
+
+        evict_entries(cache);
+}
+
+void
+vr_object_cache_free(struct vr_object_cache *cache)
+{
+        struct vr_object_cache_entry *entry, *tmp;
+
+        /* The pipelines refer to their layouts so they are destroyed
+         * first.
+         */
+        vr_list_for_each_safe(entry, tmp, &cache->entries, link) {
+                if (entry->type == VR_OBJECT_CACHE_TYPE_PIPELINE)
+                        destroy_entry(cache, entry);
+        }
+
+        vr_list_for_each_safe(entry, tmp, &cache->entries, link)
+                destroy_entry(cache, entry);
+
+        vr_free(cache);
+}
@@ -0,0 +1,152 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VR_OBJECT_CACHE_H
+#define VR_OBJECT_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "vr-vk.h"
+#include "vr-list.h"
+#include "vr-buffer.h"
+#include "vr-window.h"
+#include "vr-allocate-store.h"
+
+/* A cache of VkShaderModules, VkPipelines, pipeline layouts and
+ * static buffers so that scripts that share identical shaders,
+ * pipelines and geometry don’t have to recreate them.
+ * Entries that aren’t in use are evicted least-recently-used first
+ * once the cache is full. The objects are only valid for the window
+ * that the cache was created for so it must be freed whenever the
+ * window is recreated.
+ */
+
+enum vr_object_cache_type {
+        VR_OBJECT_CACHE_TYPE_MODULE,
+        VR_OBJECT_CACHE_TYPE_PIPELINE,
+        VR_OBJECT_CACHE_TYPE_LAYOUT,
+        VR_OBJECT_CACHE_TYPE_BUFFER
+};
+
+struct vr_object_cache_entry {
+        /* Position in the LRU list. The most recently used entry is
+         * first.
+         */
+        struct vr_list link;
+        enum vr_object_cache_type type;
+        uint64_t hash;
+        struct vr_buffer key;
+        /* Unique number for the entry that is never reused. This can
+         * be used to refer to a module in a pipeline key.
+         */
+        uint64_t serial;
+        int ref_count;
+        /* For a pipeline this is the entry of the layout it was
+         * created with. The pipeline holds a reference on it because
+         * the layout has to outlive the pipeline.
+         */
+        struct vr_object_cache_entry *layout_entry;
+        union {
+                VkShaderModule module;
+                VkPipeline pipeline;
+                struct {
+                        VkPipelineLayout layout;
+                        unsigned n_set_layouts;
+                        VkDescriptorSetLayout *set_layouts;
+                } layout;
+                struct {
+                        VkBuffer buffer;
+                        struct vr_allocate_store_allocation allocation;
+                } buffer;
+        };
+};
+
+struct vr_object_cache;
+
+struct vr_object_cache *
+vr_object_cache_new(struct vr_window *window);
+
+/* Returns a referenced entry for a module with the given SPIR-V
+ * binary, creating it if it isn’t already in the cache. Returns NULL
+ * if the module can’t be created.
+ */
+struct vr_object_cache_entry *
+vr_object_cache_get_module(struct vr_object_cache *cache,
+                           const void *binary,
+                           size_t size);
+
+/* Returns a referenced entry for a host-visible buffer with the
+ * given usage that contains a copy of the data, creating it if it
+ * isn’t already in the cache. Returns NULL if the buffer can’t be
+ * created.
+ */
+struct vr_object_cache_entry *
+vr_object_cache_get_buffer(struct vr_object_cache *cache,
+                           VkBufferUsageFlags usage,
+                           const void *data,
+                           size_t size);
+
+/* Returns a referenced entry for a pipeline with the given key or
+ * NULL if there isn’t one.
+ */
+struct vr_object_cache_entry *
+vr_object_cache_lookup_pipeline(struct vr_object_cache *cache,
+                                const struct vr_buffer *key);
+
+/* Takes ownership of the pipeline and returns a referenced entry for
+ * it. The entry takes its own reference on the layout entry.
+ */
+struct vr_object_cache_entry *
+vr_object_cache_add_pipeline(struct vr_object_cache *cache,
+                             const struct vr_buffer *key,
+                             VkPipeline pipeline,
+                             struct vr_object_cache_entry *layout_entry);
+
+/* Returns a referenced entry for a pipeline layout with the given
+ * key or NULL if there isn’t one.
+ */
+struct vr_object_cache_entry *
+vr_object_cache_lookup_layout(struct vr_object_cache *cache,
+                              const struct vr_buffer *key);
+
+/* Takes ownership of the pipeline layout and the array of descriptor
+ * set layouts and returns a referenced entry for them.
+ */
+struct vr_object_cache_entry *
+vr_object_cache_add_layout(struct vr_object_cache *cache,
+                           const struct vr_buffer *key,
+                           VkPipelineLayout layout,
+                           unsigned n_set_layouts,
+                           VkDescriptorSetLayout *set_layouts);
+
+void
+vr_object_cache_release(struct vr_object_cache *cache,
+                        struct vr_object_cache_entry *entry);
+
+void
+vr_object_cache_free(struct vr_object_cache *cache);
+
+#endif /* VR_OBJECT_CACHE_H */
@@ -0,0 +1,303 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "vr-pipeline-cache.h"
+#include "vr-config-private.h"
+#include "vr-buffer.h"
+#include "vr-temp-file.h"
+#include "vr-error-message.h"
+#include "vr-util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Size of VkPipelineCacheHeaderVersionOne */
+#define HEADER_SIZE (4 * sizeof (uint32_t) + VK_UUID_SIZE)
+
+static bool
+read_cache_file(const char *filename,
+                struct vr_buffer *data)
+{
+        FILE *file = fopen(filename, "rb");
+
+        if (file == NULL)
+                return false;
+
+        while (true) {
+                vr_buffer_ensure_size(data, data->length + 4096);
+
+                size_t got = fread(data->data + data->length,
+                                   1,
+                                   data->size - data->length,
+                                   file);
+
+                if (got == 0)
+                        break;
+
+                data->length += got;
+        }
+
+        bool ret = !ferror(file);
+
+        fclose(file);
+
+        return ret;
+}
+
+static uint32_t
+read_header_value(const uint8_t *p)
+{
+        /* The header values are always stored least-significant
+         * byte first
+         */
+        return (((uint32_t) p[3] << 24) |
+                ((uint32_t) p[2] << 16) |
+                ((uint32_t) p[1] << 8) |
+                (uint32_t) p[0]);
+}
+
+/* Checks that the data was created by the same driver and device.
+ * The driver should also validate this itself but not all of them
+ * are careful about it.
+ */
+static bool
+is_valid_cache_data(const struct vr_context *context,
+                    const struct vr_buffer *data)
+{
+        const VkPhysicalDeviceProperties *props = &context->device_properties;
+        const uint8_t *p = data->data;
+
+        if (data->length < HEADER_SIZE)
+                return false;
+
+        uint32_t header_size = read_header_value(p);
+        uint32_t header_version = read_header_value(p + 4);
+        uint32_t vendor_id = read_header_value(p + 8);
+        uint32_t device_id = read_header_value(p + 12);
+
+        return (header_size >= HEADER_SIZE &&
+                header_size <= data->length &&
+                header_version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                vendor_id == props->vendorID &&
+                device_id == props->deviceID &&
+                !memcmp(p + 16, props->pipelineCacheUUID, VK_UUID_SIZE));
+}
+
+static VkPipelineCache
+create_cache(struct vr_context *context,
+             const struct vr_buffer *initial_data)
+{
+        struct vr_vk *vkfn = &context->vkfn;
+        VkPipelineCache cache;
+        VkResult res;
+
+        VkPipelineCacheCreateInfo pipeline_cache_create_info = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+                .initialDataSize = initial_data ? initial_data->length : 0,
+                .pInitialData = initial_data ? initial_data->data : NULL
+        };
+        res = vkfn->vkCreatePipelineCache(context->device,
+                                          &pipeline_cache_create_info,
+                                          NULL, /* allocator */
+                                          &cache);
+        if (res != VK_SUCCESS)
+                return VK_NULL_HANDLE;
+
+        return cache;
+}
+
+static void
+read_valid_cache_file(struct vr_context *context,
+                      struct vr_buffer *data)
+{
+        const char *filename = context->config->pipeline_cache_file;
+
+        if (filename == NULL)
+                return;
+
+        if (!read_cache_file(filename, data) ||
+            !is_valid_cache_data(context, data))
+                vr_buffer_set_length(data, 0);
+}
+
+VkPipelineCache
+vr_pipeline_cache_create(struct vr_context *context,
+                         const struct vr_buffer *previous_data)
+{
+        struct vr_buffer data = VR_BUFFER_STATIC_INIT;
+        VkPipelineCache cache = VK_NULL_HANDLE;
+
+        /* The cache of a previous context on the same device already
+         * includes anything that was loaded from the file so there
+         * is no need to read it again.
+         */
+        if (previous_data && is_valid_cache_data(context, previous_data)) {
+                cache = create_cache(context, previous_data);
+        } else {
+                read_valid_cache_file(context, &data);
+
+                if (data.length > 0)
+                        cache = create_cache(context, &data);
+        }
+
+        /* If the driver rejects the data then start with an empty
+         * cache instead
+         */
+        if (cache == VK_NULL_HANDLE)
+                cache = create_cache(context, NULL);
+
+        if (cache == VK_NULL_HANDLE)
+                vr_error_message(context->config,
+                                 "Error creating pipeline cache");
+
+        vr_buffer_destroy(&data);
+
+        return cache;
+}
+
+/* Merges the current contents of the file into the cache so that
+ * entries written by other processes since it was loaded aren’t
+ * lost.
+ */
+static void
+merge_cache_file(struct vr_context *context,
+                 const struct vr_buffer *file_data)
+{
+        struct vr_vk *vkfn = &context->vkfn;
+
+        if (file_data->length <= 0)
+                return;
+
+        VkPipelineCache file_cache = create_cache(context, file_data);
+
+        if (file_cache == VK_NULL_HANDLE)
+                return;
+
+        vkfn->vkMergePipelineCaches(context->device,
+                                    context->pipeline_cache,
+                                    1, /* srcCacheCount */
+                                    &file_cache);
+
+        vkfn->vkDestroyPipelineCache(context->device,
+                                     file_cache,
+                                     NULL /* allocator */);
+}
+
+bool
+vr_pipeline_cache_get_data(struct vr_context *context,
+                           struct vr_buffer *data)
+{
+        struct vr_vk *vkfn = &context->vkfn;
+        size_t size;
+        VkResult res;
+
+        res = vkfn->vkGetPipelineCacheData(context->device,
+                                           context->pipeline_cache,
+                                           &size,
+                                           NULL /* pData */);
+        if (res != VK_SUCCESS)
+                return false;
+
+        vr_buffer_set_length(data, size);
+
+        res = vkfn->vkGetPipelineCacheData(context->device,
+                                           context->pipeline_cache,
+                                           &size,
+                                           data->data);
+        if (res != VK_SUCCESS)
+                return false;
+
+        vr_buffer_set_length(data, size);
+
+        return true;
+}
+
+static bool
+write_cache_file(const char *filename,
+                 const struct vr_buffer *data)
+{
+        struct vr_buffer temp_filename = VR_BUFFER_STATIC_INIT;
+        bool ok;
+
+        FILE *file = vr_temp_file_open_replacement(filename, &temp_filename);
+
+        if (file == NULL) {
+                vr_buffer_destroy(&temp_filename);
+                return false;
+        }
+
+        ok = fwrite(data->data, 1, data->length, file) == data->length;
+
+        if (fclose(file) != 0)
+                ok = false;
+
+        if (ok) {
+                ok = vr_temp_file_replace((const char *) temp_filename.data,
+                                          filename);
+        } else {
+                remove((const char *) temp_filename.data);
+        }
+
+        vr_buffer_destroy(&temp_filename);
+
+        return ok;
+}
+
+void
+vr_pipeline_cache_save(struct vr_context *context)
+{
+        const char *filename = context->config->pipeline_cache_file;
+        struct vr_buffer file_data = VR_BUFFER_STATIC_INIT;
+        struct vr_buffer data = VR_BUFFER_STATIC_INIT;
+
+        if (filename == NULL)
+                goto out;
+
+        read_valid_cache_file(context, &file_data);
+        merge_cache_file(context, &file_data);
+
+        if (!vr_pipeline_cache_get_data(context, &data)) {
+                vr_error_message(context->config,
+                                 "Error getting pipeline cache data");
+                goto out;
+        }
+
+        /* Avoid rewriting the file if nothing changed */
+        if (data.length == file_data.length &&
+            !memcmp(data.data, file_data.data, data.length))
+                goto out;
+
+        if (!write_cache_file(filename, &data)) {
+                vr_error_message(context->config,
+                                 "%s: error writing pipeline cache",
+                                 filename);
+        }
+
+out:
+        vr_buffer_destroy(&data);
+        vr_buffer_destroy(&file_data);
+}
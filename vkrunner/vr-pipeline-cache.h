@@ -0,0 +1,58 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VR_PIPELINE_CACHE_H
+#define VR_PIPELINE_CACHE_H
+
+#include "vr-vk.h"
+#include "vr-context.h"
+#include "vr-buffer.h"
+
+/* Creates the VkPipelineCache that is shared by all of the pipelines
+ * created with the context. If previous_data was written for the
+ * same device then the cache is initialised with it. Otherwise if
+ * the config has a pipeline cache file and its header matches the
+ * device then the cache is initialised with its contents. Returns
+ * VK_NULL_HANDLE on failure.
+ */
+VkPipelineCache
+vr_pipeline_cache_create(struct vr_context *context,
+                         const struct vr_buffer *previous_data);
+
+/* Replaces the contents of data with the contents of the context’s
+ * pipeline cache.
+ */
+bool
+vr_pipeline_cache_get_data(struct vr_context *context,
+                           struct vr_buffer *data);
+
+/* Writes the contents of the context’s pipeline cache back to the
+ * file, merged with anything that other processes have written in
+ * the meantime. Does nothing if no file is configured.
+ */
+void
+vr_pipeline_cache_save(struct vr_context *context);
+
+#endif /* VR_PIPELINE_CACHE_H */
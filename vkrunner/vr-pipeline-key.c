@@ -176,6 +176,78 @@ vr_pipeline_key_equal(const struct vr_pipeline_key *a,
         vr_fatal("Unexpected shader stage");
 }
 
+static void
+serialize_entrypoint(const struct vr_pipeline_key *key,
+                     enum vr_shader_stage stage,
+                     struct vr_buffer *buffer)
+{
+        const char *entrypoint = vr_pipeline_key_get_entrypoint(key, stage);
+
+        /* Include the terminator so that the strings are delimited */
+        vr_buffer_append(buffer, entrypoint, strlen(entrypoint) + 1);
+}
+
+void
+vr_pipeline_key_serialize(const struct vr_pipeline_key *key,
+                          struct vr_buffer *buffer)
+{
+        switch (key->type) {
+        case VR_PIPELINE_KEY_TYPE_GRAPHICS:
+                vr_buffer_append(buffer,
+                                 key,
+                                 offsetof(struct vr_pipeline_key, entrypoints));
+
+                for (int i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
+                        if (i != VR_SHADER_STAGE_COMPUTE)
+                                serialize_entrypoint(key, i, buffer);
+                }
+                return;
+
+        case VR_PIPELINE_KEY_TYPE_COMPUTE:
+                vr_buffer_append(buffer, &key->type, sizeof key->type);
+                serialize_entrypoint(key, VR_SHADER_STAGE_COMPUTE, buffer);
+                return;
+        }
+
+        vr_fatal("Unexpected pipeline key type");
+}
+
+static uint64_t
+hash_entrypoint(uint64_t hash,
+                const struct vr_pipeline_key *key,
+                enum vr_shader_stage stage)
+{
+        const char *entrypoint = vr_pipeline_key_get_entrypoint(key, stage);
+
+        return vr_hash_data(hash, entrypoint, strlen(entrypoint) + 1);
+}
+
+uint64_t
+vr_pipeline_key_hash(const struct vr_pipeline_key *key)
+{
+        uint64_t hash = VR_HASH_INIT;
+
+        switch (key->type) {
+        case VR_PIPELINE_KEY_TYPE_GRAPHICS:
+                hash = vr_hash_data(hash,
+                                    key,
+                                    offsetof(struct vr_pipeline_key,
+                                             entrypoints));
+
+                for (int i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
+                        if (i != VR_SHADER_STAGE_COMPUTE)
+                                hash = hash_entrypoint(hash, key, i);
+                }
+                return hash;
+
+        case VR_PIPELINE_KEY_TYPE_COMPUTE:
+                hash = vr_hash_data(hash, &key->type, sizeof key->type);
+                return hash_entrypoint(hash, key, VR_SHADER_STAGE_COMPUTE);
+        }
+
+        vr_fatal("Unexpected pipeline key type");
+}
+
 union vr_pipeline_key_value *
 vr_pipeline_key_lookup(struct vr_pipeline_key *key,
                        const char *name,
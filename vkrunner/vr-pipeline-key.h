@@ -29,6 +29,7 @@
 #include <stdbool.h>
 #include "vr-vk.h"
 #include "vr-shader-stage.h"
+#include "vr-buffer.h"
 
 enum vr_pipeline_key_type {
         VR_PIPELINE_KEY_TYPE_GRAPHICS,
@@ -109,6 +110,20 @@ void
 vr_pipeline_key_to_create_info(const struct vr_pipeline_key *key,
                                VkGraphicsPipelineCreateInfo *create_info);
 
+/* Appends a representation of the key to the buffer. Two keys have
+ * the same representation if and only if vr_pipeline_key_equal
+ * would consider them equal.
+ */
+void
+vr_pipeline_key_serialize(const struct vr_pipeline_key *key,
+                          struct vr_buffer *buffer);
+
+/* Returns a hash of the same parts of the key that
+ * vr_pipeline_key_equal compares.
+ */
+uint64_t
+vr_pipeline_key_hash(const struct vr_pipeline_key *key);
+
 void
 vr_pipeline_key_destroy(struct vr_pipeline_key *key);
 
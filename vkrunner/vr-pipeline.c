@@ -26,23 +26,21 @@
 #include "config.h"
 
 #include "vr-pipeline.h"
-#include "vr-subprocess.h"
+#include "vr-compiler.h"
 #include "vr-util.h"
 #include "vr-script-private.h"
 #include "vr-error-message.h"
 #include "vr-buffer.h"
-#include "vr-temp-file.h"
 #include "vr-format-private.h"
+#include "vr-shader-cache.h"
+#include "vr-thread.h"
+#include "vr-object-cache.h"
 
 #include <stddef.h>
 #include <stdio.h>
-#include <errno.h>
 #include <assert.h>
 #include <string.h>
 #include <limits.h>
-#ifndef WIN32
-#include <unistd.h>
-#endif
 
 struct desc_set_bindings_info {
         VkDescriptorSetLayoutBinding *bindings;
@@ -50,335 +48,288 @@ struct desc_set_bindings_info {
         unsigned desc_set;
 };
 
-static const char *
-stage_names[VR_SHADER_STAGE_N_STAGES] = {
-        [VR_SHADER_STAGE_VERTEX] = "vert",
-        [VR_SHADER_STAGE_TESS_CTRL] = "tesc",
-        [VR_SHADER_STAGE_TESS_EVAL] = "tese",
-        [VR_SHADER_STAGE_GEOMETRY] = "geom",
-        [VR_SHADER_STAGE_FRAGMENT] = "frag",
-        [VR_SHADER_STAGE_COMPUTE] = "comp",
-};
-
 static const VkPipelineMultisampleStateCreateInfo
 base_multisample_state = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
         .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
 };
 
-#define TARGET_ENV "vulkan1.0"
-
-static char *
-create_file_for_shader(const struct vr_config *config,
-                       const struct vr_script_shader *shader)
-{
-        char *filename;
-        FILE *out;
-
-        if (!vr_temp_file_create_named(config, &out, &filename))
-                return NULL;
-
-        fwrite(shader->source, 1, shader->length, out);
+/* Storage for everything that a VkGraphicsPipelineCreateInfo points
+ * to so that several of them can be passed to the driver at once.
+ */
+struct graphics_state {
+        VkPipelineShaderStageCreateInfo stages[VR_SHADER_STAGE_N_STAGES];
+        VkPipelineInputAssemblyStateCreateInfo input_assembly_state;
+        VkViewport viewport;
+        VkRect2D scissor;
+        VkPipelineViewportStateCreateInfo viewport_state;
+        VkPipelineRasterizationStateCreateInfo rasterization_state;
+        VkPipelineVertexInputStateCreateInfo vertex_input_state;
+        VkPipelineTessellationStateCreateInfo tessellation_state;
+        VkPipelineColorBlendAttachmentState blend_attachment;
+        VkPipelineDepthStencilStateCreateInfo depth_stencil_state;
+        VkPipelineColorBlendStateCreateInfo color_blend_state;
+};
 
-        fclose(out);
+struct pipeline_batch {
+        struct vr_window *window;
+        enum vr_pipeline_key_type type;
+        uint32_t n_infos;
+        const void *infos;
+        VkPipeline *pipelines;
+        VkResult result;
+        struct vr_thread *thread;
+};
 
-        return filename;
-}
+struct stage_build {
+        const struct vr_script *script;
+        enum vr_shader_stage stage;
+        enum vr_script_source_type source_type;
+        /* Config for the compiler with the error callback redirected
+         * to collect the messages
+         */
+        struct vr_config config;
+        bool use_cache;
+        struct vr_shader_cache_key key;
+        bool needs_compile;
+        struct vr_thread *thread;
+        enum vr_compiler_result result;
+        struct vr_buffer binary;
+        struct vr_buffer messages;
+};
 
-static bool
-load_stream_contents(const struct vr_config *config,
-                     FILE *stream,
-                     uint8_t **contents_out,
-                     size_t *size_out)
+static void
+report_cached_output(const struct vr_config *config,
+                     struct vr_buffer *output)
 {
-        size_t got;
-        long pos;
-
-        fseek(stream, 0, SEEK_END);
-        pos = ftell(stream);
-
-        if (pos == -1) {
-                vr_error_message(config, "ftell failed");
-                return false;
-        }
-
-        size_t size = pos;
-        rewind(stream);
-        uint8_t *contents = vr_alloc(size);
+        uint8_t *p = output->data;
+        uint8_t *end;
 
-        got = fread(contents, 1, size, stream);
-        if (got != size) {
-                vr_error_message(config, "Error reading file contents");
-                vr_free(contents);
-                return false;
+        while ((end = memchr(p, '\n', output->data + output->length - p))) {
+                *end = '\0';
+                vr_error_message_string(config, (const char *) p);
+                p = end + 1;
         }
-
-        *contents_out = contents;
-        *size_out = size;
-
-        return true;
 }
 
-static bool
-show_disassembly(const struct vr_config *config,
-                 const char *filename)
+static void
+collect_message_cb(const char *message,
+                   void *user_data)
 {
-        char *args[] = {
-                getenv("PIGLIT_SPIRV_DIS_BINARY"),
-                (char *) filename,
-                NULL
-        };
+        struct vr_buffer *messages = user_data;
 
-        if (args[0] == NULL)
-                args[0] = "spirv-dis";
-
-        return vr_subprocess_command(config, args);
+        vr_buffer_append_string(messages, message);
+        vr_buffer_append_c(messages, '\0');
 }
 
-static VkShaderModule
-compile_stage(const struct vr_config *config,
-              struct vr_window *window,
-              const struct vr_script *script,
-              enum vr_shader_stage stage)
+static void
+init_stage_build(const struct vr_config *config,
+                 const struct vr_script *script,
+                 enum vr_shader_stage stage,
+                 struct stage_build *build)
 {
-        struct vr_vk *vkfn = &window->vkfn;
-        const int n_base_args = 8;
-        int n_shaders = vr_list_length(&script->stages[stage]);
-        char **args = alloca((n_base_args + n_shaders + 1) * sizeof args[0]);
-        const struct vr_script_shader *shader;
-        VkShaderModule module = VK_NULL_HANDLE;
-        FILE *module_stream = NULL;
-        char *module_filename;
-        uint8_t *module_binary = NULL;
-        size_t module_size;
-        bool res;
-        int i;
-
-        memset(args + n_base_args, 0, (n_shaders + 1) * sizeof args[0]);
-
-        if (!vr_temp_file_create_named(config,
-                                       &module_stream,
-                                       &module_filename))
-                goto out;
-
-        args[0] = getenv("PIGLIT_GLSLANG_VALIDATOR_BINARY");
-        if (args[0] == NULL)
-                args[0] = "glslangValidator";
-
-        args[1] = "-V";
-        args[2] = "--target-env";
-        args[3] = TARGET_ENV;
-        args[4] = "-S";
-        args[5] = (char *) stage_names[stage];
-        args[6] = "-o";
-        args[7] = module_filename;
-
-        i = n_base_args;
-        vr_list_for_each(shader, &script->stages[stage], link) {
-                args[i] = create_file_for_shader(config, shader);
-                if (args[i] == 0)
-                        goto out;
-                i++;
-        }
+        struct vr_script_shader *shader =
+                vr_container_of(script->stages[stage].next,
+                                struct vr_script_shader,
+                                link);
 
-        res = vr_subprocess_command(config, args);
-        if (!res) {
-                vr_error_message(config, "glslangValidator failed");
-                goto out;
+        memset(build, 0, sizeof *build);
+
+        build->script = script;
+        build->stage = stage;
+        build->source_type = shader->source_type;
+
+        /* The stages can be compiled in separate threads so any
+         * messages are collected using a separate config and
+         * reported afterwards in stage order. Only the fields that
+         * the compiler uses are copied.
+         */
+        build->config.error_cb = collect_message_cb;
+        build->config.user_data = &build->messages;
+        build->config.shader_cache = config->shader_cache;
+        build->config.compiler_pool = config->compiler_pool;
+        vr_mutex_init(&build->config.callback_mutex);
+
+        if (shader->source_type == VR_SCRIPT_SOURCE_TYPE_BINARY) {
+                vr_buffer_append(&build->binary,
+                                 shader->source,
+                                 shader->length);
+                build->result = VR_COMPILER_RESULT_OK;
+                return;
         }
 
-        if (config->show_disassembly)
-                show_disassembly(config, module_filename);
+        build->needs_compile = true;
 
-        if (!load_stream_contents(config,
-                                  module_stream,
-                                  &module_binary,
-                                  &module_size))
-                goto out;
+        if (config->shader_cache == NULL ||
+            !vr_compiler_init_cache_key(config,
+                                        &build->key,
+                                        stage,
+                                        &script->stages[stage]))
+                return;
 
-        VkShaderModuleCreateInfo shader_module_create_info = {
-                        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-                        .codeSize = module_size,
-                        .pCode = (const uint32_t *) module_binary
-        };
-        res = vkfn->vkCreateShaderModule(window->device,
-                                         &shader_module_create_info,
-                                         NULL, /* allocator */
-                                         &module);
-        if (res != VK_SUCCESS) {
-                vr_error_message(config, "vkCreateShaderModule failed");
-                module = VK_NULL_HANDLE;
-                goto out;
+        build->use_cache = true;
+
+        switch (vr_shader_cache_lookup(config->shader_cache,
+                                       &build->key,
+                                       &build->binary)) {
+        case VR_SHADER_CACHE_HIT:
+                build->result = VR_COMPILER_RESULT_OK;
+                build->needs_compile = false;
+                break;
+        case VR_SHADER_CACHE_HIT_FAILED:
+                report_cached_output(&build->config, &build->binary);
+                build->result = VR_COMPILER_RESULT_FAILED;
+                build->needs_compile = false;
+                break;
+        case VR_SHADER_CACHE_MISS:
+                break;
         }
+}
 
-out:
-        for (i = 0; i < n_shaders; i++) {
-                if (args[i + n_base_args]) {
-                        unlink(args[i + n_base_args]);
-                        vr_free(args[i + n_base_args]);
+static void
+compile_stage_build(void *user_data)
+{
+        struct stage_build *build = user_data;
+        struct vr_buffer output = VR_BUFFER_STATIC_INIT;
+
+        build->result =
+                vr_compiler_run(&build->config,
+                                build->stage,
+                                &build->script->stages[build->stage],
+                                build->use_cache ? &output : NULL,
+                                &build->binary);
+
+        if (build->use_cache) {
+                struct vr_shader_cache *cache = build->config.shader_cache;
+
+                if (build->result == VR_COMPILER_RESULT_OK) {
+                        vr_shader_cache_store(cache,
+                                              &build->key,
+                                              true, /* compiled */
+                                              build->binary.data,
+                                              build->binary.length);
+                } else if (build->result == VR_COMPILER_RESULT_FAILED) {
+                        vr_shader_cache_store(cache,
+                                              &build->key,
+                                              false, /* compiled */
+                                              output.data,
+                                              output.length);
                 }
         }
 
-        if (module_stream) {
-                fclose(module_stream);
-                unlink(module_filename);
-                vr_free(module_filename);
-        }
-
-        if (module_binary)
-                vr_free(module_binary);
-
-        return module;
+        vr_buffer_destroy(&output);
 }
 
-static VkShaderModule
-assemble_stage(const struct vr_config *config,
-               struct vr_window *window,
-               const struct vr_script_shader *shader)
+static bool
+finish_stage_build(const struct vr_config *config,
+                   struct vr_object_cache *object_cache,
+                   struct stage_build *build,
+                   struct vr_object_cache_entry **entry_out)
 {
-        struct vr_vk *vkfn = &window->vkfn;
-        FILE *module_stream = NULL;
-        char *module_filename;
-        char *source_filename = NULL;
-        uint8_t *module_binary = NULL;
-        VkShaderModule module = VK_NULL_HANDLE;
-        size_t module_size;
-        bool res;
-
-        if (!vr_temp_file_create_named(config,
-                                       &module_stream,
-                                       &module_filename))
-                goto out;
-
-        source_filename = create_file_for_shader(config, shader);
-        if (source_filename == NULL)
-                goto out;
-
-        char *args[] = {
-                getenv("PIGLIT_SPIRV_AS_BINARY"),
-                "--target-env", TARGET_ENV,
-                "-o", module_filename,
-                source_filename,
-                NULL
-        };
-
-        if (args[0] == NULL)
-                args[0] = "spirv-as";
-
-        res = vr_subprocess_command(config, args);
-        if (!res) {
-                vr_error_message(config, "spirv-as failed");
-                goto out;
-        }
-
-        if (config->show_disassembly)
-                show_disassembly(config, module_filename);
-
-        if (!load_stream_contents(config,
-                                  module_stream,
-                                  &module_binary,
-                                  &module_size))
-                goto out;
-
-        VkShaderModuleCreateInfo shader_module_create_info = {
-                        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-                        .codeSize = module_size,
-                        .pCode = (const uint32_t *) module_binary
-        };
-        res = vkfn->vkCreateShaderModule(window->device,
-                                         &shader_module_create_info,
-                                         NULL, /* allocator */
-                                         &module);
-        if (res != VK_SUCCESS) {
-                vr_error_message(config, "vkCreateShaderModule failed");
-                module = VK_NULL_HANDLE;
-                goto out;
+        const char *p = (const char *) build->messages.data;
+        const char *end = p + build->messages.length;
+
+        for (; p < end; p += strlen(p) + 1)
+                vr_error_message_string(config, p);
+
+        switch (build->result) {
+        case VR_COMPILER_RESULT_OK:
+                break;
+        case VR_COMPILER_RESULT_FAILED:
+                vr_error_message(config,
+                                 "%s failed",
+                                 vr_compiler_get_name(build->source_type));
+                return false;
+        case VR_COMPILER_RESULT_ERROR:
+                return false;
         }
 
-out:
-        if (source_filename) {
-                unlink(source_filename);
-                vr_free(source_filename);
+        if (config->show_disassembly) {
+                vr_compiler_show_disassembly(config,
+                                             build->binary.data,
+                                             build->binary.length);
         }
 
-        if (module_stream) {
-                fclose(module_stream);
-                unlink(module_filename);
-                vr_free(module_filename);
-        }
+        *entry_out = vr_object_cache_get_module(object_cache,
+                                                build->binary.data,
+                                                build->binary.length);
 
-        if (module_binary)
-                vr_free(module_binary);
+        return *entry_out != NULL;
+}
 
-        return module;
+static void
+destroy_stage_build(struct stage_build *build)
+{
+        if (build->use_cache)
+                vr_shader_cache_key_destroy(&build->key);
+        vr_buffer_destroy(&build->binary);
+        vr_buffer_destroy(&build->messages);
+        vr_mutex_destroy(&build->config.callback_mutex);
 }
 
-static VkShaderModule
-load_binary_stage(const struct vr_config *config,
-                  struct vr_window *window,
-                  const struct vr_script_shader *shader)
+static bool
+build_stages(const struct vr_config *config,
+             struct vr_object_cache *object_cache,
+             const struct vr_script *script,
+             struct vr_object_cache_entry **module_entries)
 {
-        struct vr_vk *vkfn = &window->vkfn;
-        VkShaderModule module = VK_NULL_HANDLE;
-        bool res;
+        struct stage_build builds[VR_SHADER_STAGE_N_STAGES];
+        int n_compiles = 0;
+        bool ret = true;
+        int i;
 
-        if (config->show_disassembly) {
-                FILE *module_stream;
-                char *module_filename;
+        for (i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
+                if (vr_list_empty(&script->stages[i]))
+                        continue;
+
+                init_stage_build(config, script, i, builds + i);
 
-                if (vr_temp_file_create_named(config,
-                                              &module_stream,
-                                              &module_filename)) {
-                        fwrite(shader->source,
-                               1, shader->length,
-                               module_stream);
-                        fclose(module_stream);
+                if (builds[i].needs_compile)
+                        n_compiles++;
+        }
 
-                        show_disassembly(config, module_filename);
+        /* Compile the stages concurrently. The last one is compiled
+         * on this thread while waiting for the others. If a thread
+         * can’t be created then the stage is compiled here instead.
+         */
+        for (i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
+                if (vr_list_empty(&script->stages[i]) ||
+                    !builds[i].needs_compile)
+                        continue;
 
-                        unlink(module_filename);
-                        vr_free(module_filename);
-                }
+                if (--n_compiles > 0)
+                        builds[i].thread = vr_thread_start(compile_stage_build,
+                                                           builds + i);
+
+                if (builds[i].thread == NULL)
+                        compile_stage_build(builds + i);
         }
 
-        VkShaderModuleCreateInfo shader_module_create_info = {
-                        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-                        .codeSize = shader->length,
-                        .pCode = (const uint32_t *) shader->source
-        };
-        res = vkfn->vkCreateShaderModule(window->device,
-                                         &shader_module_create_info,
-                                         NULL, /* allocator */
-                                         &module);
-        if (res != VK_SUCCESS)
-                vr_error_message(config, "vkCreateShaderModule failed");
-
-        return module;
-}
+        for (i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
+                if (vr_list_empty(&script->stages[i]))
+                        continue;
 
-static VkShaderModule
-build_stage(const struct vr_config *config,
-            struct vr_window *window,
-            const struct vr_script *script,
-            enum vr_shader_stage stage)
-{
-        assert(!vr_list_empty(&script->stages[stage]));
+                if (builds[i].thread)
+                        vr_thread_join(builds[i].thread);
+        }
 
-        struct vr_script_shader *shader =
-                vr_container_of(script->stages[stage].next,
-                                struct vr_script_shader,
-                                link);
+        /* Report the results in stage order so that the output is
+         * the same as if the stages were compiled one at a time.
+         */
+        for (i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
+                if (vr_list_empty(&script->stages[i]))
+                        continue;
+
+                if (ret && !finish_stage_build(config,
+                                               object_cache,
+                                               builds + i,
+                                               module_entries + i))
+                        ret = false;
 
-        switch (shader->source_type) {
-        case VR_SCRIPT_SOURCE_TYPE_GLSL:
-                return compile_stage(config, window, script, stage);
-        case VR_SCRIPT_SOURCE_TYPE_SPIRV:
-                return assemble_stage(config, window, shader);
-        case VR_SCRIPT_SOURCE_TYPE_BINARY:
-                return load_binary_stage(config, window, shader);
+                destroy_stage_build(builds + i);
         }
 
-        vr_fatal("should not be reached");
+        return ret;
 }
 
 static void
@@ -439,184 +390,332 @@ set_vertex_input_state(const struct vr_script *script,
         };
 }
 
-static VkPipeline
-create_vk_pipeline(struct vr_pipeline *pipeline,
-                   const struct vr_script *script,
-                   const struct vr_pipeline_key *key,
-                   bool allow_derivatives,
-                   VkPipeline parent_pipeline)
+static void
+init_graphics_create_info(struct vr_pipeline *pipeline,
+                          const struct vr_script *script,
+                          const struct vr_pipeline_key *key,
+                          VkPipelineCreateFlags flags,
+                          struct graphics_state *state,
+                          VkGraphicsPipelineCreateInfo *info)
 {
         struct vr_window *window = pipeline->window;
-        struct vr_vk *vkfn = &window->vkfn;
-        VkResult res;
         int num_stages = 0;
 
-        VkPipelineShaderStageCreateInfo stages[VR_SHADER_STAGE_N_STAGES];
-        memset(&stages, 0, sizeof stages);
+        memset(state, 0, sizeof *state);
 
         for (int i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
                 if (i == VR_SHADER_STAGE_COMPUTE ||
                     pipeline->modules[i] == VK_NULL_HANDLE)
                         continue;
-                stages[num_stages].sType =
+                state->stages[num_stages].sType =
                         VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-                stages[num_stages].stage = VK_SHADER_STAGE_VERTEX_BIT << i;
-                stages[num_stages].module = pipeline->modules[i];
-                stages[num_stages].pName =
+                state->stages[num_stages].stage =
+                        VK_SHADER_STAGE_VERTEX_BIT << i;
+                state->stages[num_stages].module = pipeline->modules[i];
+                state->stages[num_stages].pName =
                         vr_pipeline_key_get_entrypoint(key, i);
                 num_stages++;
         }
 
-        VkPipelineInputAssemblyStateCreateInfo input_assembly_state = {
-                .sType =
-                VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO
-        };
+        state->input_assembly_state.sType =
+                VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
 
-        VkViewport viewports[] = {
-                {
-                        .width = window->format.width,
-                        .height = window->format.height,
-                        .minDepth = 0.0f,
-                        .maxDepth = 1.0f
-                }
-        };
-        VkRect2D scissors[] = {
-                {
-                        .extent = { window->format.width,
-                                    window->format.height }
-                }
-        };
-        VkPipelineViewportStateCreateInfo viewport_state = {
-                .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-                .viewportCount = VR_N_ELEMENTS(viewports),
-                .pViewports = viewports,
-                .scissorCount = VR_N_ELEMENTS(scissors),
-                .pScissors = scissors
-        };
+        state->viewport.width = window->format.width;
+        state->viewport.height = window->format.height;
+        state->viewport.minDepth = 0.0f;
+        state->viewport.maxDepth = 1.0f;
 
-        VkPipelineRasterizationStateCreateInfo rasterization_state = {
-                .sType =
-                VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO
-        };
+        state->scissor.extent.width = window->format.width;
+        state->scissor.extent.height = window->format.height;
 
-        VkPipelineVertexInputStateCreateInfo vertex_input_state;
-        set_vertex_input_state(script, &vertex_input_state, key);
+        state->viewport_state.sType =
+                VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        state->viewport_state.viewportCount = 1;
+        state->viewport_state.pViewports = &state->viewport;
+        state->viewport_state.scissorCount = 1;
+        state->viewport_state.pScissors = &state->scissor;
 
-        VkPipelineTessellationStateCreateInfo tessellation_state = {
-                .sType =
-                VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO
-        };
+        state->rasterization_state.sType =
+                VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
 
-        VkPipelineColorBlendAttachmentState blend_attachments[] = {
-                {
-                        .blendEnable = false,
-                }
-        };
+        set_vertex_input_state(script, &state->vertex_input_state, key);
 
-        VkPipelineDepthStencilStateCreateInfo depth_stencil_state = {
-                .sType =
-                VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-        };
+        state->tessellation_state.sType =
+                VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO;
 
-        VkPipelineColorBlendStateCreateInfo color_blend_state = {
-                .sType =
-                VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-                .attachmentCount = VR_N_ELEMENTS(blend_attachments),
-                .pAttachments = blend_attachments
-        };
+        state->blend_attachment.blendEnable = false;
 
-        VkGraphicsPipelineCreateInfo info = {
-                .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-                .pViewportState = &viewport_state,
-                .pRasterizationState = &rasterization_state,
-                .pMultisampleState = &base_multisample_state,
-                .pDepthStencilState = &depth_stencil_state,
-                .pColorBlendState = &color_blend_state,
-                .pTessellationState = &tessellation_state,
-                .subpass = 0,
-                .basePipelineHandle = parent_pipeline,
-                .basePipelineIndex = -1,
-
-                .stageCount = num_stages,
-                .pStages = stages,
-                .pVertexInputState = &vertex_input_state,
-                .pInputAssemblyState = &input_assembly_state,
-                .layout = pipeline->layout,
-                .renderPass = window->render_pass[0],
-        };
+        state->depth_stencil_state.sType =
+                VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 
-        vr_pipeline_key_to_create_info(key, &info);
+        state->color_blend_state.sType =
+                VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        state->color_blend_state.attachmentCount = 1;
+        state->color_blend_state.pAttachments = &state->blend_attachment;
 
-        if (allow_derivatives)
-                info.flags |= VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
-        if (parent_pipeline)
-                info.flags |= VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+        memset(info, 0, sizeof *info);
+        info->sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        info->pViewportState = &state->viewport_state;
+        info->pRasterizationState = &state->rasterization_state;
+        info->pMultisampleState = &base_multisample_state;
+        info->pDepthStencilState = &state->depth_stencil_state;
+        info->pColorBlendState = &state->color_blend_state;
+        info->pTessellationState = &state->tessellation_state;
+        info->subpass = 0;
+        info->basePipelineHandle = VK_NULL_HANDLE;
+        info->basePipelineIndex = -1;
+        info->stageCount = num_stages;
+        info->pStages = state->stages;
+        info->pVertexInputState = &state->vertex_input_state;
+        info->pInputAssemblyState = &state->input_assembly_state;
+        info->layout = pipeline->layout;
+        info->renderPass = window->render_pass[0];
+
+        vr_pipeline_key_to_create_info(key, info);
+
+        info->flags |= flags;
 
         if (!(pipeline->stages & (VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT |
                                   VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT)))
-                info.pTessellationState = NULL;
-
-        VkPipeline vk_pipeline;
+                info->pTessellationState = NULL;
+}
 
-        res = vkfn->vkCreateGraphicsPipelines(window->device,
-                                              pipeline->pipeline_cache,
-                                              1, /* nCreateInfos */
-                                              &info,
-                                              NULL, /* allocator */
-                                              &vk_pipeline);
+static void
+destroy_graphics_state(struct graphics_state *state)
+{
+        VkPipelineVertexInputStateCreateInfo *vertex_input_state =
+                &state->vertex_input_state;
 
-        vr_free((void *) vertex_input_state.pVertexBindingDescriptions);
-        vr_free((void *) vertex_input_state.pVertexAttributeDescriptions);
+        vr_free((void *) vertex_input_state->pVertexBindingDescriptions);
+        vr_free((void *) vertex_input_state->pVertexAttributeDescriptions);
+}
 
-        if (res != VK_SUCCESS) {
-                vr_error_message(window->config, "Error creating VkPipeline");
-                return VK_NULL_HANDLE;
-        }
+static void
+init_compute_create_info(struct vr_pipeline *pipeline,
+                         const struct vr_pipeline_key *key,
+                         VkComputePipelineCreateInfo *info)
+{
+        const char *entrypoint =
+                vr_pipeline_key_get_entrypoint(key, VR_SHADER_STAGE_COMPUTE);
 
-        return vk_pipeline;
+        memset(info, 0, sizeof *info);
+        info->sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        info->stage.sType =
+                VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        info->stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        info->stage.module = pipeline->modules[VR_SHADER_STAGE_COMPUTE];
+        info->stage.pName = entrypoint;
+        info->layout = pipeline->layout;
+        info->basePipelineHandle = VK_NULL_HANDLE;
+        info->basePipelineIndex = -1;
 }
 
-static VkPipeline
-create_compute_pipeline(struct vr_pipeline *pipeline,
-                        const struct vr_pipeline_key *key)
+static void
+create_pipeline_batch(void *user_data)
 {
-        struct vr_window *window = pipeline->window;
+        struct pipeline_batch *batch = user_data;
+        struct vr_window *window = batch->window;
         struct vr_vk *vkfn = &window->vkfn;
-        const char *entrypoint =
-                vr_pipeline_key_get_entrypoint(key, VR_SHADER_STAGE_COMPUTE);
-        VkResult res;
 
-        VkComputePipelineCreateInfo info = {
-                .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        switch (batch->type) {
+        case VR_PIPELINE_KEY_TYPE_GRAPHICS:
+                batch->result = vkfn->vkCreateGraphicsPipelines(
+                        window->device,
+                        window->context->pipeline_cache,
+                        batch->n_infos,
+                        batch->infos,
+                        NULL, /* allocator */
+                        batch->pipelines);
+                break;
+        case VR_PIPELINE_KEY_TYPE_COMPUTE:
+                batch->result = vkfn->vkCreateComputePipelines(
+                        window->device,
+                        window->context->pipeline_cache,
+                        batch->n_infos,
+                        batch->infos,
+                        NULL, /* allocator */
+                        batch->pipelines);
+                break;
+        }
+}
 
-                .stage = {
-                        .sType =
-                        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-                        .stage = VK_SHADER_STAGE_COMPUTE_BIT,
-                        .module =
-                        pipeline->modules[VR_SHADER_STAGE_COMPUTE],
-                        .pName = entrypoint
-                },
-                .layout = pipeline->layout,
-                .basePipelineHandle = VK_NULL_HANDLE,
-                .basePipelineIndex = -1,
-        };
+/* Creates the pipelines for an array of create infos of the given
+ * type. The array is split into a batch per pipeline thread and each
+ * batch is passed to the driver in a single call. The last batch is
+ * created on this thread. If any of the pipelines can’t be created
+ * then the others will still be stored in pipelines so that they can
+ * be freed.
+ */
+static bool
+create_pipeline_batches(const struct vr_config *config,
+                        struct vr_window *window,
+                        enum vr_pipeline_key_type type,
+                        uint32_t n_infos,
+                        const void *infos,
+                        size_t info_size,
+                        VkPipeline *pipelines)
+{
+        if (n_infos == 0)
+                return true;
+
+        unsigned n_batches = MAX(1, MIN(config->pipeline_threads, n_infos));
+        struct pipeline_batch *batches =
+                vr_calloc(sizeof *batches * n_batches);
+        uint32_t start = 0;
+        bool ret = true;
+
+        for (unsigned i = 0; i < n_batches; i++) {
+                uint32_t end = (uint64_t) n_infos * (i + 1) / n_batches;
+
+                batches[i].window = window;
+                batches[i].type = type;
+                batches[i].n_infos = end - start;
+                batches[i].infos = (const uint8_t *) infos + start * info_size;
+                batches[i].pipelines = pipelines + start;
+
+                if (i + 1 < n_batches) {
+                        batches[i].thread =
+                                vr_thread_start(create_pipeline_batch,
+                                                batches + i);
+                }
 
-        VkPipeline vk_pipeline;
+                if (batches[i].thread == NULL)
+                        create_pipeline_batch(batches + i);
 
-        res = vkfn->vkCreateComputePipelines(window->device,
-                                             pipeline->pipeline_cache,
-                                             1, /* nCreateInfos */
-                                             &info,
-                                             NULL, /* allocator */
-                                             &vk_pipeline);
+                start = end;
+        }
 
-        if (res != VK_SUCCESS) {
+        for (unsigned i = 0; i < n_batches; i++) {
+                if (batches[i].thread)
+                        vr_thread_join(batches[i].thread);
+                if (batches[i].result != VK_SUCCESS)
+                        ret = false;
+        }
+
+        vr_free(batches);
+
+        if (!ret)
                 vr_error_message(window->config, "Error creating VkPipeline");
-                return VK_NULL_HANDLE;
+
+        return ret;
+}
+
+/* Creates the graphics pipelines for the keys listed in misses. The
+ * first graphics key of the script is the parent of the others. If
+ * parent is VK_NULL_HANDLE then the parent isn’t in the object cache
+ * so it must be the first key in misses and the others refer to it by
+ * its index.
+ */
+static bool
+create_graphics_pipelines(const struct vr_config *config,
+                          struct vr_pipeline *pipeline,
+                          const struct vr_script *script,
+                          int n_misses,
+                          const int *misses,
+                          const VkPipelineCreateFlags *flags,
+                          VkPipeline parent,
+                          VkPipeline *pipelines_out)
+{
+        VkGraphicsPipelineCreateInfo *infos =
+                vr_alloc(sizeof *infos * n_misses);
+        struct graphics_state *states = vr_alloc(sizeof *states * n_misses);
+        int first = 0;
+        bool ret = true;
+
+        for (int i = 0; i < n_misses; i++) {
+                int key_num = misses[i];
+
+                init_graphics_create_info(pipeline,
+                                          script,
+                                          script->pipeline_keys + key_num,
+                                          flags[key_num],
+                                          states + i,
+                                          infos + i);
+
+                if ((flags[key_num] & VK_PIPELINE_CREATE_DERIVATIVE_BIT)) {
+                        if (parent) {
+                                infos[i].basePipelineHandle = parent;
+                        } else {
+                                assert(i > 0);
+                                infos[i].basePipelineIndex = 0;
+                        }
+                }
+        }
+
+        /* The derivatives can only refer to the parent by index
+         * within the same call, so if the batch is going to be split
+         * across threads then the parent is created first on its
+         * own.
+         */
+        if (parent == VK_NULL_HANDLE &&
+            n_misses > 1 &&
+            config->pipeline_threads > 1 &&
+            (infos[0].flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT)) {
+                ret = create_pipeline_batches(config,
+                                              pipeline->window,
+                                              VR_PIPELINE_KEY_TYPE_GRAPHICS,
+                                              1, /* n_infos */
+                                              infos,
+                                              sizeof *infos,
+                                              pipelines_out);
+
+                for (int i = 1; i < n_misses; i++) {
+                        if (infos[i].basePipelineIndex == 0) {
+                                infos[i].basePipelineHandle = pipelines_out[0];
+                                infos[i].basePipelineIndex = -1;
+                        }
+                }
+
+                first = 1;
+        }
+
+        if (ret) {
+                ret = create_pipeline_batches(config,
+                                              pipeline->window,
+                                              VR_PIPELINE_KEY_TYPE_GRAPHICS,
+                                              n_misses - first,
+                                              infos + first,
+                                              sizeof *infos,
+                                              pipelines_out + first);
         }
 
-        return vk_pipeline;
+        for (int i = 0; i < n_misses; i++)
+                destroy_graphics_state(states + i);
+
+        vr_free(states);
+        vr_free(infos);
+
+        return ret;
+}
+
+static bool
+create_compute_pipelines(const struct vr_config *config,
+                         struct vr_pipeline *pipeline,
+                         const struct vr_script *script,
+                         int n_misses,
+                         const int *misses,
+                         VkPipeline *pipelines_out)
+{
+        VkComputePipelineCreateInfo *infos =
+                vr_alloc(sizeof *infos * n_misses);
+
+        for (int i = 0; i < n_misses; i++) {
+                init_compute_create_info(pipeline,
+                                         script->pipeline_keys + misses[i],
+                                         infos + i);
+        }
+
+        bool ret = create_pipeline_batches(config,
+                                           pipeline->window,
+                                           VR_PIPELINE_KEY_TYPE_COMPUTE,
+                                           n_misses,
+                                           infos,
+                                           sizeof *infos,
+                                           pipelines_out);
+
+        vr_free(infos);
+
+        return ret;
 }
 
 static size_t
@@ -714,20 +813,15 @@ create_vk_descriptor_set_layout(struct vr_pipeline *pipeline,
         size_t n_used_desc_sets = 0;
         unsigned prev_desc_set = UINT_MAX;
 
-        unsigned n_ubo = 0;
-        unsigned n_ssbo = 0;
-
         for (unsigned i = 0; i < n_buffers; i++) {
                 const struct vr_script_buffer *buffer = script->buffers + i;
                 VkDescriptorType descriptor_type;
                 switch (buffer->type) {
                 case VR_SCRIPT_BUFFER_TYPE_UBO:
                         descriptor_type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-                        ++n_ubo;
                         goto found_type;
                 case VR_SCRIPT_BUFFER_TYPE_SSBO:
                         descriptor_type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-                        ++n_ssbo;
                         goto found_type;
                 }
                 vr_fatal("Unexpected buffer type");
@@ -755,39 +849,6 @@ create_vk_descriptor_set_layout(struct vr_pipeline *pipeline,
 
         size_t n_desc_sets = info[n_used_desc_sets - 1].desc_set + 1;
 
-        VkDescriptorPoolSize pool_sizes[2];
-        uint32_t n_pool_sizes = 0;
-        if (n_ubo) {
-                pool_sizes[n_pool_sizes].type =
-                        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-                pool_sizes[n_pool_sizes].descriptorCount = n_ubo;
-                n_pool_sizes++;
-        }
-        if (n_ssbo) {
-                pool_sizes[n_pool_sizes].type =
-                        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-                pool_sizes[n_pool_sizes].descriptorCount = n_ssbo;
-                n_pool_sizes++;
-        }
-
-        VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
-                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-                .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
-                .maxSets = n_desc_sets,
-                .poolSizeCount = n_pool_sizes,
-                .pPoolSizes = pool_sizes
-        };
-
-        res = vkfn->vkCreateDescriptorPool(pipeline->window->device,
-                                           &descriptor_pool_create_info,
-                                           NULL, /* allocator */
-                                           &pipeline->descriptor_pool);
-        if (res != VK_SUCCESS) {
-                vr_error_message(pipeline->window->config,
-                                 "Error creating VkDescriptorPool");
-                goto error;
-        }
-
         pipeline->descriptor_set_layout =
                 vr_calloc(sizeof(VkDescriptorSetLayout) * n_desc_sets);
         pipeline->n_desc_sets = n_desc_sets;
@@ -830,85 +891,354 @@ error:
         return ret;
 }
 
-struct vr_pipeline *
-vr_pipeline_create(const struct vr_config *config,
-                   struct vr_window *window,
-                   const struct vr_script *script)
+static bool
+create_vk_descriptor_pool(struct vr_pipeline *pipeline,
+                          const struct vr_script *script)
 {
-        struct vr_vk *vkfn = &window->vkfn;
+        struct vr_vk *vkfn = &pipeline->window->vkfn;
+        size_t n_buffers = script->n_buffers;
+        unsigned n_ubo = 0;
+        unsigned n_ssbo = 0;
         VkResult res;
-        struct vr_pipeline *pipeline = vr_calloc(sizeof *pipeline);
 
-        pipeline->window = window;
+        for (unsigned i = 0; i < n_buffers; i++) {
+                switch (script->buffers[i].type) {
+                case VR_SCRIPT_BUFFER_TYPE_UBO:
+                        ++n_ubo;
+                        break;
+                case VR_SCRIPT_BUFFER_TYPE_SSBO:
+                        ++n_ssbo;
+                        break;
+                }
+        }
 
-        for (int i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
-                if (vr_list_empty(&script->stages[i]))
-                        continue;
+        /* The buffers are sorted by descriptor set */
+        size_t n_desc_sets = script->buffers[n_buffers - 1].desc_set + 1;
 
-                pipeline->modules[i] = build_stage(config, window, script, i);
-                if (pipeline->modules[i] == VK_NULL_HANDLE)
-                        goto error;
+        VkDescriptorPoolSize pool_sizes[2];
+        uint32_t n_pool_sizes = 0;
+        if (n_ubo) {
+                pool_sizes[n_pool_sizes].type =
+                        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                pool_sizes[n_pool_sizes].descriptorCount = n_ubo;
+                n_pool_sizes++;
+        }
+        if (n_ssbo) {
+                pool_sizes[n_pool_sizes].type =
+                        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                pool_sizes[n_pool_sizes].descriptorCount = n_ssbo;
+                n_pool_sizes++;
         }
 
-        VkPipelineCacheCreateInfo pipeline_cache_create_info = {
-                .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO
+        VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+                .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+                .maxSets = n_desc_sets,
+                .poolSizeCount = n_pool_sizes,
+                .pPoolSizes = pool_sizes
         };
-        res = vkfn->vkCreatePipelineCache(window->device,
-                                          &pipeline_cache_create_info,
-                                          NULL, /* allocator */
-                                          &pipeline->pipeline_cache);
+
+        res = vkfn->vkCreateDescriptorPool(pipeline->window->device,
+                                           &descriptor_pool_create_info,
+                                           NULL, /* allocator */
+                                           &pipeline->descriptor_pool);
         if (res != VK_SUCCESS) {
-                vr_error_message(config, "Error creating pipeline cache");
-                goto error;
+                vr_error_message(pipeline->window->config,
+                                 "Error creating VkDescriptorPool");
+                return false;
         }
 
-        pipeline->stages = get_script_stages(script);
+        return true;
+}
 
-        if (script->n_buffers > 0) {
-                if (!create_vk_descriptor_set_layout(pipeline, script))
-                        goto error;
+static void
+append_value(struct vr_buffer *buffer,
+             uint64_t value)
+{
+        vr_buffer_append(buffer, &value, sizeof value);
+}
+
+/* Gets the pipeline layout for the script from the object cache,
+ * creating it if it isn’t already there. The layout is owned by the
+ * cache because it has to stay alive as long as the cached pipelines
+ * that were created with it.
+ */
+static bool
+get_layout(struct vr_pipeline *pipeline,
+           struct vr_object_cache *object_cache,
+           const struct vr_script *script)
+{
+        struct vr_buffer key = VR_BUFFER_STATIC_INIT;
+        bool ret = false;
+
+        append_value(&key, pipeline->stages);
+        append_value(&key, get_push_constant_size(script));
+
+        append_value(&key, script->n_buffers);
+        for (size_t i = 0; i < script->n_buffers; i++) {
+                const struct vr_script_buffer *script_buffer =
+                        script->buffers + i;
+                append_value(&key, script_buffer->desc_set);
+                append_value(&key, script_buffer->binding);
+                append_value(&key, script_buffer->type);
         }
 
-        pipeline->layout = create_vk_layout(pipeline, script);
-        if (pipeline->layout == VK_NULL_HANDLE)
-                goto error;
+        struct vr_object_cache_entry *entry =
+                vr_object_cache_lookup_layout(object_cache, &key);
 
+        if (entry == NULL) {
+                if (script->n_buffers > 0 &&
+                    !create_vk_descriptor_set_layout(pipeline, script))
+                        goto out;
+
+                pipeline->layout = create_vk_layout(pipeline, script);
+                if (pipeline->layout == VK_NULL_HANDLE)
+                        goto out;
+
+                entry = vr_object_cache_add_layout(
+                        object_cache,
+                        &key,
+                        pipeline->layout,
+                        pipeline->n_desc_sets,
+                        pipeline->descriptor_set_layout);
+        }
+
+        pipeline->layout_entry = entry;
+        pipeline->layout = entry->layout.layout;
+        pipeline->n_desc_sets = entry->layout.n_set_layouts;
+        pipeline->descriptor_set_layout = entry->layout.set_layouts;
+
+        ret = true;
+
+out:
+        vr_buffer_destroy(&key);
+
+        return ret;
+}
+
+/* Builds a key for the object cache that describes everything that
+ * would be passed to vkCreate*Pipelines. The modules and the layout
+ * are referred to by the serial of their cache entry.
+ */
+static void
+get_pipeline_cache_key(const struct vr_pipeline *pipeline,
+                       const struct vr_script *script,
+                       const struct vr_pipeline_key *key,
+                       VkPipelineCreateFlags flags,
+                       struct vr_buffer *buffer)
+{
+        for (int i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
+                const struct vr_object_cache_entry *entry =
+                        pipeline->module_entries[i];
+                append_value(buffer, entry ? entry->serial : 0);
+        }
+
+        vr_pipeline_key_serialize(key, buffer);
+
+        append_value(buffer, flags);
+        append_value(buffer, pipeline->layout_entry->serial);
+
+        if (key->type != VR_PIPELINE_KEY_TYPE_GRAPHICS)
+                return;
+
+        VkPipelineVertexInputStateCreateInfo vertex_input_state;
+        set_vertex_input_state(script, &vertex_input_state, key);
+
+        append_value(buffer, vertex_input_state.vertexBindingDescriptionCount);
+        if (vertex_input_state.vertexBindingDescriptionCount > 0) {
+                append_value(buffer,
+                             vertex_input_state.
+                             pVertexBindingDescriptions[0].stride);
+        }
+
+        append_value(buffer,
+                     vertex_input_state.vertexAttributeDescriptionCount);
+        for (unsigned i = 0;
+             i < vertex_input_state.vertexAttributeDescriptionCount;
+             i++) {
+                const VkVertexInputAttributeDescription *attrib =
+                        vertex_input_state.pVertexAttributeDescriptions + i;
+                append_value(buffer, attrib->location);
+                append_value(buffer, attrib->format);
+                append_value(buffer, attrib->offset);
+        }
+
+        vr_free((void *) vertex_input_state.pVertexBindingDescriptions);
+        vr_free((void *) vertex_input_state.pVertexAttributeDescriptions);
+
+        /* The viewport depends on the size requested by the script
+         * which can change when the window is reused.
+         */
+        append_value(buffer, pipeline->window->format.width);
+        append_value(buffer, pipeline->window->format.height);
+}
+
+static bool
+create_pipelines(const struct vr_config *config,
+                 struct vr_pipeline *pipeline,
+                 struct vr_object_cache *object_cache,
+                 const struct vr_script *script)
+{
+        int n_pipelines = pipeline->n_pipelines;
         const struct vr_pipeline_key *keys = script->pipeline_keys;
+        struct vr_buffer *cache_keys =
+                vr_alloc(sizeof *cache_keys * MAX(1, n_pipelines));
+        VkPipelineCreateFlags *flags =
+                vr_alloc(sizeof *flags * MAX(1, n_pipelines));
+        /* Keys that aren’t in the object cache. The graphics keys are
+         * added at the start and the compute keys are moved after
+         * them once they are all known.
+         */
+        int *misses = vr_alloc(sizeof *misses * MAX(1, n_pipelines));
+        int *compute_misses = vr_alloc(sizeof *misses * MAX(1, n_pipelines));
+        int n_graphics_misses = 0, n_compute_misses = 0;
+        int parent_num = -1;
+        bool ret = true;
+
+        for (int i = 0; i < n_pipelines; i++) {
+                if (keys[i].type != VR_PIPELINE_KEY_TYPE_GRAPHICS) {
+                        flags[i] = 0;
+                } else if (parent_num == -1) {
+                        parent_num = i;
+                        flags[i] = (n_pipelines > 1 ?
+                                    VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT :
+                                    0);
+                } else {
+                        flags[i] = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+                }
 
-        pipeline->n_pipelines = script->n_pipeline_keys;
-        pipeline->pipelines = vr_calloc(sizeof (VkPipeline) *
-                                        MAX(1, pipeline->n_pipelines));
+                vr_buffer_init(cache_keys + i);
+                get_pipeline_cache_key(pipeline,
+                                       script,
+                                       keys + i,
+                                       flags[i],
+                                       cache_keys + i);
 
-        VkPipeline first_graphics_pipeline = VK_NULL_HANDLE;
+                struct vr_object_cache_entry *entry =
+                        vr_object_cache_lookup_pipeline(object_cache,
+                                                        cache_keys + i);
+
+                if (entry) {
+                        pipeline->pipeline_entries[i] = entry;
+                        pipeline->pipelines[i] = entry->pipeline;
+                        continue;
+                }
 
-        for (int i = 0; i < pipeline->n_pipelines; i++) {
                 switch (keys[i].type) {
-                case VR_PIPELINE_KEY_TYPE_GRAPHICS: {
-                        bool allow_derivatives = (pipeline->n_pipelines > 1 &&
-                                                  first_graphics_pipeline ==
-                                                  VK_NULL_HANDLE);
-                        pipeline->pipelines[i] =
-                                create_vk_pipeline(pipeline,
-                                                   script,
-                                                   keys + i,
-                                                   allow_derivatives,
-                                                   first_graphics_pipeline);
-                        if (first_graphics_pipeline == VK_NULL_HANDLE) {
-                                first_graphics_pipeline =
-                                        pipeline->pipelines[i];
-                        }
+                case VR_PIPELINE_KEY_TYPE_GRAPHICS:
+                        misses[n_graphics_misses++] = i;
                         break;
-                }
                 case VR_PIPELINE_KEY_TYPE_COMPUTE:
-                        pipeline->pipelines[i] =
-                                create_compute_pipeline(pipeline, keys + i);
+                        compute_misses[n_compute_misses++] = i;
                         break;
                 }
+        }
 
-                if (pipeline->pipelines[i] == VK_NULL_HANDLE)
-                        goto error;
+        memcpy(misses + n_graphics_misses,
+               compute_misses,
+               sizeof *misses * n_compute_misses);
+        vr_free(compute_misses);
+
+        VkPipeline *created = vr_calloc(sizeof *created *
+                                        MAX(1, n_pipelines));
+        VkPipeline parent = VK_NULL_HANDLE;
+
+        if (parent_num != -1 && pipeline->pipeline_entries[parent_num])
+                parent = pipeline->pipeline_entries[parent_num]->pipeline;
+
+        if (n_graphics_misses > 0 &&
+            !create_graphics_pipelines(config,
+                                       pipeline,
+                                       script,
+                                       n_graphics_misses,
+                                       misses,
+                                       flags,
+                                       parent,
+                                       created))
+                ret = false;
+
+        if (ret &&
+            n_compute_misses > 0 &&
+            !create_compute_pipelines(config,
+                                      pipeline,
+                                      script,
+                                      n_compute_misses,
+                                      misses + n_graphics_misses,
+                                      created + n_graphics_misses))
+                ret = false;
+
+        /* Give the pipelines that were created to the object cache,
+         * even if some of them failed, so that they will be freed.
+         */
+        for (int i = 0; i < n_graphics_misses + n_compute_misses; i++) {
+                if (created[i] == VK_NULL_HANDLE)
+                        continue;
+
+                int key_num = misses[i];
+                struct vr_object_cache_entry *entry =
+                        vr_object_cache_add_pipeline(object_cache,
+                                                     cache_keys + key_num,
+                                                     created[i],
+                                                     pipeline->layout_entry);
+                pipeline->pipeline_entries[key_num] = entry;
+                pipeline->pipelines[key_num] = created[i];
         }
 
+        vr_free(created);
+
+        for (int i = 0; i < n_pipelines; i++)
+                vr_buffer_destroy(cache_keys + i);
+
+        vr_free(misses);
+        vr_free(flags);
+        vr_free(cache_keys);
+
+        return ret;
+}
+
+struct vr_pipeline *
+vr_pipeline_create(const struct vr_config *config,
+                   struct vr_window *window,
+                   struct vr_object_cache *object_cache,
+                   const struct vr_script *script)
+{
+        struct vr_pipeline *pipeline = vr_calloc(sizeof *pipeline);
+
+        pipeline->window = window;
+        pipeline->object_cache = object_cache;
+
+        if (!build_stages(config,
+                          object_cache,
+                          script,
+                          pipeline->module_entries))
+                goto error;
+
+        for (int i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
+                if (pipeline->module_entries[i])
+                        pipeline->modules[i] =
+                                pipeline->module_entries[i]->module;
+        }
+
+        pipeline->stages = get_script_stages(script);
+
+        if (script->n_buffers > 0 &&
+            !create_vk_descriptor_pool(pipeline, script))
+                goto error;
+
+        if (!get_layout(pipeline, object_cache, script))
+                goto error;
+
+        pipeline->n_pipelines = script->n_pipeline_keys;
+        pipeline->pipelines = vr_calloc(sizeof (VkPipeline) *
+                                        MAX(1, pipeline->n_pipelines));
+
+        pipeline->pipeline_entries =
+                vr_calloc(sizeof (struct vr_object_cache_entry *) *
+                          MAX(1, pipeline->n_pipelines));
+
+        if (!create_pipelines(config, pipeline, object_cache, script))
+                goto error;
+
         return pipeline;
 
 error:
@@ -923,27 +1253,21 @@ vr_pipeline_free(struct vr_pipeline *pipeline)
         struct vr_vk *vkfn = &window->vkfn;
 
         for (int i = 0; i < pipeline->n_pipelines; i++) {
-                if (pipeline->pipelines[i]) {
-                        vkfn->vkDestroyPipeline(window->device,
-                                                pipeline->pipelines[i],
-                                                NULL /* allocator */);
+                if (pipeline->pipeline_entries[i]) {
+                        vr_object_cache_release(pipeline->object_cache,
+                                                pipeline->pipeline_entries[i]);
                 }
         }
+        vr_free(pipeline->pipeline_entries);
         vr_free(pipeline->pipelines);
 
-        if (pipeline->pipeline_cache) {
-                vkfn->vkDestroyPipelineCache(window->device,
-                                             pipeline->pipeline_cache,
-                                             NULL /* allocator */);
-        }
-
-        if (pipeline->layout) {
-                vkfn->vkDestroyPipelineLayout(window->device,
-                                              pipeline->layout,
-                                              NULL /* allocator */);
-        }
-
-        if (pipeline->descriptor_set_layout) {
+        if (pipeline->layout_entry) {
+                vr_object_cache_release(pipeline->object_cache,
+                                        pipeline->layout_entry);
+        } else if (pipeline->descriptor_set_layout) {
+                /* Creating the layout failed after some of the
+                 * descriptor set layouts were created.
+                 */
                 for (unsigned i = 0; i < pipeline->n_desc_sets; i++) {
                         VkDescriptorSetLayout dsl =
                                 pipeline->descriptor_set_layout[i];
@@ -964,11 +1288,10 @@ vr_pipeline_free(struct vr_pipeline *pipeline)
         }
 
         for (int i = 0; i < VR_SHADER_STAGE_N_STAGES; i++) {
-                if (pipeline->modules[i] == VK_NULL_HANDLE)
-                        continue;
-                vkfn->vkDestroyShaderModule(window->device,
-                                            pipeline->modules[i],
-                                            NULL /* allocator */);
+                if (pipeline->module_entries[i]) {
+                        vr_object_cache_release(pipeline->object_cache,
+                                                pipeline->module_entries[i]);
+                }
         }
 
         vr_free(pipeline);
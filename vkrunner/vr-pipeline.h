@@ -30,17 +30,24 @@
 #include "vr-window.h"
 #include "vr-config.h"
 #include "vr-pipeline-key.h"
+#include "vr-object-cache.h"
 
 struct vr_pipeline {
         struct vr_window *window;
+        struct vr_object_cache *object_cache;
+        /* The layout and the descriptor set layouts are owned by
+         * this entry in the object cache.
+         */
+        struct vr_object_cache_entry *layout_entry;
         VkPipelineLayout layout;
         VkDescriptorPool descriptor_pool;
         VkDescriptorSetLayout *descriptor_set_layout;
         unsigned n_desc_sets;
         int n_pipelines;
         VkPipeline *pipelines;
-        VkPipelineCache pipeline_cache;
+        struct vr_object_cache_entry **pipeline_entries;
         VkShaderModule modules[VR_SHADER_STAGE_N_STAGES];
+        struct vr_object_cache_entry *module_entries[VR_SHADER_STAGE_N_STAGES];
         VkShaderStageFlagBits stages;
 };
 
@@ -51,6 +58,7 @@ struct vr_pipeline_vertex {
 struct vr_pipeline *
 vr_pipeline_create(const struct vr_config *config,
                    struct vr_window *window,
+                   struct vr_object_cache *object_cache,
                    const struct vr_script *script);
 
 void
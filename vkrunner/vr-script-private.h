@@ -65,6 +65,8 @@ struct vr_script_command {
                 struct {
                         float x, y, w, h;
                         unsigned pipeline_key;
+                        /* Offset of the vertices in the geometry */
+                        size_t vertex_offset;
                 } draw_rect;
 
                 struct {
@@ -148,6 +150,14 @@ struct vr_script {
         struct vr_vbo *vertex_data;
         uint16_t *indices;
         size_t n_indices;
+        /* The vertices of all of the draw rect commands, the vertex
+         * data and the indices packed together so that they can be
+         * uploaded to a single buffer.
+         */
+        uint8_t *geometry;
+        size_t geometry_size;
+        size_t vertex_data_offset;
+        size_t indices_offset;
         struct vr_script_buffer *buffers;
         size_t n_buffers;
 };
@@ -45,6 +45,7 @@
 #include "vr-tolerance.h"
 #include "vr-stream.h"
 #include "vr-char.h"
+#include "vr-pipeline.h"
 
 #define DEFAULT_TOLERANCE 0.01
 
@@ -71,6 +72,14 @@ enum parse_result {
         PARSE_RESULT_NON_MATCHED,
 };
 
+struct pipeline_key_slot {
+        uint64_t hash;
+        /* Index of the key in pipeline_keys plus one, or zero if the
+         * slot is empty.
+         */
+        unsigned key_num;
+};
+
 struct load_state {
         const struct vr_config *config;
         const struct vr_source *source;
@@ -84,6 +93,11 @@ struct load_state {
         enum section current_section;
         struct vr_buffer commands;
         struct vr_buffer pipeline_keys;
+        /* Open-addressing hash table to find the pipeline keys. The
+         * size is always a power of two.
+         */
+        struct pipeline_key_slot *pipeline_key_index;
+        unsigned pipeline_key_index_size;
         struct vr_buffer extensions;
         struct vr_buffer buffers;
         struct vr_pipeline_key current_key;
@@ -983,19 +997,82 @@ process_require_line(struct load_state *data)
         return false;
 }
 
+static struct pipeline_key_slot *
+find_pipeline_key_slot(struct pipeline_key_slot *index,
+                       unsigned index_size,
+                       const struct vr_pipeline_key *keys,
+                       uint64_t hash,
+                       const struct vr_pipeline_key *key)
+{
+        unsigned mask = index_size - 1;
+
+        for (unsigned pos = hash & mask; ; pos = (pos + 1) & mask) {
+                struct pipeline_key_slot *slot = index + pos;
+
+                if (slot->key_num == 0)
+                        return slot;
+
+                if (key &&
+                    slot->hash == hash &&
+                    vr_pipeline_key_equal(keys + slot->key_num - 1, key))
+                        return slot;
+        }
+}
+
+static void
+grow_pipeline_key_index(struct load_state *data)
+{
+        unsigned old_size = data->pipeline_key_index_size;
+        struct pipeline_key_slot *old_index = data->pipeline_key_index;
+        unsigned new_size = MAX(old_size * 2, 16);
+        struct pipeline_key_slot *new_index =
+                vr_calloc(sizeof *new_index * new_size);
+
+        for (unsigned i = 0; i < old_size; i++) {
+                if (old_index[i].key_num == 0)
+                        continue;
+
+                /* The keys are all different so there’s no need to
+                 * compare them.
+                 */
+                *find_pipeline_key_slot(new_index,
+                                        new_size,
+                                        NULL, /* keys */
+                                        old_index[i].hash,
+                                        NULL /* key */) = old_index[i];
+        }
+
+        vr_free(old_index);
+
+        data->pipeline_key_index = new_index;
+        data->pipeline_key_index_size = new_size;
+}
+
 static unsigned
 add_pipeline_key(struct load_state *data,
                  const struct vr_pipeline_key *key)
 {
         unsigned n_keys = (data->pipeline_keys.length /
                            sizeof (struct vr_pipeline_key));
-        const struct vr_pipeline_key *keys =
-                (const struct vr_pipeline_key *) data->pipeline_keys.data;
 
-        for (unsigned i = 0; i < n_keys; i++) {
-                if (vr_pipeline_key_equal(keys + i, key))
-                        return i;
-        }
+        /* Keep the table at most half full */
+        if ((n_keys + 1) * 2 > data->pipeline_key_index_size)
+                grow_pipeline_key_index(data);
+
+        uint64_t hash = vr_pipeline_key_hash(key);
+        struct pipeline_key_slot *slot =
+                find_pipeline_key_slot(data->pipeline_key_index,
+                                       data->pipeline_key_index_size,
+                                       (const struct vr_pipeline_key *)
+                                       data->pipeline_keys.data,
+                                       hash,
+                                       key);
+
+        if (slot->key_num != 0)
+                return slot->key_num - 1;
+
+        slot->hash = hash;
+        slot->key_num = n_keys + 1;
 
         vr_buffer_set_length(&data->pipeline_keys,
                              data->pipeline_keys.length + sizeof *key);
@@ -2425,6 +2502,69 @@ load_script_from_string(struct load_state *data,
         return res;
 }
 
+static void
+append_geometry(struct vr_buffer *buffer,
+                const void *data,
+                size_t size,
+                size_t *offset_out)
+{
+        /* Keep every part aligned enough for any vertex format */
+        size_t offset = vr_align(buffer->length, 16);
+
+        vr_buffer_set_length(buffer, offset);
+        vr_buffer_append(buffer, data, size);
+
+        *offset_out = offset;
+}
+
+static void
+build_geometry(struct vr_script *script)
+{
+        struct vr_buffer buffer = VR_BUFFER_STATIC_INIT;
+
+        for (size_t i = 0; i < script->n_commands; i++) {
+                struct vr_script_command *command = script->commands + i;
+
+                if (command->op != VR_SCRIPT_OP_DRAW_RECT)
+                        continue;
+
+                float x = command->draw_rect.x;
+                float y = command->draw_rect.y;
+                float w = command->draw_rect.w;
+                float h = command->draw_rect.h;
+                const struct vr_pipeline_vertex vertices[] = {
+                        { x, y, 0.0f },
+                        { x + w, y, 0.0f },
+                        { x, y + h, 0.0f },
+                        { x + w, y + h, 0.0f },
+                };
+
+                append_geometry(&buffer,
+                                vertices,
+                                sizeof vertices,
+                                &command->draw_rect.vertex_offset);
+        }
+
+        if (script->vertex_data) {
+                const struct vr_vbo *vbo = script->vertex_data;
+
+                append_geometry(&buffer,
+                                vbo->raw_data,
+                                vbo->stride * vbo->num_rows,
+                                &script->vertex_data_offset);
+        }
+
+        if (script->n_indices > 0) {
+                append_geometry(&buffer,
+                                script->indices,
+                                script->n_indices * sizeof script->indices[0],
+                                &script->indices_offset);
+        }
+
+        script->geometry = buffer.data;
+        script->geometry_size = buffer.length;
+}
+
 struct vr_script *
 vr_script_load(const struct vr_config *config,
                const struct vr_source *source)
@@ -2511,9 +2651,11 @@ vr_script_load(const struct vr_config *config,
 
         vr_buffer_destroy(&data.buffer);
         vr_buffer_destroy(&data.line);
+        vr_free(data.pipeline_key_index);
         vr_pipeline_key_destroy(&data.current_key);
 
         if (res) {
+                build_geometry(script);
                 return script;
         } else {
                 vr_script_free(script);
@@ -2549,6 +2691,8 @@ vr_script_free(struct vr_script *script)
         if (script->vertex_data)
                 vr_vbo_free(script->vertex_data);
 
+        vr_free(script->geometry);
+
         vr_free(script->indices);
 
         vr_free(script->filename);
@@ -2635,3 +2779,27 @@ vr_script_replace_shaders_stage_binary(struct vr_script *script,
                    source_length,
                    (const char *) source);
 }
+
+bool
+vr_script_requirements_equal(const struct vr_script *a,
+                             const struct vr_script *b)
+{
+        if (memcmp(&a->required_features,
+                   &b->required_features,
+                   sizeof a->required_features))
+                return false;
+
+        if (!vr_window_format_equal(&a->window_format, &b->window_format))
+                return false;
+
+        const char *const *ext_a, *const *ext_b;
+
+        for (ext_a = a->extensions, ext_b = b->extensions;
+             *ext_a && *ext_b;
+             ext_a++, ext_b++) {
+                if (strcmp(*ext_a, *ext_b))
+                        return false;
+        }
+
+        return *ext_a == NULL && *ext_b == NULL;
+}
@@ -28,6 +28,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <vkrunner/vr-shader-stage.h>
 #include <vkrunner/vr-config.h>
 #include <vkrunner/vr-source.h>
@@ -74,6 +75,14 @@ vr_script_replace_shaders_stage_binary(struct vr_script *script,
                                        size_t source_length,
                                        const uint32_t *source);
 
+/* Returns whether the two scripts need the same features, extensions
+ * and framebuffer format so that they can be run one after the other
+ * without recreating the device or the window.
+ */
+bool
+vr_script_requirements_equal(const struct vr_script *a,
+                             const struct vr_script *b);
+
 void
 vr_script_free(struct vr_script *script);
 
@@ -0,0 +1,382 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "vr-shader-cache.h"
+#include "vr-util.h"
+#include "vr-temp-file.h"
+#include "vr-thread.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+#define ENTRY_MAGIC "VRSC"
+#define ENTRY_VERSION 1
+
+struct vr_shader_cache {
+        char *dir;
+        /* Protects the stats when the stages are compiled on
+         * several threads
+         */
+        vr_mutex_t mutex;
+        unsigned hits;
+        unsigned misses;
+};
+
+struct entry_header {
+        char magic[4];
+        uint32_t version;
+        uint32_t compiled;
+        uint32_t key_size;
+        uint32_t data_size;
+};
+
+struct vr_shader_cache *
+vr_shader_cache_new(const char *dir)
+{
+        struct vr_shader_cache *cache = vr_calloc(sizeof *cache);
+
+        cache->dir = vr_strdup(dir);
+        vr_mutex_init(&cache->mutex);
+
+        /* Try to create the directory. If this fails then opening
+         * the files will also fail and the cache will just always
+         * miss.
+         */
+#ifdef WIN32
+        _mkdir(dir);
+#else
+        mkdir(dir, 0777);
+#endif
+
+        return cache;
+}
+
+void
+vr_shader_cache_free(struct vr_shader_cache *cache)
+{
+        vr_mutex_destroy(&cache->mutex);
+        vr_free(cache->dir);
+        vr_free(cache);
+}
+
+static bool
+find_binary(const char *binary,
+            struct vr_buffer *path_out,
+            struct stat *statbuf)
+{
+#ifdef WIN32
+        char path[MAX_PATH + 1];
+        DWORD len = SearchPathA(NULL, /* lpPath */
+                                binary,
+                                ".exe",
+                                sizeof path,
+                                path,
+                                NULL /* lpFilePart */);
+
+        if (len == 0 || len > MAX_PATH || stat(path, statbuf) == -1)
+                return false;
+
+        vr_buffer_append_string(path_out, path);
+
+        return true;
+#else
+        if (strchr(binary, '/')) {
+                if (stat(binary, statbuf) == -1)
+                        return false;
+                vr_buffer_append_string(path_out, binary);
+                return true;
+        }
+
+        const char *search_path = getenv("PATH");
+
+        if (search_path == NULL)
+                search_path = "/usr/bin:/bin";
+
+        while (true) {
+                const char *end = strchr(search_path, ':');
+                size_t dir_len = (end ?
+                                  (size_t) (end - search_path) :
+                                  strlen(search_path));
+
+                vr_buffer_set_length(path_out, 0);
+
+                /* An empty component means the current directory */
+                if (dir_len == 0)
+                        vr_buffer_append_c(path_out, '.');
+                else
+                        vr_buffer_append(path_out, search_path, dir_len);
+
+                vr_buffer_append_c(path_out, '/');
+                vr_buffer_append_string(path_out, binary);
+
+                if (stat((const char *) path_out->data, statbuf) == 0 &&
+                    S_ISREG(statbuf->st_mode) &&
+                    access((const char *) path_out->data, X_OK) == 0)
+                        return true;
+
+                if (end == NULL)
+                        break;
+
+                search_path = end + 1;
+        }
+
+        return false;
+#endif
+}
+
+bool
+vr_shader_cache_key_init(struct vr_shader_cache_key *key,
+                         const char *binary)
+{
+        struct vr_buffer path = VR_BUFFER_STATIC_INIT;
+        struct stat statbuf;
+
+        if (!find_binary(binary, &path, &statbuf)) {
+                vr_buffer_destroy(&path);
+                return false;
+        }
+
+        vr_buffer_init(&key->data);
+
+        vr_buffer_append(&key->data, path.data, path.length);
+        vr_buffer_append_c(&key->data, '\0');
+        vr_buffer_append_printf(&key->data,
+                                "%llu:%llu",
+                                (unsigned long long) statbuf.st_size,
+                                (unsigned long long) statbuf.st_mtime);
+        vr_buffer_append_c(&key->data, '\0');
+
+        vr_buffer_destroy(&path);
+
+        return true;
+}
+
+void
+vr_shader_cache_key_init_builtin(struct vr_shader_cache_key *key,
+                                 const char *version)
+{
+        vr_buffer_init(&key->data);
+
+        /* The path of an external binary will never be empty so
+         * this can’t be confused with the key for a binary.
+         */
+        vr_buffer_append_c(&key->data, '\0');
+        vr_buffer_append_string(&key->data, version);
+        vr_buffer_append_c(&key->data, '\0');
+}
+
+void
+vr_shader_cache_key_add(struct vr_shader_cache_key *key,
+                        const void *data,
+                        size_t size)
+{
+        /* Prefix the data with its size so that the boundaries
+         * between the parts can’t be ambiguous.
+         */
+        uint64_t size64 = size;
+
+        vr_buffer_append(&key->data, &size64, sizeof size64);
+        vr_buffer_append(&key->data, data, size);
+}
+
+void
+vr_shader_cache_key_add_string(struct vr_shader_cache_key *key,
+                               const char *str)
+{
+        vr_shader_cache_key_add(key, str, strlen(str));
+}
+
+void
+vr_shader_cache_key_destroy(struct vr_shader_cache_key *key)
+{
+        vr_buffer_destroy(&key->data);
+}
+
+static void
+get_entry_filename(const struct vr_shader_cache *cache,
+                   const struct vr_shader_cache_key *key,
+                   struct vr_buffer *filename)
+{
+        uint64_t hash = vr_hash_data(VR_HASH_INIT,
+                                     key->data.data,
+                                     key->data.length);
+
+        vr_buffer_append_printf(filename,
+                                "%s" VR_PATH_SEPARATOR "%08x%08x.spvc",
+                                cache->dir,
+                                (unsigned) (hash >> 32),
+                                (unsigned) hash);
+}
+
+static bool
+read_entry(FILE *file,
+           const struct vr_shader_cache_key *key,
+           bool *compiled_out,
+           struct vr_buffer *data_out)
+{
+        struct entry_header header;
+        bool ret = false;
+        uint8_t *key_data;
+
+        if (fread(&header, sizeof header, 1, file) != 1 ||
+            memcmp(header.magic, ENTRY_MAGIC, sizeof header.magic) ||
+            header.version != ENTRY_VERSION ||
+            header.key_size != key->data.length)
+                return false;
+
+        key_data = vr_alloc(header.key_size);
+
+        if (fread(key_data, 1, header.key_size, file) != header.key_size ||
+            memcmp(key_data, key->data.data, header.key_size))
+                goto out;
+
+        size_t old_length = data_out->length;
+
+        vr_buffer_ensure_size(data_out, old_length + header.data_size);
+
+        if (fread(data_out->data + old_length,
+                  1,
+                  header.data_size,
+                  file) != header.data_size)
+                goto out;
+
+        data_out->length = old_length + header.data_size;
+        *compiled_out = header.compiled;
+
+        ret = true;
+
+out:
+        vr_free(key_data);
+
+        return ret;
+}
+
+enum vr_shader_cache_result
+vr_shader_cache_lookup(struct vr_shader_cache *cache,
+                       const struct vr_shader_cache_key *key,
+                       struct vr_buffer *data_out)
+{
+        struct vr_buffer filename = VR_BUFFER_STATIC_INIT;
+        bool found = false;
+        bool compiled = false;
+
+        get_entry_filename(cache, key, &filename);
+
+        FILE *file = fopen((const char *) filename.data, "rb");
+
+        if (file) {
+                found = read_entry(file, key, &compiled, data_out);
+                fclose(file);
+        }
+
+        vr_buffer_destroy(&filename);
+
+        vr_mutex_lock(&cache->mutex);
+        if (found)
+                cache->hits++;
+        else
+                cache->misses++;
+        vr_mutex_unlock(&cache->mutex);
+
+        if (!found)
+                return VR_SHADER_CACHE_MISS;
+
+        return compiled ? VR_SHADER_CACHE_HIT : VR_SHADER_CACHE_HIT_FAILED;
+}
+
+void
+vr_shader_cache_store(struct vr_shader_cache *cache,
+                      const struct vr_shader_cache_key *key,
+                      bool compiled,
+                      const void *data,
+                      size_t size)
+{
+        struct vr_buffer filename = VR_BUFFER_STATIC_INIT;
+        struct vr_buffer temp_filename = VR_BUFFER_STATIC_INIT;
+        struct entry_header header = {
+                .magic = ENTRY_MAGIC,
+                .version = ENTRY_VERSION,
+                .compiled = compiled,
+                .key_size = key->data.length,
+                .data_size = size
+        };
+        bool ok;
+
+        get_entry_filename(cache, key, &filename);
+
+        /* The entry is written to a temporary file and then renamed
+         * so that a concurrent run never sees a partial entry.
+         * Failing to write the cache is not an error.
+         */
+        FILE *file =
+                vr_temp_file_open_replacement((const char *) filename.data,
+                                              &temp_filename);
+        if (file == NULL)
+                goto out;
+
+        ok = (fwrite(&header, sizeof header, 1, file) == 1 &&
+              fwrite(key->data.data, 1, key->data.length, file) ==
+              key->data.length &&
+              fwrite(data, 1, size, file) == size);
+
+        if (fclose(file) != 0)
+                ok = false;
+
+        if (ok) {
+                vr_temp_file_replace((const char *) temp_filename.data,
+                                     (const char *) filename.data);
+        } else {
+                remove((const char *) temp_filename.data);
+        }
+
+out:
+        vr_buffer_destroy(&temp_filename);
+        vr_buffer_destroy(&filename);
+}
+
+void
+vr_shader_cache_get_stats(const struct vr_shader_cache *cache,
+                          unsigned *hits_out,
+                          unsigned *misses_out)
+{
+        vr_mutex_t *mutex = (vr_mutex_t *) &cache->mutex;
+
+        vr_mutex_lock(mutex);
+        *hits_out = cache->hits;
+        *misses_out = cache->misses;
+        vr_mutex_unlock(mutex);
+}
@@ -0,0 +1,116 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VR_SHADER_CACHE_H
+#define VR_SHADER_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "vr-buffer.h"
+
+/* Persistent on-disk cache of the results of invoking the shader
+ * compiler. Each entry is stored in a separate file in the cache
+ * directory named after a hash of the key. The key contains the
+ * identity of the compiler binary, its arguments and the shader
+ * sources so any change in them causes a miss. The full key is
+ * stored in the file and compared on lookup so a hash collision
+ * can only cause a miss.
+ */
+
+struct vr_shader_cache;
+
+struct vr_shader_cache_key {
+        struct vr_buffer data;
+};
+
+enum vr_shader_cache_result {
+        VR_SHADER_CACHE_MISS,
+        /* The entry contains a SPIR-V binary */
+        VR_SHADER_CACHE_HIT,
+        /* The compilation failed and the entry contains the output
+         * of the compiler.
+         */
+        VR_SHADER_CACHE_HIT_FAILED
+};
+
+struct vr_shader_cache *
+vr_shader_cache_new(const char *dir);
+
+void
+vr_shader_cache_free(struct vr_shader_cache *cache);
+
+/* Starts a new key for the given compiler binary. The binary is
+ * looked up in the same way as the subprocess would and its
+ * modification time and size are added to the key. Returns false if
+ * the binary can’t be found in which case the result shouldn’t be
+ * cached.
+ */
+bool
+vr_shader_cache_key_init(struct vr_shader_cache_key *key,
+                         const char *binary);
+
+/* Starts a new key for a compiler that is linked into VkRunner.
+ * The version should be a string that changes whenever the output
+ * of the compiler might change.
+ */
+void
+vr_shader_cache_key_init_builtin(struct vr_shader_cache_key *key,
+                                 const char *version);
+
+void
+vr_shader_cache_key_add(struct vr_shader_cache_key *key,
+                        const void *data,
+                        size_t size);
+
+void
+vr_shader_cache_key_add_string(struct vr_shader_cache_key *key,
+                               const char *str);
+
+void
+vr_shader_cache_key_destroy(struct vr_shader_cache_key *key);
+
+/* Looks for an entry matching the key. If one is found its contents
+ * are appended to data_out.
+ */
+enum vr_shader_cache_result
+vr_shader_cache_lookup(struct vr_shader_cache *cache,
+                       const struct vr_shader_cache_key *key,
+                       struct vr_buffer *data_out);
+
+void
+vr_shader_cache_store(struct vr_shader_cache *cache,
+                      const struct vr_shader_cache_key *key,
+                      bool compiled,
+                      const void *data,
+                      size_t size);
+
+void
+vr_shader_cache_get_stats(const struct vr_shader_cache *cache,
+                          unsigned *hits_out,
+                          unsigned *misses_out);
+
+#endif /* VR_SHADER_CACHE_H */
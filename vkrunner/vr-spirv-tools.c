@@ -0,0 +1,184 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "vr-spirv-tools.h"
+#include "vr-util.h"
+
+#ifdef HAVE_SPIRV_TOOLS
+
+#include "vr-error-message.h"
+
+#include <string.h>
+#include <spirv-tools/libspirv.h>
+
+#define TARGET_ENV SPV_ENV_VULKAN_1_0
+
+static void
+report_lines(const struct vr_config *config,
+             const char *text,
+             size_t length,
+             struct vr_buffer *output)
+{
+        const char *end = text + length;
+
+        while (text < end) {
+                const char *eol = memchr(text, '\n', end - text);
+                size_t len = eol ? (size_t) (eol - text) : (size_t) (end - text);
+                char *line = vr_strndup(text, len);
+
+                vr_error_message_string(config, line);
+
+                if (output) {
+                        vr_buffer_append_string(output, line);
+                        vr_buffer_append_c(output, '\n');
+                }
+
+                vr_free(line);
+
+                if (eol == NULL)
+                        break;
+
+                text = eol + 1;
+        }
+}
+
+const char *
+vr_spirv_tools_get_version(void)
+{
+        return spvSoftwareVersionString();
+}
+
+bool
+vr_spirv_tools_assemble(const struct vr_config *config,
+                        const char *source,
+                        size_t length,
+                        struct vr_buffer *output,
+                        struct vr_buffer *binary)
+{
+        spv_context context = spvContextCreate(TARGET_ENV);
+        spv_binary module = NULL;
+        spv_diagnostic diagnostic = NULL;
+        spv_result_t res;
+
+        res = spvTextToBinary(context,
+                              source,
+                              length,
+                              &module,
+                              &diagnostic);
+
+        if (res == SPV_SUCCESS) {
+                vr_buffer_append(binary,
+                                 module->code,
+                                 module->wordCount * sizeof (uint32_t));
+        } else if (diagnostic) {
+                /* Use the same format as spirv-as */
+                struct vr_buffer message = VR_BUFFER_STATIC_INIT;
+
+                vr_buffer_append_printf(&message,
+                                        "error: %u: %u: %s",
+                                        (unsigned)
+                                        diagnostic->position.line + 1,
+                                        (unsigned)
+                                        diagnostic->position.column + 1,
+                                        diagnostic->error);
+                report_lines(config,
+                             (const char *) message.data,
+                             message.length,
+                             output);
+                vr_buffer_destroy(&message);
+        }
+
+        spvBinaryDestroy(module);
+        spvDiagnosticDestroy(diagnostic);
+        spvContextDestroy(context);
+
+        return res == SPV_SUCCESS;
+}
+
+bool
+vr_spirv_tools_disassemble(const struct vr_config *config,
+                           const void *binary,
+                           size_t size)
+{
+        spv_context context = spvContextCreate(TARGET_ENV);
+        spv_text text = NULL;
+        spv_diagnostic diagnostic = NULL;
+        spv_result_t res;
+
+        res = spvBinaryToText(context,
+                              binary,
+                              size / sizeof (uint32_t),
+                              /* Same as the defaults of spirv-dis */
+                              SPV_BINARY_TO_TEXT_OPTION_FRIENDLY_NAMES |
+                              SPV_BINARY_TO_TEXT_OPTION_INDENT |
+                              SPV_BINARY_TO_TEXT_OPTION_HEADER,
+                              &text,
+                              &diagnostic);
+
+        if (res == SPV_SUCCESS) {
+                report_lines(config, text->str, text->length, NULL);
+        } else if (diagnostic) {
+                vr_error_message(config,
+                                 "error: %u: %s",
+                                 (unsigned) diagnostic->position.index,
+                                 diagnostic->error);
+        }
+
+        spvTextDestroy(text);
+        spvDiagnosticDestroy(diagnostic);
+        spvContextDestroy(context);
+
+        return res == SPV_SUCCESS;
+}
+
+#else /* HAVE_SPIRV_TOOLS */
+
+const char *
+vr_spirv_tools_get_version(void)
+{
+        return NULL;
+}
+
+bool
+vr_spirv_tools_assemble(const struct vr_config *config,
+                        const char *source,
+                        size_t length,
+                        struct vr_buffer *output,
+                        struct vr_buffer *binary)
+{
+        vr_fatal("VkRunner was built without SPIRV-Tools");
+}
+
+bool
+vr_spirv_tools_disassemble(const struct vr_config *config,
+                           const void *binary,
+                           size_t size)
+{
+        vr_fatal("VkRunner was built without SPIRV-Tools");
+}
+
+#endif /* HAVE_SPIRV_TOOLS */
@@ -0,0 +1,60 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VR_SPIRV_TOOLS_H
+#define VR_SPIRV_TOOLS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vr-config.h"
+#include "vr-buffer.h"
+
+/* Returns a string identifying the version of SPIRV-Tools that was
+ * linked into VkRunner or NULL if it was built without it.
+ */
+const char *
+vr_spirv_tools_get_version(void);
+
+/* Assembles the SPIR-V source and appends the binary to binary. Any
+ * errors are reported and also appended to output if it is not
+ * NULL.
+ */
+bool
+vr_spirv_tools_assemble(const struct vr_config *config,
+                        const char *source,
+                        size_t length,
+                        struct vr_buffer *output,
+                        struct vr_buffer *binary);
+
+/* Reports the disassembly of the binary in the same way as the
+ * output of spirv-dis would be.
+ */
+bool
+vr_spirv_tools_disassemble(const struct vr_config *config,
+                           const void *binary,
+                           size_t size);
+
+#endif /* VR_SPIRV_TOOLS_H */
@@ -26,6 +26,9 @@
 #include "vr-error-message.h"
 #include "vr-buffer.h"
 #include "vr-char.h"
+#include "vr-list.h"
+#include "vr-thread.h"
+#include "vr-util.h"
 
 #include <stdio.h>
 #include <errno.h>
@@ -33,7 +36,8 @@
 
 static void
 print_lines_in_buffer(const struct vr_config *config,
-                      struct vr_buffer *buf)
+                      struct vr_buffer *buf,
+                      struct vr_buffer *output)
 {
         uint8_t *p = buf->data;
 
@@ -50,6 +54,11 @@ print_lines_in_buffer(const struct vr_config *config,
 
                 vr_error_message_string(config, (const char *) p);
 
+                if (output) {
+                        vr_buffer_append_string(output, (const char *) p);
+                        vr_buffer_append_c(output, '\n');
+                }
+
                 p = end + 1;
         }
 
@@ -60,13 +69,19 @@ print_lines_in_buffer(const struct vr_config *config,
 
 static void
 print_remaining_output(const struct vr_config *config,
-                       struct vr_buffer *buf)
+                       struct vr_buffer *buf,
+                       struct vr_buffer *output)
 {
         if (buf->length <= 0)
                 return;
 
         vr_buffer_append_c(buf, '\0');
         vr_error_message_string(config, (const char *) buf->data);
+
+        if (output) {
+                vr_buffer_append_string(output, (const char *) buf->data);
+                vr_buffer_append_c(output, '\n');
+        }
 }
 
 #ifdef WIN32
@@ -178,7 +193,8 @@ error:
 
 static bool
 process_output(const struct vr_config *config,
-               HANDLE pipe_fd)
+               HANDLE pipe_fd,
+               struct vr_buffer *output)
 {
         struct vr_buffer buf = VR_BUFFER_STATIC_INIT;
         bool ret = true;
@@ -205,22 +221,23 @@ process_output(const struct vr_config *config,
 
                 buf.length += got;
 
-                print_lines_in_buffer(config, &buf);
+                print_lines_in_buffer(config, &buf, output);
         }
 
-        print_remaining_output(config, &buf);
+        print_remaining_output(config, &buf, output);
 
         vr_buffer_destroy(&buf);
 
         return ret;
 }
 
-bool
-vr_subprocess_command(const struct vr_config *config,
-                      char * const *arguments)
+enum vr_subprocess_result
+vr_subprocess_command_capture(const struct vr_config *config,
+                              char * const *arguments,
+                              struct vr_buffer *output)
 {
         BOOL res;
-        bool result = true;
+        enum vr_subprocess_result result = VR_SUBPROCESS_RESULT_OK;
 
         HANDLE stdin_fd, stdout_fd, stderr_fd, output_fd;
 
@@ -229,7 +246,7 @@ vr_subprocess_command(const struct vr_config *config,
                           &stdout_fd,
                           &stderr_fd,
                           &output_fd))
-                return false;
+                return VR_SUBPROCESS_RESULT_ERROR;
 
         struct vr_buffer buffer = VR_BUFFER_STATIC_INIT;
 
@@ -278,19 +295,20 @@ vr_subprocess_command(const struct vr_config *config,
                 vr_error_message(config,
                                  "%s: CreateProcess failed",
                                  arguments[0]);
-                result = false;
+                result = VR_SUBPROCESS_RESULT_ERROR;
                 goto out_pipes;
         }
 
-        if (!process_output(config, output_fd))
-                result = false;
+        bool output_ok = process_output(config, output_fd, output);
 
         DWORD exit_code;
         if (WaitForSingleObject(process_info.hProcess,
                                 INFINITE) != WAIT_OBJECT_0 ||
             !GetExitCodeProcess(process_info.hProcess, &exit_code) ||
-            exit_code != 0)
-                result = false;
+            !output_ok)
+                result = VR_SUBPROCESS_RESULT_ERROR;
+        else if (exit_code != 0)
+                result = VR_SUBPROCESS_RESULT_FAILED;
 
         CloseHandle(process_info.hProcess);
         CloseHandle(process_info.hThread);
@@ -301,18 +319,47 @@ out_pipes:
         return result;
 }
 
+struct vr_subprocess_pool *
+vr_subprocess_pool_new(const char *command)
+{
+        return NULL;
+}
+
+void
+vr_subprocess_pool_free(struct vr_subprocess_pool *pool)
+{
+}
+
+const char *
+vr_subprocess_pool_get_command(const struct vr_subprocess_pool *pool)
+{
+        return NULL;
+}
+
+bool
+vr_subprocess_pool_request(const struct vr_config *config,
+                           struct vr_subprocess_pool *pool,
+                           const void *request,
+                           size_t request_size,
+                           struct vr_buffer *reply)
+{
+        vr_fatal("Worker pools are not supported on Windows");
+}
+
 #else /* WIN32 */
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
 #include <poll.h>
 #include <limits.h>
 
 static bool
 process_output(const struct vr_config *config,
                int *pipe_fd,
-               struct vr_buffer *buf)
+               struct vr_buffer *buf,
+               struct vr_buffer *output)
 {
         int res;
 
@@ -340,7 +387,7 @@ process_output(const struct vr_config *config,
 
         buf->length += res;
 
-        print_lines_in_buffer(config, buf);
+        print_lines_in_buffer(config, buf, output);
 
         return true;
 }
@@ -348,7 +395,8 @@ process_output(const struct vr_config *config,
 static bool
 stream_data(const struct vr_config *config,
             int stdout_pipe,
-            int stderr_pipe)
+            int stderr_pipe,
+            struct vr_buffer *output)
 {
         struct vr_buffer stdout_buf = VR_BUFFER_STATIC_INIT;
         struct vr_buffer stderr_buf = VR_BUFFER_STATIC_INIT;
@@ -392,14 +440,16 @@ stream_data(const struct vr_config *config,
                         if (pollfds[i].fd == stdout_pipe) {
                                 if (!process_output(config,
                                                     &stdout_pipe,
-                                                    &stdout_buf)) {
+                                                    &stdout_buf,
+                                                    output)) {
                                         ret = false;
                                         goto done;
                                 }
                         } else if (pollfds[i].fd == stderr_pipe) {
                                 if (!process_output(config,
                                                     &stderr_pipe,
-                                                    &stderr_buf)) {
+                                                    &stderr_buf,
+                                                    output)) {
                                         ret = false;
                                         goto done;
                                 }
@@ -408,8 +458,8 @@ stream_data(const struct vr_config *config,
         }
 
 done:
-        print_remaining_output(config, &stdout_buf);
-        print_remaining_output(config, &stderr_buf);
+        print_remaining_output(config, &stdout_buf, output);
+        print_remaining_output(config, &stderr_buf, output);
 
         vr_buffer_destroy(&stdout_buf);
         vr_buffer_destroy(&stderr_buf);
@@ -417,9 +467,10 @@ done:
         return ret;
 }
 
-bool
-vr_subprocess_command(const struct vr_config *config,
-                      char * const *arguments)
+enum vr_subprocess_result
+vr_subprocess_command_capture(const struct vr_config *config,
+                              char * const *arguments,
+                              struct vr_buffer *output)
 {
         pid_t pid;
         int stdout_pipe[2];
@@ -427,13 +478,13 @@ vr_subprocess_command(const struct vr_config *config,
 
         if (pipe(stdout_pipe) == -1) {
                 vr_error_message(config, "pipe: %s\n", strerror(errno));
-                return false;
+                return VR_SUBPROCESS_RESULT_ERROR;
         }
         if (pipe(stderr_pipe) == -1) {
                 vr_error_message(config, "pipe: %s\n", strerror(errno));
                 close(stdout_pipe[0]);
                 close(stdout_pipe[1]);
-                return false;
+                return VR_SUBPROCESS_RESULT_ERROR;
         }
 
         pid = fork();
@@ -442,7 +493,7 @@ vr_subprocess_command(const struct vr_config *config,
                 vr_error_message(config,
                                  "fork failed: %s\n",
                                  strerror(errno));
-                return false;
+                return VR_SUBPROCESS_RESULT_ERROR;
         } else if (pid == 0) {
                 dup2(stdout_pipe[1], STDOUT_FILENO);
                 dup2(stderr_pipe[1], STDERR_FILENO);
@@ -450,7 +501,10 @@ vr_subprocess_command(const struct vr_config *config,
                         close(i);
                 execvp(arguments[0], arguments);
                 fprintf(stderr, "%s: %s\n", arguments[0], strerror(errno));
-                exit(EXIT_FAILURE);
+                /* Same status as the shell uses when a command can’t
+                 * be found
+                 */
+                exit(127);
         } else {
                 close(stdout_pipe[1]);
                 close(stderr_pipe[1]);
@@ -458,18 +512,264 @@ vr_subprocess_command(const struct vr_config *config,
                 int status;
                 bool ret = stream_data(config,
                                        stdout_pipe[0],
-                                       stderr_pipe[0]);
+                                       stderr_pipe[0],
+                                       output);
 
                 close(stdout_pipe[0]);
                 close(stderr_pipe[0]);
 
                 while (waitpid(pid, &status, 0 /* options */) == -1);
 
-                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
-                        ret = false;
+                if (WIFSIGNALED(status)) {
+                        vr_error_message(config,
+                                         "%s: killed by signal %i",
+                                         arguments[0],
+                                         WTERMSIG(status));
+                }
+
+                if (!ret ||
+                    !WIFEXITED(status) ||
+                    WEXITSTATUS(status) == 127)
+                        return VR_SUBPROCESS_RESULT_ERROR;
+
+                if (WEXITSTATUS(status) != 0)
+                        return VR_SUBPROCESS_RESULT_FAILED;
+
+                return VR_SUBPROCESS_RESULT_OK;
+        }
+}
+
+
+struct worker {
+        struct vr_list link;
+        pid_t pid;
+        /* Socket connected to both stdin and stdout of the worker */
+        int fd;
+};
+
+struct vr_subprocess_pool {
+        char *command;
+        vr_mutex_t mutex;
+        struct vr_list idle_workers;
+};
+
+bool
+vr_subprocess_write_message(int fd,
+                            const void *data,
+                            size_t size)
+{
+        uint32_t size32 = size;
+        const uint8_t *parts[] = { (const uint8_t *) &size32, data };
+        size_t part_sizes[] = { sizeof size32, size };
+
+        for (int i = 0; i < VR_N_ELEMENTS(parts); i++) {
+                const uint8_t *p = parts[i];
+                size_t remaining = part_sizes[i];
+
+                while (remaining > 0) {
+#ifdef MSG_NOSIGNAL
+                        /* Don’t get killed with SIGPIPE if the other
+                         * end has died.
+                         */
+                        ssize_t wrote = send(fd, p, remaining, MSG_NOSIGNAL);
+
+                        if (wrote == -1 && errno == ENOTSOCK)
+                                wrote = write(fd, p, remaining);
+#else
+                        ssize_t wrote = write(fd, p, remaining);
+#endif
+
+                        if (wrote == -1) {
+                                if (errno == EINTR)
+                                        continue;
+                                return false;
+                        }
+
+                        p += wrote;
+                        remaining -= wrote;
+                }
+        }
+
+        return true;
+}
+
+static bool
+read_all(int fd,
+         void *data,
+         size_t size)
+{
+        uint8_t *p = data;
+
+        while (size > 0) {
+                ssize_t got = read(fd, p, size);
 
-                return ret;
+                if (got == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        return false;
+                }
+
+                if (got == 0)
+                        return false;
+
+                p += got;
+                size -= got;
         }
+
+        return true;
+}
+
+bool
+vr_subprocess_read_message(int fd,
+                           struct vr_buffer *message)
+{
+        uint32_t size;
+
+        if (!read_all(fd, &size, sizeof size))
+                return false;
+
+        size_t old_length = message->length;
+
+        vr_buffer_ensure_size(message, old_length + size);
+
+        if (!read_all(fd, message->data + old_length, size))
+                return false;
+
+        message->length = old_length + size;
+
+        return true;
+}
+
+struct vr_subprocess_pool *
+vr_subprocess_pool_new(const char *command)
+{
+        struct vr_subprocess_pool *pool = vr_calloc(sizeof *pool);
+
+        pool->command = vr_strdup(command);
+        vr_mutex_init(&pool->mutex);
+        vr_list_init(&pool->idle_workers);
+
+        return pool;
+}
+
+static void
+free_worker(struct worker *worker)
+{
+        /* Closing the socket tells the worker to quit */
+        close(worker->fd);
+        while (waitpid(worker->pid, NULL, 0 /* options */) == -1 &&
+               errno == EINTR);
+        vr_free(worker);
+}
+
+void
+vr_subprocess_pool_free(struct vr_subprocess_pool *pool)
+{
+        struct worker *worker, *tmp;
+
+        vr_list_for_each_safe(worker, tmp, &pool->idle_workers, link)
+                free_worker(worker);
+
+        vr_mutex_destroy(&pool->mutex);
+        vr_free(pool->command);
+        vr_free(pool);
+}
+
+const char *
+vr_subprocess_pool_get_command(const struct vr_subprocess_pool *pool)
+{
+        return pool->command;
+}
+
+static struct worker *
+start_worker(const struct vr_config *config,
+             const char *command)
+{
+        int sv[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+                vr_error_message(config, "socketpair: %s", strerror(errno));
+                return NULL;
+        }
+
+        pid_t pid = fork();
+
+        if (pid < 0) {
+                vr_error_message(config, "fork failed: %s", strerror(errno));
+                close(sv[0]);
+                close(sv[1]);
+                return NULL;
+        } else if (pid == 0) {
+                dup2(sv[1], STDIN_FILENO);
+                dup2(sv[1], STDOUT_FILENO);
+                for (int i = 3; i < 256; i++)
+                        close(i);
+                char *args[] = { (char *) command, NULL };
+                execvp(args[0], args);
+                fprintf(stderr, "%s: %s\n", args[0], strerror(errno));
+                exit(EXIT_FAILURE);
+        }
+
+        close(sv[1]);
+
+        struct worker *worker = vr_alloc(sizeof *worker);
+
+        worker->pid = pid;
+        worker->fd = sv[0];
+
+        return worker;
+}
+
+bool
+vr_subprocess_pool_request(const struct vr_config *config,
+                           struct vr_subprocess_pool *pool,
+                           const void *request,
+                           size_t request_size,
+                           struct vr_buffer *reply)
+{
+        struct worker *worker = NULL;
+
+        vr_mutex_lock(&pool->mutex);
+
+        if (!vr_list_empty(&pool->idle_workers)) {
+                worker = vr_container_of(pool->idle_workers.next,
+                                         struct worker,
+                                         link);
+                vr_list_remove(&worker->link);
+        }
+
+        vr_mutex_unlock(&pool->mutex);
+
+        if (worker == NULL) {
+                worker = start_worker(config, pool->command);
+                if (worker == NULL)
+                        return false;
+        }
+
+        if (!vr_subprocess_write_message(worker->fd, request, request_size) ||
+            !vr_subprocess_read_message(worker->fd, reply)) {
+                vr_error_message(config,
+                                 "%s: worker process died",
+                                 pool->command);
+                free_worker(worker);
+                return false;
+        }
+
+        vr_mutex_lock(&pool->mutex);
+        vr_list_insert(&pool->idle_workers, &worker->link);
+        vr_mutex_unlock(&pool->mutex);
+
+        return true;
 }
 
 #endif /* WIN32 */
+
+bool
+vr_subprocess_command(const struct vr_config *config,
+                      char * const *arguments)
+{
+        return (vr_subprocess_command_capture(config,
+                                              arguments,
+                                              NULL /* output */) ==
+                VR_SUBPROCESS_RESULT_OK);
+}
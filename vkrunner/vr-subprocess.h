@@ -28,9 +28,75 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include "vr-config.h"
+#include "vr-buffer.h"
+
+enum vr_subprocess_result {
+        VR_SUBPROCESS_RESULT_OK,
+        /* The command ran and exited with a non-zero status */
+        VR_SUBPROCESS_RESULT_FAILED,
+        /* The command couldn’t be run, it was killed or its output
+         * couldn’t be read
+         */
+        VR_SUBPROCESS_RESULT_ERROR
+};
 
 bool
 vr_subprocess_command(const struct vr_config *config,
                       char * const *arguments);
 
+/* Same as vr_subprocess_command except that the output of the
+ * command is also appended to the output buffer and the result tells
+ * whether the command itself failed.
+ */
+enum vr_subprocess_result
+vr_subprocess_command_capture(const struct vr_config *config,
+                              char * const *arguments,
+                              struct vr_buffer *output);
+
+/* A pool of long-running worker processes. Each worker is started
+ * with the command and then reads requests on its stdin and writes
+ * a reply for each on its stdout. Every message is framed as a
+ * native-endian uint32_t length followed by that many bytes. A new
+ * worker is started whenever a request is made and all of the
+ * existing ones are busy. The pool can be used from multiple
+ * threads.
+ */
+struct vr_subprocess_pool;
+
+/* Returns NULL if worker pools aren’t supported on this platform */
+struct vr_subprocess_pool *
+vr_subprocess_pool_new(const char *command);
+
+void
+vr_subprocess_pool_free(struct vr_subprocess_pool *pool);
+
+const char *
+vr_subprocess_pool_get_command(const struct vr_subprocess_pool *pool);
+
+/* Sends the request to an idle worker and waits for the reply which
+ * is appended to reply. If the worker can’t be started or it dies
+ * then an error is reported and false is returned.
+ */
+bool
+vr_subprocess_pool_request(const struct vr_config *config,
+                           struct vr_subprocess_pool *pool,
+                           const void *request,
+                           size_t request_size,
+                           struct vr_buffer *reply);
+
+#ifndef WIN32
+
+/* Helpers to implement the worker side of the protocol */
+
+bool
+vr_subprocess_read_message(int fd,
+                           struct vr_buffer *message);
+
+bool
+vr_subprocess_write_message(int fd,
+                            const void *data,
+                            size_t size);
+
+#endif /* WIN32 */
+
 #endif /* __VR_SUBPROCESS_H__ */
@@ -25,6 +25,10 @@
 
 #include "config.h"
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "vr-temp-file.h"
 #include "vr-util.h"
 #include "vr-buffer.h"
@@ -33,6 +37,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifdef WIN32
 #include <windows.h>
@@ -41,6 +47,50 @@
 #include <unistd.h>
 #endif
 
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+
+/* The path used to refer to an anonymous memory file. This uses the
+ * pid rather than “self” so that the path still works when passed to
+ * a child process. The file descriptor is close-on-exec so it isn’t
+ * leaked into other processes.
+ */
+#define MEMFD_PATH_PREFIX "/proc/"
+
+static bool
+create_memfd(FILE **stream_out,
+             char **filename_out)
+{
+        int fd = memfd_create("vkrunner", MFD_CLOEXEC);
+
+        if (fd == -1)
+                return false;
+
+        struct vr_buffer filename = VR_BUFFER_STATIC_INIT;
+
+        vr_buffer_append_printf(&filename,
+                                MEMFD_PATH_PREFIX "%i/fd/%i",
+                                (int) getpid(),
+                                fd);
+
+        /* Fall back to a real file if /proc isn’t available */
+        FILE *stream = access((char *) filename.data, R_OK | W_OK) == 0 ?
+                fdopen(fd, "r+") :
+                NULL;
+
+        if (stream == NULL) {
+                vr_buffer_destroy(&filename);
+                close(fd);
+                return false;
+        }
+
+        *filename_out = (char *) filename.data;
+        *stream_out = stream;
+
+        return true;
+}
+#endif /* HAVE_MEMFD_CREATE */
+
 bool
 vr_temp_file_create_named(const struct vr_config *config,
                           FILE **stream_out,
@@ -79,6 +129,12 @@ vr_temp_file_create_named(const struct vr_config *config,
 
 #else
 
+#ifdef HAVE_MEMFD_CREATE
+        /* Avoid touching the disk where possible */
+        if (create_memfd(stream_out, filename_out))
+                return true;
+#endif
+
         struct vr_buffer filename = VR_BUFFER_STATIC_INIT;
 
         const char *dir = getenv("TMPDIR");
@@ -116,3 +172,77 @@ vr_temp_file_create_named(const struct vr_config *config,
 
         return true;
 }
+
+void
+vr_temp_file_remove(const char *filename)
+{
+#ifdef HAVE_MEMFD_CREATE
+        /* Anonymous files disappear when the stream is closed */
+        if (!strncmp(filename,
+                     MEMFD_PATH_PREFIX,
+                     sizeof MEMFD_PATH_PREFIX - 1))
+                return;
+#endif
+
+        unlink(filename);
+}
+
+FILE *
+vr_temp_file_open_replacement(const char *filename,
+                              struct vr_buffer *temp_filename)
+{
+        vr_buffer_append_string(temp_filename, filename);
+
+#ifdef WIN32
+        /* The thread is included so that threads in the same
+         * process don’t use the same name.
+         */
+        vr_buffer_append_printf(temp_filename,
+                                ".%lu.%lu",
+                                (unsigned long) GetCurrentProcessId(),
+                                (unsigned long) GetCurrentThreadId());
+        return fopen((const char *) temp_filename->data, "wb");
+#else
+        vr_buffer_append_string(temp_filename, ".XXXXXX");
+
+        int fd = mkstemp((char *) temp_filename->data);
+
+        if (fd == -1)
+                return NULL;
+
+        /* mkstemp always uses 0600 but the replacement should have
+         * the same permissions as a normally created file.
+         */
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0666 & ~mask);
+
+        FILE *file = fdopen(fd, "wb");
+
+        if (file == NULL) {
+                int fdopen_errno = errno;
+                close(fd);
+                unlink((const char *) temp_filename->data);
+                errno = fdopen_errno;
+        }
+
+        return file;
+#endif
+}
+
+bool
+vr_temp_file_replace(const char *temp_filename,
+                     const char *filename)
+{
+#ifdef WIN32
+        if (MoveFileExA(temp_filename, filename, MOVEFILE_REPLACE_EXISTING))
+                return true;
+#else
+        if (rename(temp_filename, filename) == 0)
+                return true;
+#endif
+
+        remove(temp_filename);
+
+        return false;
+}
@@ -29,10 +29,41 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "vr-config.h"
+#include "vr-buffer.h"
 
+/* Creates a temporary file that can be passed by name to another
+ * process. On Linux this is an anonymous memory file referred to via
+ * /proc so it only exists as long as the stream is open. Otherwise
+ * it is a real file in the temporary directory. Either way the
+ * stream must be kept open until the other process has finished with
+ * the file.
+ */
 bool
 vr_temp_file_create_named(const struct vr_config *config,
                           FILE **stream_out,
                           char **filename_out);
 
+/* Removes a file created with vr_temp_file_create_named. This should
+ * be used instead of unlink because anonymous files have no name to
+ * remove.
+ */
+void
+vr_temp_file_remove(const char *filename);
+
+/* Opens a new file in the same directory as filename in which to
+ * write a replacement for it. The name of the new file is appended
+ * to temp_filename. Returns NULL on failure with errno set.
+ */
+FILE *
+vr_temp_file_open_replacement(const char *filename,
+                              struct vr_buffer *temp_filename);
+
+/* Renames a closed file created with vr_temp_file_open_replacement
+ * over the original file so that other processes never see a
+ * partially written file. If it fails the temporary file is removed.
+ */
+bool
+vr_temp_file_replace(const char *temp_filename,
+                     const char *filename);
+
 #endif /* VR_TEMP_FILE_H */
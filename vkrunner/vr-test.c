@@ -43,15 +43,27 @@
 #include <inttypes.h>
 #include <limits.h>
 
+/* Minimum size of the buffer that the probes copy their data into */
+#define READBACK_BUFFER_SIZE (1024 * 1024)
+
 struct test_buffer {
         struct vr_list link;
         VkBuffer buffer;
-        VkDeviceMemory memory;
+        struct vr_allocate_store_allocation allocation;
         void *memory_map;
-        int memory_type_index;
         size_t size;
 };
 
+/* A probe whose data has been copied into the readback buffer by the
+ * command buffer but that hasn’t been checked yet.
+ */
+struct pending_probe {
+        const struct vr_script_command *command;
+        size_t offset;
+        /* Distance between rows for a probe rect */
+        size_t stride;
+};
+
 enum test_state {
         /* Any rendering or computing has finished and we can read the
          * buffers. */
@@ -68,13 +80,40 @@ struct test_data {
         struct vr_list buffers;
         struct test_buffer **ubo_buffers;
         const struct vr_script *script;
-        struct test_buffer *vbo_buffer;
-        struct test_buffer *index_buffer;
+        /* Buffer containing the script’s geometry. This comes from
+         * the object cache so it can be reused by later runs of the
+         * same script.
+         */
+        struct vr_object_cache_entry *geometry;
         bool ubo_descriptor_set_bound;
         VkDescriptorSet *ubo_descriptor_set;
         unsigned bound_pipeline;
         enum test_state test_state;
         bool first_render;
+        /* The probes copy the data that they need into this buffer so
+         * that they can all be checked after a single submission.
+         */
+        struct test_buffer *readback_buffer;
+        size_t readback_offset;
+        /* Array of struct pending_probe */
+        struct vr_buffer pending_probes;
+        bool probe_failed;
+        /* Region of the framebuffer that has been copied into the
+         * readback buffer since it was last rendered to. This is the
+         * union of the rectangles of a run of consecutive probes so
+         * that they only need one copy.
+         */
+        struct {
+                bool valid;
+                int x, y, w, h;
+                size_t offset;
+        } framebuffer_copy;
+        /* Index of the command being run */
+        int command_index;
+        /* Index of the last command that renders to the framebuffer
+         * or -1 if there isn't one.
+         */
+        int last_framebuffer_write;
 };
 
 static struct test_buffer *
@@ -106,31 +145,18 @@ allocate_test_buffer(struct test_data *data,
                 return NULL;
         }
 
-        res = vr_allocate_store_buffer(data->window->context,
-                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                                       1, /* n_buffers */
-                                       &buffer->buffer,
-                                       &buffer->memory,
-                                       &buffer->memory_type_index,
-                                       NULL /* offsets */);
+        res = vr_allocate_store_arena_buffer(
+                data->window->context->arena,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                buffer->buffer,
+                &buffer->allocation);
         if (res != VK_SUCCESS) {
-                buffer->memory = VK_NULL_HANDLE;
                 vr_error_message(data->window->config,
                                  "Error allocating memory");
                 return NULL;
         }
 
-        res = vkfn->vkMapMemory(data->window->device,
-                                buffer->memory,
-                                0, /* offset */
-                                VK_WHOLE_SIZE,
-                                0, /* flags */
-                                &buffer->memory_map);
-        if (res != VK_SUCCESS) {
-                buffer->memory_map = NULL;
-                vr_error_message(data->window->config, "Error mapping memory");
-                return NULL;
-        }
+        buffer->memory_map = buffer->allocation.memory_map;
 
         return buffer;
 }
@@ -142,25 +168,62 @@ free_test_buffer(struct test_data *data,
         struct vr_window *window = data->window;
         struct vr_vk *vkfn = &window->vkfn;
 
-        if (buffer->memory_map) {
-                vkfn->vkUnmapMemory(window->device,
-                                    buffer->memory);
-        }
-        if (buffer->memory) {
-                vkfn->vkFreeMemory(window->device,
-                                   buffer->memory,
-                                   NULL /* allocator */);
-        }
         if (buffer->buffer) {
                 vkfn->vkDestroyBuffer(window->device,
                                       buffer->buffer,
                                       NULL /* allocator */);
         }
+        if (buffer->allocation.block) {
+                vr_allocate_store_arena_release(window->context->arena,
+                                                &buffer->allocation);
+        }
 
         vr_list_remove(&buffer->link);
         vr_free(buffer);
 }
 
+static bool
+check_pending_probe(struct test_data *data,
+                    const struct pending_probe *probe,
+                    const uint8_t *observed);
+
+static void
+flush_test_buffer(struct test_data *data,
+                  const struct test_buffer *buffer)
+{
+        vr_flush_memory(data->window->context,
+                        buffer->allocation.memory_type_index,
+                        buffer->allocation.memory,
+                        buffer->allocation.offset,
+                        buffer->allocation.size);
+}
+
+static void
+add_memory_barrier(struct test_data *data,
+                   VkPipelineStageFlags src_stage,
+                   VkAccessFlags src_access,
+                   VkPipelineStageFlags dst_stage,
+                   VkAccessFlags dst_access)
+{
+        struct vr_vk *vkfn = &data->window->vkfn;
+
+        VkMemoryBarrier barrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = src_access,
+                .dstAccessMask = dst_access
+        };
+        vkfn->vkCmdPipelineBarrier(data->window->context->command_buffer,
+                                   src_stage,
+                                   dst_stage,
+                                   0, /* dependencyFlags */
+                                   1, /* memoryBarrierCount */
+                                   &barrier,
+                                   0, /* bufferMemoryBarrierCount */
+                                   NULL, /* pBufferMemoryBarriers */
+                                   0, /* imageMemoryBarrierCount */
+                                   NULL /* pImageMemoryBarriers */);
+}
+
 static bool
 begin_command_buffer(struct test_data *data)
 {
@@ -185,36 +248,70 @@ begin_command_buffer(struct test_data *data)
 }
 
 static void
-invalidate_ssbos(struct test_data *data)
+invalidate_test_buffer(struct test_data *data,
+                       const struct test_buffer *buffer)
 {
         struct vr_vk *vkfn = &data->window->vkfn;
+        const VkMemoryType *memory_type =
+                (data->window->context->memory_properties.memoryTypes +
+                 buffer->allocation.memory_type_index);
+
+        /* We don’t need to do anything if the memory is already
+         * coherent */
+        if ((memory_type->propertyFlags &
+             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+                return;
+
+        VkMappedMemoryRange memory_range = {
+                .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                .memory = buffer->allocation.memory,
+                .offset = buffer->allocation.offset,
+                .size = buffer->allocation.size
+        };
+        vkfn->vkInvalidateMappedMemoryRanges(data->window->device,
+                                             1, /* memoryRangeCount */
+                                             &memory_range);
+}
 
+static void
+invalidate_ssbos(struct test_data *data)
+{
         for (unsigned i = 0; i < data->script->n_buffers; i++) {
                 if (data->script->buffers[i].type != VR_SCRIPT_BUFFER_TYPE_SSBO)
                         continue;
 
-                const struct test_buffer *buffer = data->ubo_buffers[i];
+                invalidate_test_buffer(data, data->ubo_buffers[i]);
+        }
+}
 
-                const VkMemoryType *memory_type =
-                        (data->window->context->memory_properties.memoryTypes +
-                         buffer->memory_type_index);
+/* Checks all of the probes that were waiting for the command buffer
+ * to finish.
+ */
+static void
+check_pending_probes(struct test_data *data)
+{
+        const struct pending_probe *probes =
+                (const struct pending_probe *) data->pending_probes.data;
+        size_t n_probes = (data->pending_probes.length /
+                           sizeof (struct pending_probe));
 
-                /* We don’t need to do anything if the memory is
-                 * already coherent */
-                if ((memory_type->propertyFlags &
-                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
-                        continue;
+        if (n_probes == 0)
+                return;
 
-                VkMappedMemoryRange memory_range = {
-                        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-                        .memory = data->ubo_buffers[i]->memory,
-                        .offset = 0,
-                        .size = VK_WHOLE_SIZE
-                };
-                vkfn->vkInvalidateMappedMemoryRanges(data->window->device,
-                                                     1, /* memoryRangeCount */
-                                                     &memory_range);
+        invalidate_test_buffer(data, data->readback_buffer);
+
+        for (size_t i = 0; i < n_probes; i++) {
+                const uint8_t *observed =
+                        ((const uint8_t *) data->readback_buffer->memory_map +
+                         probes[i].offset);
+
+                if (!check_pending_probe(data, probes + i, observed))
+                        data->probe_failed = true;
         }
+
+        vr_buffer_set_length(&data->pending_probes, 0);
+        data->readback_offset = 0;
+        data->framebuffer_copy.valid = false;
 }
 
 static bool
@@ -225,6 +322,15 @@ end_command_buffer(struct test_data *data)
         struct vr_context *context = window->context;
         struct vr_vk *vkfn = &context->vkfn;
 
+        if (data->pending_probes.length > 0) {
+                /* Make the copies for the probes visible to the host */
+                add_memory_barrier(data,
+                                   VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                   VK_ACCESS_TRANSFER_WRITE_BIT,
+                                   VK_PIPELINE_STAGE_HOST_BIT,
+                                   VK_ACCESS_HOST_READ_BIT);
+        }
+
         res = vkfn->vkEndCommandBuffer(context->command_buffer);
         if (res != VK_SUCCESS) {
                 vr_error_message(context->config,
@@ -277,6 +383,8 @@ end_command_buffer(struct test_data *data)
 
         invalidate_ssbos(data);
 
+        check_pending_probes(data);
+
         return true;
 }
 
@@ -285,6 +393,11 @@ begin_render_pass(struct test_data *data)
 {
         struct vr_vk *vkfn = &data->window->vkfn;
 
+        /* The executor only uses a window without a framebuffer for
+         * scripts that never render.
+         */
+        assert(!data->window->compute_only);
+
         VkRenderPassBeginInfo render_pass_begin_info = {
                 .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
                 .renderPass = (data->first_render ?
@@ -304,6 +417,7 @@ begin_render_pass(struct test_data *data)
                                    VK_SUBPASS_CONTENTS_INLINE);
 
         data->first_render = false;
+        data->framebuffer_copy.valid = false;
 
         return true;
 }
@@ -316,10 +430,21 @@ end_render_pass(struct test_data *data)
 
         vkfn->vkCmdEndRenderPass(window->context->command_buffer);
 
+        /* The deferred probes copy the parts of the framebuffer that
+         * they need themselves so the whole image is only needed for
+         * the inspection callback. That only looks at the final
+         * contents so there is no need to copy it if a later command
+         * is going to render again.
+         */
+        if (window->config->deferred_probes &&
+            (window->config->inspect_cb == NULL ||
+             data->command_index <= data->last_framebuffer_write))
+                return true;
+
         VkBufferImageCopy copy_region = {
                 .bufferOffset = 0,
-                .bufferRowLength = data->window->format.width,
-                .bufferImageHeight = data->window->format.height,
+                .bufferRowLength = data->window->image_width,
+                .bufferImageHeight = data->window->image_height,
                 .imageSubresource = {
                         .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
                         .mipLevel = 0,
@@ -473,49 +598,35 @@ get_ubo_buffer(struct test_data *data,
         return NULL;
 }
 
+static bool
+ensure_geometry(struct test_data *data)
+{
+        if (data->geometry)
+                return true;
+
+        const struct vr_script *script = data->script;
+
+        data->geometry =
+                vr_object_cache_get_buffer(data->pipeline->object_cache,
+                                           VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                                           VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                           script->geometry,
+                                           script->geometry_size);
+
+        return data->geometry != NULL;
+}
+
 static bool
 draw_rect(struct test_data *data,
           const struct vr_script_command *command)
 {
         struct vr_vk *vkfn = &data->window->vkfn;
-        struct test_buffer *buffer;
-
-        buffer = allocate_test_buffer(data,
-                                      sizeof (struct vr_pipeline_vertex) * 4,
-                                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-        if (buffer == NULL)
-                return false;
 
         if (!set_state(data, TEST_STATE_RENDER_PASS))
                 return false;
 
-        struct vr_pipeline_vertex *v = buffer->memory_map;
-
-        v->x = command->draw_rect.x;
-        v->y = command->draw_rect.y;
-        v->z = 0.0f;
-        v++;
-
-        v->x = command->draw_rect.x + command->draw_rect.w;
-        v->y = command->draw_rect.y;
-        v->z = 0.0f;
-        v++;
-
-        v->x = command->draw_rect.x;
-        v->y = command->draw_rect.y + command->draw_rect.h;
-        v->z = 0.0f;
-        v++;
-
-        v->x = command->draw_rect.x + command->draw_rect.w;
-        v->y = command->draw_rect.y + command->draw_rect.h;
-        v->z = 0.0f;
-        v++;
-
-        vr_flush_memory(data->window->context,
-                        buffer->memory_type_index,
-                        buffer->memory,
-                        0, /* offset */
-                        VK_WHOLE_SIZE);
+        if (!ensure_geometry(data))
+                return false;
 
         bind_ubo_descriptor_set(data);
         bind_pipeline(data, command->draw_rect.pipeline_key);
@@ -523,8 +634,10 @@ draw_rect(struct test_data *data,
         vkfn->vkCmdBindVertexBuffers(data->window->context->command_buffer,
                                      0, /* firstBinding */
                                      1, /* bindingCount */
-                                     &buffer->buffer,
-                                     (VkDeviceSize[]) { 0 });
+                                     &data->geometry->buffer.buffer,
+                                     (VkDeviceSize[]) {
+                                             command->draw_rect.vertex_offset
+                                     });
         vkfn->vkCmdDraw(data->window->context->command_buffer,
                         4, /* vertexCount */
                         1, /* instanceCount */
@@ -534,62 +647,6 @@ draw_rect(struct test_data *data,
         return true;
 }
 
-static bool
-ensure_index_buffer(struct test_data *data)
-{
-        if (data->index_buffer)
-                return true;
-
-        data->index_buffer =
-                allocate_test_buffer(data,
-                                     data->script->n_indices *
-                                     sizeof data->script->indices[0],
-                                     VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
-        if (data->index_buffer == NULL)
-                return false;
-
-        memcpy(data->index_buffer->memory_map,
-               data->script->indices,
-               data->script->n_indices * sizeof data->script->indices[0]);
-
-        vr_flush_memory(data->window->context,
-                        data->index_buffer->memory_type_index,
-                        data->index_buffer->memory,
-                        0, /* offset */
-                        VK_WHOLE_SIZE);
-
-        return true;
-}
-
-static bool
-ensure_vbo_buffer(struct test_data *data)
-{
-        struct vr_vbo *vbo = data->script->vertex_data;
-
-        if (vbo == NULL || data->vbo_buffer)
-                return true;
-
-        data->vbo_buffer =
-                allocate_test_buffer(data,
-                                     vbo->stride *
-                                     vbo->num_rows,
-                                     VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-        if (data->vbo_buffer == NULL)
-                return false;
-
-        memcpy(data->vbo_buffer->memory_map,
-               vbo->raw_data,
-               vbo->stride * vbo->num_rows);
-
-        vr_flush_memory(data->window->context,
-                        data->vbo_buffer->memory_type_index,
-                        data->vbo_buffer->memory,
-                        0, /* offset */
-                        VK_WHOLE_SIZE);
-
-        return true;
-}
-
 static bool
 draw_arrays(struct test_data *data,
             const struct vr_script_command *command)
@@ -600,29 +657,27 @@ draw_arrays(struct test_data *data,
         if (!set_state(data, TEST_STATE_RENDER_PASS))
                 return false;
 
-        struct vr_vbo *vbo = data->script->vertex_data;
-
-        if (vbo) {
-                if (!ensure_vbo_buffer(data))
-                        return false;
+        if (!ensure_geometry(data))
+                return false;
 
+        if (data->script->vertex_data) {
                 vkfn->vkCmdBindVertexBuffers(context->command_buffer,
                                              0, /* firstBinding */
                                              1, /* bindingCount */
-                                             &data->vbo_buffer->buffer,
-                                             (VkDeviceSize[]) { 0 });
-
+                                             &data->geometry->buffer.buffer,
+                                             (VkDeviceSize[]) {
+                                                     data->script->
+                                                     vertex_data_offset
+                                             });
         }
 
         bind_ubo_descriptor_set(data);
         bind_pipeline(data, command->draw_arrays.pipeline_key);
 
         if (command->draw_arrays.indexed) {
-                if (!ensure_index_buffer(data))
-                        return false;
                 vkfn->vkCmdBindIndexBuffer(context->command_buffer,
-                                           data->index_buffer->buffer,
-                                           0, /* offset */
+                                           data->geometry->buffer.buffer,
+                                           data->script->indices_offset,
                                            VK_INDEX_TYPE_UINT16);
                 vkfn->vkCmdDrawIndexed(context->command_buffer,
                                        command->draw_arrays.vertex_count,
@@ -711,25 +766,254 @@ print_bad_pixel(const struct vr_config *config,
         vr_buffer_destroy(&buf);
 }
 
+/* Reserves space in the readback buffer. If there isn’t enough space
+ * then the probes that are waiting are checked first so that their
+ * space can be reused.
+ */
+static bool
+reserve_readback_space(struct test_data *data,
+                       size_t size,
+                       size_t alignment,
+                       size_t *offset_out)
+{
+        size_t offset = 0;
+
+        if (data->readback_buffer) {
+                offset = ((data->readback_offset + alignment - 1) /
+                          alignment * alignment);
+                if (offset + size <= data->readback_buffer->size)
+                        goto found;
+
+                if (data->pending_probes.length > 0 &&
+                    !set_state(data, TEST_STATE_IDLE))
+                        return false;
+
+                offset = 0;
+                if (size <= data->readback_buffer->size)
+                        goto found;
+
+                free_test_buffer(data, data->readback_buffer);
+                data->readback_buffer = NULL;
+        }
+
+        data->readback_buffer =
+                allocate_test_buffer(data,
+                                     MAX(size, READBACK_BUFFER_SIZE),
+                                     VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        if (data->readback_buffer == NULL)
+                return false;
+
+found:
+        data->readback_offset = offset + size;
+        *offset_out = offset;
+
+        return true;
+}
+
+static void
+add_pending_probe(struct test_data *data,
+                  const struct vr_script_command *command,
+                  size_t offset,
+                  size_t stride)
+{
+        struct pending_probe probe = {
+                .command = command,
+                .offset = offset,
+                .stride = stride
+        };
+
+        vr_buffer_append(&data->pending_probes, &probe, sizeof probe);
+}
+
+static bool
+probe_rect_in_framebuffer(const struct test_data *data,
+                          const struct vr_script_command *command)
+{
+        return (command->probe_rect.x >= 0 &&
+                command->probe_rect.y >= 0 &&
+                command->probe_rect.w >= 0 &&
+                command->probe_rect.h >= 0 &&
+                command->probe_rect.x + command->probe_rect.w <=
+                data->window->format.width &&
+                command->probe_rect.y + command->probe_rect.h <=
+                data->window->format.height);
+}
+
+static bool
+framebuffer_copy_contains(const struct test_data *data,
+                          const struct vr_script_command *command)
+{
+        return (data->framebuffer_copy.valid &&
+                command->probe_rect.x >= data->framebuffer_copy.x &&
+                command->probe_rect.y >= data->framebuffer_copy.y &&
+                command->probe_rect.x + command->probe_rect.w <=
+                data->framebuffer_copy.x + data->framebuffer_copy.w &&
+                command->probe_rect.y + command->probe_rect.h <=
+                data->framebuffer_copy.y + data->framebuffer_copy.h);
+}
+
+static size_t
+get_framebuffer_copy_offset(const struct test_data *data,
+                            int x, int y)
+{
+        const struct vr_format *format = data->window->format.color_format;
+        int format_size = vr_format_get_size(format);
+
+        return (data->framebuffer_copy.offset +
+                ((size_t) (y - data->framebuffer_copy.y) *
+                 data->framebuffer_copy.w +
+                 (x - data->framebuffer_copy.x)) *
+                format_size);
+}
+
+/* Copies the region of the framebuffer that is needed by the probe
+ * rect command into the readback buffer. The commands that follow are
+ * looked at so that if they are also probes then the copy covers the
+ * union of all of their rectangles and they can share it.
+ */
+static bool
+copy_framebuffer_region(struct test_data *data,
+                        const struct vr_script_command *command)
+{
+        struct vr_vk *vkfn = &data->window->vkfn;
+        const struct vr_format *format =
+                data->window->format.color_format;
+        int format_size = vr_format_get_size(format);
+        const struct vr_script *script = data->script;
+        int x1 = command->probe_rect.x;
+        int y1 = command->probe_rect.y;
+        int x2 = x1 + command->probe_rect.w;
+        int y2 = y1 + command->probe_rect.h;
+        size_t offset;
+
+        for (const struct vr_script_command *next = command + 1;
+             next < script->commands + script->n_commands;
+             next++) {
+                if (next->op == VR_SCRIPT_OP_PROBE_SSBO)
+                        continue;
+                if (next->op != VR_SCRIPT_OP_PROBE_RECT)
+                        break;
+                if (!probe_rect_in_framebuffer(data, next) ||
+                    next->probe_rect.w == 0 ||
+                    next->probe_rect.h == 0)
+                        continue;
+
+                x1 = MIN(x1, next->probe_rect.x);
+                y1 = MIN(y1, next->probe_rect.y);
+                x2 = MAX(x2, next->probe_rect.x + next->probe_rect.w);
+                y2 = MAX(y2, next->probe_rect.y + next->probe_rect.h);
+        }
+
+        if (!reserve_readback_space(data,
+                                    (size_t) (x2 - x1) * (y2 - y1) *
+                                    format_size,
+                                    format_size * 4,
+                                    &offset))
+                return false;
+
+        /* The first render pass moves the image into the layout
+         * needed to copy it, so make sure it has happened even if
+         * nothing has been drawn yet.
+         */
+        if (data->first_render &&
+            !set_state(data, TEST_STATE_RENDER_PASS))
+                return false;
+
+        /* End the render pass so that the framebuffer can be copied */
+        if (!set_state(data, TEST_STATE_COMMAND_BUFFER))
+                return false;
+
+        add_memory_barrier(data,
+                           VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                           VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_ACCESS_TRANSFER_READ_BIT);
+
+        VkBufferImageCopy copy_region = {
+                .bufferOffset = offset,
+                .imageSubresource = {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .mipLevel = 0,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1
+                },
+                .imageOffset = { x1, y1, 0 },
+                .imageExtent = { x2 - x1, y2 - y1, 1 }
+        };
+        vkfn->vkCmdCopyImageToBuffer(data->window->context->command_buffer,
+                                     data->window->color_image,
+                                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                     data->readback_buffer->buffer,
+                                     1, /* regionCount */
+                                     &copy_region);
+
+        /* Later commands must not modify the framebuffer before it
+         * has been copied.
+         */
+        add_memory_barrier(data,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           0, /* src_access */
+                           VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                           0 /* dst_access */);
+
+        data->framebuffer_copy.valid = true;
+        data->framebuffer_copy.x = x1;
+        data->framebuffer_copy.y = y1;
+        data->framebuffer_copy.w = x2 - x1;
+        data->framebuffer_copy.h = y2 - y1;
+        data->framebuffer_copy.offset = offset;
+
+        return true;
+}
+
 static bool
 probe_rect(struct test_data *data,
            const struct vr_script_command *command)
 {
-        int n_components = command->probe_rect.n_components;
         const struct vr_format *format =
                 data->window->format.color_format;
         int format_size = vr_format_get_size(format);
 
-        /* End the paint to copy the framebuffer into the linear buffer */
-        if (!set_state(data, TEST_STATE_IDLE))
+        if (!probe_rect_in_framebuffer(data, command)) {
+                print_command_fail(data->window->config, command);
+                vr_error_message(data->window->config,
+                                 "Probe rectangle is outside of the "
+                                 "framebuffer");
                 return false;
+        }
+
+        if (command->probe_rect.w == 0 || command->probe_rect.h == 0)
+                return true;
+
+        if (!framebuffer_copy_contains(data, command) &&
+            !copy_framebuffer_region(data, command))
+                return false;
+
+        add_pending_probe(data,
+                          command,
+                          get_framebuffer_copy_offset(data,
+                                                      command->probe_rect.x,
+                                                      command->probe_rect.y),
+                          data->framebuffer_copy.w * format_size);
+
+        return true;
+}
+
+static bool
+check_probe_rect(struct test_data *data,
+                 const struct vr_script_command *command,
+                 const uint8_t *observed,
+                 size_t stride)
+{
+        int n_components = command->probe_rect.n_components;
+        const struct vr_format *format =
+                data->window->format.color_format;
+        int format_size = vr_format_get_size(format);
+        const uint8_t *p;
 
         for (int y = 0; y < command->probe_rect.h; y++) {
-                const uint8_t *p =
-                        ((y + command->probe_rect.y) *
-                         data->window->linear_memory_stride +
-                         command->probe_rect.x * format_size +
-                         (uint8_t *) data->window->linear_memory_map);
+                p = observed + y * stride;
+
                 for (int x = 0; x < command->probe_rect.w; x++) {
                         double pixel[4];
                         vr_format_load_pixel(format, p, pixel);
@@ -843,8 +1127,8 @@ static bool
 probe_ssbo(struct test_data *data,
            const struct vr_script_command *command)
 {
-        if (!set_state(data, TEST_STATE_IDLE))
-                return false;
+        struct vr_vk *vkfn = &data->window->vkfn;
+        size_t offset;
 
         struct test_buffer *buffer =
                 get_ubo_buffer(data,
@@ -858,24 +1142,72 @@ probe_ssbo(struct test_data *data,
                 return false;
         }
 
-        const uint8_t *expected = command->probe_ssbo.value;
         size_t type_size = vr_box_type_size(command->probe_ssbo.type,
                                             &command->probe_ssbo.layout);
         size_t observed_stride =
                 vr_box_type_array_stride(command->probe_ssbo.type,
                                          &command->probe_ssbo.layout);
+        size_t size = ((command->probe_ssbo.n_values - 1) * observed_stride +
+                       type_size);
 
-        if (command->probe_ssbo.offset +
-            (command->probe_ssbo.n_values - 1) * observed_stride +
-            type_size > buffer->size) {
+        if (command->probe_ssbo.offset + size > buffer->size) {
                 print_command_fail(data->window->config, command);
                 vr_error_message(data->window->config,
                                  "Invalid offset in probe command");
                 return false;
         }
 
-        const uint8_t *observed = ((const uint8_t *) buffer->memory_map +
-                                   command->probe_ssbo.offset);
+        if (!reserve_readback_space(data,
+                                    size,
+                                    16, /* alignment */
+                                    &offset))
+                return false;
+
+        if (!set_state(data, TEST_STATE_COMMAND_BUFFER))
+                return false;
+
+        add_memory_barrier(data,
+                           VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                           VK_ACCESS_SHADER_WRITE_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_ACCESS_TRANSFER_READ_BIT);
+
+        VkBufferCopy copy_region = {
+                .srcOffset = command->probe_ssbo.offset,
+                .dstOffset = offset,
+                .size = size
+        };
+        vkfn->vkCmdCopyBuffer(data->window->context->command_buffer,
+                              buffer->buffer,
+                              data->readback_buffer->buffer,
+                              1, /* regionCount */
+                              &copy_region);
+
+        /* Later commands must not modify the buffer before it has
+         * been copied.
+         */
+        add_memory_barrier(data,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           0, /* src_access */
+                           VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                           0 /* dst_access */);
+
+        add_pending_probe(data, command, offset, 0 /* stride */);
+
+        return true;
+}
+
+static bool
+check_probe_ssbo(struct test_data *data,
+                 const struct vr_script_command *command,
+                 const uint8_t *observed)
+{
+        const uint8_t *expected = command->probe_ssbo.value;
+        size_t type_size = vr_box_type_size(command->probe_ssbo.type,
+                                            &command->probe_ssbo.layout);
+        size_t observed_stride =
+                vr_box_type_array_stride(command->probe_ssbo.type,
+                                         &command->probe_ssbo.layout);
 
         for (size_t i = 0; i < command->probe_ssbo.n_values; i++) {
                 if (vr_box_compare(command->probe_ssbo.comparison,
@@ -918,6 +1250,100 @@ probe_ssbo(struct test_data *data,
         return true;
 }
 
+static bool
+check_pending_probe(struct test_data *data,
+                    const struct pending_probe *probe,
+                    const uint8_t *observed)
+{
+        switch (probe->command->op) {
+        case VR_SCRIPT_OP_PROBE_RECT:
+                return check_probe_rect(data,
+                                        probe->command,
+                                        observed,
+                                        probe->stride);
+        case VR_SCRIPT_OP_PROBE_SSBO:
+                return check_probe_ssbo(data, probe->command, observed);
+        default:
+                break;
+        }
+
+        vr_fatal("Unexpected pending probe");
+}
+
+/* Checks a probe rect straight away using the copy of the whole
+ * framebuffer that is made at the end of the render pass.
+ */
+static bool
+probe_rect_immediate(struct test_data *data,
+                     const struct vr_script_command *command)
+{
+        const struct vr_window *window = data->window;
+        int format_size = vr_format_get_size(window->format.color_format);
+
+        if (!probe_rect_in_framebuffer(data, command)) {
+                print_command_fail(window->config, command);
+                vr_error_message(window->config,
+                                 "Probe rectangle is outside of the "
+                                 "framebuffer");
+                return false;
+        }
+
+        /* End the paint to copy the framebuffer into the linear buffer */
+        if (!set_state(data, TEST_STATE_IDLE))
+                return false;
+
+        const uint8_t *observed =
+                ((const uint8_t *) window->linear_memory_map +
+                 command->probe_rect.y * window->linear_memory_stride +
+                 command->probe_rect.x * format_size);
+
+        return check_probe_rect(data,
+                                command,
+                                observed,
+                                window->linear_memory_stride);
+}
+
+/* Checks a probe ssbo straight away by reading the mapped buffer */
+static bool
+probe_ssbo_immediate(struct test_data *data,
+                     const struct vr_script_command *command)
+{
+        if (!set_state(data, TEST_STATE_IDLE))
+                return false;
+
+        struct test_buffer *buffer =
+                get_ubo_buffer(data,
+                               command->probe_ssbo.desc_set,
+                               command->probe_ssbo.binding);
+
+        if (buffer == NULL) {
+                print_command_fail(data->window->config, command);
+                vr_error_message(data->window->config,
+                                 "Invalid binding in probe command");
+                return false;
+        }
+
+        size_t type_size = vr_box_type_size(command->probe_ssbo.type,
+                                            &command->probe_ssbo.layout);
+        size_t observed_stride =
+                vr_box_type_array_stride(command->probe_ssbo.type,
+                                         &command->probe_ssbo.layout);
+
+        if (command->probe_ssbo.offset +
+            (command->probe_ssbo.n_values - 1) * observed_stride +
+            type_size > buffer->size) {
+                print_command_fail(data->window->config, command);
+                vr_error_message(data->window->config,
+                                 "Invalid offset in probe command");
+                return false;
+        }
+
+        return check_probe_ssbo(data,
+                                command,
+                                (const uint8_t *) buffer->memory_map +
+                                command->probe_ssbo.offset);
+}
+
 static bool
 set_push_constant(struct test_data *data,
                   const struct vr_script_command *command)
@@ -1032,15 +1458,18 @@ set_buffer_subdata(struct test_data *data,
                                command->set_buffer_subdata.binding);
         assert(buffer);
 
+        /* If there are probes waiting then the commands before them
+         * must see the old contents of the buffer.
+         */
+        if (data->pending_probes.length > 0 &&
+            !set_state(data, TEST_STATE_IDLE))
+                return false;
+
         memcpy((uint8_t *) buffer->memory_map +
                command->set_buffer_subdata.offset,
                command->set_buffer_subdata.data,
                command->set_buffer_subdata.size);
-        vr_flush_memory(data->window->context,
-                        buffer->memory_type_index,
-                        buffer->memory,
-                        command->set_push_constant.offset,
-                        command->set_buffer_subdata.size);
+        flush_test_buffer(data, buffer);
 
         return true;
 }
@@ -1121,11 +1550,14 @@ static bool
 run_commands(struct test_data *data)
 {
         const struct vr_script *script = data->script;
+        bool deferred_probes = data->window->config->deferred_probes;
         bool ret = true;
 
         for (int i = 0; i < script->n_commands; i++) {
                 const struct vr_script_command *command = script->commands + i;
 
+                data->command_index = i;
+
                 switch (command->op) {
                 case VR_SCRIPT_OP_DRAW_RECT:
                         if (!draw_rect(data, command))
@@ -1140,11 +1572,15 @@ run_commands(struct test_data *data)
                                 ret = false;
                         break;
                 case VR_SCRIPT_OP_PROBE_RECT:
-                        if (!probe_rect(data, command))
+                        if (!(deferred_probes ?
+                              probe_rect(data, command) :
+                              probe_rect_immediate(data, command)))
                                 ret = false;
                         break;
                 case VR_SCRIPT_OP_PROBE_SSBO:
-                        if (!probe_ssbo(data, command))
+                        if (!(deferred_probes ?
+                              probe_ssbo(data, command) :
+                              probe_ssbo_immediate(data, command)))
                                 ret = false;
                         break;
                 case VR_SCRIPT_OP_SET_PUSH_CONSTANT:
@@ -1162,9 +1598,28 @@ run_commands(struct test_data *data)
                 }
         }
 
+        data->command_index = script->n_commands;
+
         return ret;
 }
 
+static int
+find_last_framebuffer_write(const struct vr_script *script)
+{
+        for (int i = script->n_commands - 1; i >= 0; i--) {
+                switch (script->commands[i].op) {
+                case VR_SCRIPT_OP_DRAW_RECT:
+                case VR_SCRIPT_OP_DRAW_ARRAYS:
+                case VR_SCRIPT_OP_CLEAR:
+                        return i;
+                default:
+                        break;
+                }
+        }
+
+        return -1;
+}
+
 static void
 call_inspect(struct test_data *data)
 {
@@ -1196,8 +1651,12 @@ call_inspect(struct test_data *data)
         color_buffer->format = data->window->format.color_format;
         color_buffer->data = data->window->linear_memory_map;
 
-        data->window->config->inspect_cb(&inspect_data,
-                                         data->window->config->user_data);
+        const struct vr_config *config = data->window->config;
+        vr_mutex_t *mutex = (vr_mutex_t *) &config->callback_mutex;
+
+        vr_mutex_lock(mutex);
+        config->inspect_cb(&inspect_data, config->user_data);
+        vr_mutex_unlock(mutex);
 }
 
 bool
@@ -1213,7 +1672,9 @@ vr_test_run(struct vr_window *window,
                 .script = script,
                 .test_state = TEST_STATE_IDLE,
                 .first_render = true,
-                .bound_pipeline = UINT_MAX
+                .bound_pipeline = UINT_MAX,
+                .pending_probes = VR_BUFFER_STATIC_INIT,
+                .last_framebuffer_write = find_last_framebuffer_write(script)
         };
         bool ret = true;
 
@@ -1228,6 +1689,9 @@ vr_test_run(struct vr_window *window,
                 if (!set_state(&data, TEST_STATE_IDLE))
                         ret = false;
 
+                if (data.probe_failed)
+                        ret = false;
+
                 if (window->config->inspect_cb)
                         call_inspect(&data);
         }
@@ -1237,7 +1701,11 @@ vr_test_run(struct vr_window *window,
                 free_test_buffer(&data, buffer);
         }
 
+        if (data.geometry)
+                vr_object_cache_release(pipeline->object_cache, data.geometry);
+
         vr_free(data.ubo_buffers);
+        vr_buffer_destroy(&data.pending_probes);
 
         if (data.ubo_descriptor_set) {
                 for (unsigned i = 0; i < pipeline->n_desc_sets; i++) {
@@ -0,0 +1,199 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "vr-thread.h"
+#include "vr-util.h"
+
+struct vr_thread {
+#ifdef WIN32
+        HANDLE handle;
+#else
+        pthread_t thread;
+#endif
+        vr_thread_func func;
+        void *user_data;
+};
+
+#ifdef WIN32
+
+static DWORD WINAPI
+thread_main(LPVOID data)
+{
+        struct vr_thread *thread = data;
+
+        thread->func(thread->user_data);
+
+        return 0;
+}
+
+struct vr_thread *
+vr_thread_start(vr_thread_func func,
+                void *user_data)
+{
+        struct vr_thread *thread = vr_alloc(sizeof *thread);
+
+        thread->func = func;
+        thread->user_data = user_data;
+
+        thread->handle = CreateThread(NULL, /* lpThreadAttributes */
+                                      0, /* dwStackSize */
+                                      thread_main,
+                                      thread,
+                                      0, /* dwCreationFlags */
+                                      NULL /* lpThreadId */);
+        if (thread->handle == NULL) {
+                vr_free(thread);
+                return NULL;
+        }
+
+        return thread;
+}
+
+void
+vr_thread_join(struct vr_thread *thread)
+{
+        WaitForSingleObject(thread->handle, INFINITE);
+        CloseHandle(thread->handle);
+        vr_free(thread);
+}
+
+static BOOL CALLBACK
+once_cb(PINIT_ONCE once,
+        PVOID parameter,
+        PVOID *context)
+{
+        void (* func)(void) = (void (*)(void)) parameter;
+
+        func();
+
+        return TRUE;
+}
+
+void
+vr_thread_once(vr_once_t *once,
+               void (* func)(void))
+{
+        InitOnceExecuteOnce(once,
+                            once_cb,
+                            (PVOID) func,
+                            NULL /* lpContext */);
+}
+
+void
+vr_mutex_init(vr_mutex_t *mutex)
+{
+        InitializeSRWLock(mutex);
+}
+
+void
+vr_mutex_destroy(vr_mutex_t *mutex)
+{
+}
+
+void
+vr_mutex_lock(vr_mutex_t *mutex)
+{
+        AcquireSRWLockExclusive(mutex);
+}
+
+void
+vr_mutex_unlock(vr_mutex_t *mutex)
+{
+        ReleaseSRWLockExclusive(mutex);
+}
+
+#else /* WIN32 */
+
+static void *
+thread_main(void *data)
+{
+        struct vr_thread *thread = data;
+
+        thread->func(thread->user_data);
+
+        return NULL;
+}
+
+struct vr_thread *
+vr_thread_start(vr_thread_func func,
+                void *user_data)
+{
+        struct vr_thread *thread = vr_alloc(sizeof *thread);
+
+        thread->func = func;
+        thread->user_data = user_data;
+
+        if (pthread_create(&thread->thread,
+                           NULL, /* attr */
+                           thread_main,
+                           thread) != 0) {
+                vr_free(thread);
+                return NULL;
+        }
+
+        return thread;
+}
+
+void
+vr_thread_join(struct vr_thread *thread)
+{
+        pthread_join(thread->thread, NULL /* retval */);
+        vr_free(thread);
+}
+
+void
+vr_thread_once(vr_once_t *once,
+               void (* func)(void))
+{
+        pthread_once(once, func);
+}
+
+void
+vr_mutex_init(vr_mutex_t *mutex)
+{
+        pthread_mutex_init(mutex, NULL /* attr */);
+}
+
+void
+vr_mutex_destroy(vr_mutex_t *mutex)
+{
+        pthread_mutex_destroy(mutex);
+}
+
+void
+vr_mutex_lock(vr_mutex_t *mutex)
+{
+        pthread_mutex_lock(mutex);
+}
+
+void
+vr_mutex_unlock(vr_mutex_t *mutex)
+{
+        pthread_mutex_unlock(mutex);
+}
+
+#endif /* WIN32 */
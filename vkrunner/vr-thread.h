@@ -0,0 +1,77 @@
+/*
+ * vkrunner
+ *
+ * Copyright (C) 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VR_THREAD_H
+#define VR_THREAD_H
+
+#ifdef WIN32
+#include <windows.h>
+typedef INIT_ONCE vr_once_t;
+#define VR_ONCE_INIT INIT_ONCE_STATIC_INIT
+typedef SRWLOCK vr_mutex_t;
+#else
+#include <pthread.h>
+typedef pthread_once_t vr_once_t;
+#define VR_ONCE_INIT PTHREAD_ONCE_INIT
+typedef pthread_mutex_t vr_mutex_t;
+#endif
+
+struct vr_thread;
+
+typedef void
+(* vr_thread_func)(void *user_data);
+
+/* Starts a new thread running func. Returns NULL if the thread
+ * couldn’t be created in which case the caller should run the
+ * function itself.
+ */
+struct vr_thread *
+vr_thread_start(vr_thread_func func,
+                void *user_data);
+
+/* Waits for the thread to finish and frees it */
+void
+vr_thread_join(struct vr_thread *thread);
+
+/* Calls func exactly once for the given once variable even if this
+ * is called from multiple threads.
+ */
+void
+vr_thread_once(vr_once_t *once,
+               void (* func)(void));
+
+void
+vr_mutex_init(vr_mutex_t *mutex);
+
+void
+vr_mutex_destroy(vr_mutex_t *mutex);
+
+void
+vr_mutex_lock(vr_mutex_t *mutex);
+
+void
+vr_mutex_unlock(vr_mutex_t *mutex);
+
+#endif /* VR_THREAD_H */
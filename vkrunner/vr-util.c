@@ -118,6 +118,21 @@ vr_memdup(const void *data, size_t size)
         return ret;
 }
 
+uint64_t
+vr_hash_data(uint64_t hash,
+             const void *data,
+             size_t size)
+{
+        const uint8_t *p = data;
+
+        for (size_t i = 0; i < size; i++) {
+                hash ^= p[i];
+                hash *= UINT64_C(0x100000001b3);
+        }
+
+        return hash;
+}
+
 char *
 vr_strconcat(const char *string1, ...)
 {
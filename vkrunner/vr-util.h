@@ -139,6 +139,15 @@ vr_memdup(const void *data, size_t size);
 VR_NULL_TERMINATED char *
 vr_strconcat(const char *string1, ...);
 
+/* Initial value for vr_hash_data */
+#define VR_HASH_INIT UINT64_C(0xcbf29ce484222325)
+
+/* Continues a 64-bit FNV-1a hash with the given data */
+uint64_t
+vr_hash_data(uint64_t hash,
+             const void *data,
+             size_t size);
+
 void
 vr_free(void *ptr);
 
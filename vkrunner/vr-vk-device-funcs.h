@@ -10,6 +10,7 @@ VR_VK_FUNC(vkCmdBindIndexBuffer)
 VR_VK_FUNC(vkCmdBindPipeline)
 VR_VK_FUNC(vkCmdBindVertexBuffers)
 VR_VK_FUNC(vkCmdClearAttachments)
+VR_VK_FUNC(vkCmdCopyBuffer)
 VR_VK_FUNC(vkCmdCopyBufferToImage)
 VR_VK_FUNC(vkCmdCopyImageToBuffer)
 VR_VK_FUNC(vkCmdDispatch)
@@ -62,8 +63,10 @@ VR_VK_FUNC(vkGetBufferMemoryRequirements)
 VR_VK_FUNC(vkGetDeviceQueue)
 VR_VK_FUNC(vkGetImageMemoryRequirements)
 VR_VK_FUNC(vkGetImageSubresourceLayout)
+VR_VK_FUNC(vkGetPipelineCacheData)
 VR_VK_FUNC(vkInvalidateMappedMemoryRanges)
 VR_VK_FUNC(vkMapMemory)
+VR_VK_FUNC(vkMergePipelineCaches)
 VR_VK_FUNC(vkQueueSubmit)
 VR_VK_FUNC(vkQueueWaitIdle)
 VR_VK_FUNC(vkResetFences)
@@ -464,21 +464,31 @@ init_framebuffer_resources(struct vr_window *window)
         return true;
 }
 
-enum vr_result
-vr_window_new(struct vr_context *context,
-              const struct vr_window_format *format,
-              struct vr_window **window_out)
+static struct vr_window *
+create_window(struct vr_context *context,
+              const struct vr_window_format *format)
 {
         struct vr_window *window = vr_calloc(sizeof *window);
-        struct vr_vk *vkfn = &window->vkfn;
-        enum vr_result vres;
 
         window->context = context;
         window->config = context->config;
         window->device = context->device;
-        *vkfn = context->vkfn;
+        window->vkfn = context->vkfn;
 
         window->format = *format;
+        window->image_width = format->width;
+        window->image_height = format->height;
+
+        return window;
+}
+
+enum vr_result
+vr_window_new(struct vr_context *context,
+              const struct vr_window_format *format,
+              struct vr_window **window_out)
+{
+        struct vr_window *window = create_window(context, format);
+        enum vr_result vres;
 
         if (!check_format(window,
                           format->color_format,
@@ -517,6 +527,29 @@ error:
         return vres;
 }
 
+struct vr_window *
+vr_window_new_compute_only(struct vr_context *context,
+                           const struct vr_window_format *format)
+{
+        struct vr_window *window = create_window(context, format);
+
+        window->compute_only = true;
+
+        return window;
+}
+
+bool
+vr_window_is_compatible(const struct vr_window *window,
+                        const struct vr_window_format *format)
+{
+        return (!window->compute_only &&
+                window->format.color_format == format->color_format &&
+                (window->format.depth_stencil_format ==
+                 format->depth_stencil_format) &&
+                window->image_width >= format->width &&
+                window->image_height >= format->height);
+}
+
 void
 vr_window_free(struct vr_window *window)
 {
@@ -60,7 +60,20 @@ struct vr_window {
         VkDeviceMemory depth_image_memory;
         VkImageView depth_image_view;
         VkFramebuffer framebuffer;
+        /* The format requested by the script that is using the
+         * window. The images can be bigger than this if the window
+         * is reused for a smaller size, in which case rendering is
+         * limited to the top-left corner.
+         */
         struct vr_window_format format;
+        /* The size that the images were created with */
+        size_t image_width, image_height;
+
+        /* If this is true then the window doesn’t have any of the
+         * framebuffer resources and it can only be used to run
+         * compute shaders.
+         */
+        bool compute_only;
 };
 
 enum vr_result
@@ -68,6 +81,17 @@ vr_window_new(struct vr_context *context,
               const struct vr_window_format *format,
               struct vr_window **window_out);
 
+/* Returns whether the window can be used to render with the given
+ * format. It has to have the same formats and be at least as big.
+ */
+bool
+vr_window_is_compatible(const struct vr_window *window,
+                        const struct vr_window_format *format);
+
+struct vr_window *
+vr_window_new_compute_only(struct vr_context *context,
+                           const struct vr_window_format *format);
+
 void
 vr_window_free(struct vr_window *window);
 